@@ -0,0 +1,146 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Minimal timing harness shared by the benchmark programs in this folder.
+// Every benchmark prints a single JSON document so results can be diffed
+// and tracked over time.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BENCH_HAS_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_RDTSC
+#endif
+
+// Written to by benchmark bodies so the compiler cannot drop the work
+static volatile float benchSink;
+
+inline uint64_t BenchCycles()
+{
+#ifdef BENCH_HAS_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+inline double BenchSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchResult
+{
+    std::string group;      // e.g. "linmath" or "glm"
+    std::string name;       // operation being measured
+    std::string variant;    // "scalar" (dependent chain) or "batch" (independent ops)
+    uint64_t ops;
+    double nsPerOp;
+    double cyclesPerOp;     // 0 when no cycle counter is available
+    double opsPerSec;
+};
+
+// Calls fn() - which performs opsPerCall operations - until minSeconds have
+// passed, repeats that reps times and keeps the median run.
+template <typename Fn>
+BenchResult BenchRun(const char* group, const char* name, const char* variant, uint64_t opsPerCall, Fn&& fn, double minSeconds = 0.02, int reps = 7)
+{
+    // warm caches and pick an iteration count that fills minSeconds
+    uint64_t iters = 1;
+    for (;;)
+    {
+        double t0 = BenchSeconds();
+        for (uint64_t i = 0; i < iters; i++)
+            fn();
+        if (BenchSeconds() - t0 >= minSeconds || iters >= (1ull << 40))
+            break;
+        iters *= 2;
+    }
+
+    std::vector<double> ns, cycles;
+    for (int r = 0; r < reps; r++)
+    {
+        double t0 = BenchSeconds();
+        uint64_t c0 = BenchCycles();
+        for (uint64_t i = 0; i < iters; i++)
+            fn();
+        uint64_t c1 = BenchCycles();
+        double t1 = BenchSeconds();
+        double n = (double)(iters * opsPerCall);
+        ns.push_back((t1 - t0) * 1e9 / n);
+        cycles.push_back((double)(c1 - c0) / n);
+    }
+    std::sort(ns.begin(), ns.end());
+    std::sort(cycles.begin(), cycles.end());
+
+    BenchResult res;
+    res.group = group;
+    res.name = name;
+    res.variant = variant;
+    res.ops = iters * opsPerCall;
+    res.nsPerOp = ns[ns.size() / 2];
+    res.cyclesPerOp = cycles[cycles.size() / 2];
+    res.opsPerSec = res.nsPerOp > 0.0 ? 1e9 / res.nsPerOp : 0.0;
+    return res;
+}
+
+inline void BenchWriteJson(FILE* out, const char* suite, const std::vector<BenchResult>& results)
+{
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    std::fprintf(out, "{\n  \"suite\": \"%s\",\n  \"timestamp\": \"%s\",\n", suite, stamp);
+#if defined(_MSC_VER)
+    std::fprintf(out, "  \"compiler\": \"msvc %d\",\n", _MSC_VER);
+#elif defined(__clang__)
+    std::fprintf(out, "  \"compiler\": \"clang %s\",\n", __clang_version__);
+#elif defined(__GNUC__)
+    std::fprintf(out, "  \"compiler\": \"gcc %s\",\n", __VERSION__);
+#else
+    std::fprintf(out, "  \"compiler\": \"unknown\",\n");
+#endif
+#ifdef BENCH_HAS_RDTSC
+    std::fprintf(out, "  \"cycle_counter\": \"rdtsc\",\n");
+#else
+    std::fprintf(out, "  \"cycle_counter\": null,\n");
+#endif
+    std::fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        std::fprintf(out,
+            "    {\"group\": \"%s\", \"name\": \"%s\", \"variant\": \"%s\", \"ops\": %llu, "
+            "\"ns_per_op\": %.4f, \"cycles_per_op\": %.3f, \"ops_per_sec\": %.1f}%s\n",
+            r.group.c_str(), r.name.c_str(), r.variant.c_str(), (unsigned long long)r.ops,
+            r.nsPerOp, r.cyclesPerOp, r.opsPerSec, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+// Writes to the path given as argv[1], or stdout when none is given
+inline int BenchFinish(int argc, char** argv, const char* suite, const std::vector<BenchResult>& results)
+{
+    FILE* out = stdout;
+    if (argc > 1 && !(out = std::fopen(argv[1], "w")))
+    {
+        std::fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+    BenchWriteJson(out, suite, results);
+    if (out != stdout)
+        std::fclose(out);
+    return 0;
+}
+
+#endif
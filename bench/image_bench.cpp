@@ -0,0 +1,1480 @@
+// Texture decode benchmarks for stb_image.h over the textures the game and
+// the learnOpengl samples ship with (Textures/*.jpg, resources/textures/*.png).
+//
+// "concurrent" decodes the whole corpus on every hardware thread at once,
+// half of the threads with a flipped per-load stbi_load_options, and
+// checks each result byte for byte against a serial decode. Any mismatch
+// is printed to stderr and makes the program exit with 1.
+//
+// "jpeg_restart" decodes each JPEG that has restart markers serially and
+// through stbi_load_options::parallel_for, and checks the results match.
+// The shipped textures have none, so bench/data holds small re-encodes of
+// Desk.jpg (4:2:0, an interval every 64 MCUs) and coaster.jpg (4:4:4, every
+// 2 MCU rows); pass more as extra images, e.g. jpegtran -restart 1.
+//
+// "png_pipeline" does the same for every non-interlaced PNG, where
+// parallel_for overlaps inflate with unfiltering.
+//
+// "file_load" loads each file from disk through stdio (stbi_load) and
+// through a mapping (stbi_load_mmap), and checks both match. Repeated
+// loads hit the page cache, so this measures the I/O path, not the disk.
+//
+// "arena" decodes the corpus over and over like a level load (ops are
+// images) with and without stbi_set_thread_arena, through a counting
+// stbi_allocator. Heap calls and the peak of live heap bytes - what the
+// process footprint follows - are printed to stderr.
+//
+// "load_into" fills a flipped staging buffer with padded rows, the way a
+// mapped pixel buffer is filled for upload: stbi_load_ex followed by a row
+// copy, against stbi_load_into_from_memory, and checks both match. It also
+// checks 16-bit RGB and RGBA PNGs loaded as 1 to 4 channels against stbi_load.
+//
+// "jpeg_scaled" decodes each JPEG at 1/1, 1/2, 1/4 and 1/8 size through
+// stbi_load_options::scale_denom. The mean difference to a box-filtered
+// full-size decode is printed to stderr; above 4 levels counts as an error.
+//
+// "bands" uploads each image in 16-row bands the way a streaming texture
+// loader would: stbi_load_ex followed by copies of each band, against
+// stbi_load_bands_from_memory, and checks both match. The peak of live heap
+// bytes for each is printed to stderr. 16-bit PNGs are checked as in
+// "load_into".
+//
+// "jpeg_crop" cuts a 256x256 tile out of the middle of each JPEG, as an
+// atlas or tiled streamer would: a full decode followed by a copy of the
+// tile, against stbi_load_options::crop_*, and checks both match.
+//
+// "jpeg_avx2" times the SSE2 and AVX2 JPEG kernels (IDCT, YCbCr to RGB, 2x2
+// chroma upsampling) on random input and the whole decode with
+// stbi_load_options::no_avx2 set and clear, and checks the outputs are
+// identical. Skipped on CPUs without AVX2.
+//
+// "inflate" runs the zlib stream of each PNG (its IDAT chunks joined)
+// through stbi_zlib_decode_malloc and stbi_zlib_decode_buffer, and times a
+// whole stbi_load of the PNG next to them. Both outputs must have the size
+// IHDR implies and match each other. Decoded megabytes are printed to
+// stderr, to turn the times into throughput.
+//
+// "png_unfilter" checks the SIMD PNG unfilter kernels byte for byte against
+// a plain implementation of the filters: each kernel on rows of random
+// bytes, and whole decodes of random PNGs (RGB/RGBA, 8 and 16 bit, every
+// row a random filter type). It then times decodes of 1024x1024 PNGs of
+// random filtered rows, stored uncompressed so unfiltering dominates, with
+// stbi_load_options::no_avx2 set and clear.
+//
+// "convert" checks the SSE2 and AVX2 channel converters (gray, gray+alpha,
+// RGB and RGBA into each other, 8 and 16 bit) byte for byte against the
+// scalar loops on rows of random bytes, and times each level on 1024-pixel
+// rows. It then times the end of a flipped RGB to RGBA load: conversion
+// and a separate flip pass (the old byte-at-a-time one, and row swapping)
+// against the flip folded into the conversion.
+//
+// "gif_stream" builds a 512x512 animated GIF - a full first frame, then a
+// round sprite moving over it that is kept, cleared to the background or
+// taken off again in turn - and checks every frame of stbi_gif_stream
+// against a plain compositor, twice with a rewind in between. It then
+// times playing it against decoding each frame stored as a GIF of its own,
+// which is what playback took before, and prints the heap calls of both.
+//
+// Usage: image_bench [out.json] [repo root, default ".."] [extra images...]
+
+#include "bench.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+static const char* const CORPUS[] = {
+    "Textures/BrickTexture.jpg",
+    "Textures/Desk.jpg",
+    "Textures/Gray.jpg",
+    "Textures/black.jpg",
+    "Textures/coaster.jpg",
+    "Textures/coasterBottom.jpg",
+    "resources/textures/bandana.png",
+    "resources/textures/smiley.png",
+    "bench/data/desk_rst.jpg",
+    "bench/data/coaster_rst.jpg",
+};
+const int CORPUS_SIZE = sizeof(CORPUS) / sizeof(CORPUS[0]);
+
+struct ImageFile
+{
+    std::string path;
+    std::vector<unsigned char> bytes;
+    std::vector<unsigned char> pixels;          // serial decode, desired_channels = 4
+    std::vector<unsigned char> pixelsFlipped;   // same, flip_vertically = 1
+    int width = 0, height = 0;
+};
+
+static bool ReadFile(const std::string& path, std::vector<unsigned char>& out)
+{
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    std::fseek(f, 0, SEEK_END);
+    long size = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    out.resize(size > 0 ? (size_t)size : 0);
+    bool ok = size > 0 && std::fread(out.data(), 1, out.size(), f) == out.size();
+    std::fclose(f);
+    return ok;
+}
+
+// stbi_load_options::parallel_for on plain std::threads, one per hardware thread
+static void ParallelFor(void*, int count, void (*task)(void* taskData, int index), void* taskData)
+{
+    std::atomic<int> next(0);
+    auto worker = [&] {
+        for (int i; (i = next++) < count;)
+            task(taskData, i);
+    };
+    int threads = std::min((int)std::thread::hardware_concurrency(), count) - 1;
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+}
+
+static bool Decode(const ImageFile& file, int flip, std::vector<unsigned char>& out, int& w, int& h, bool parallel = false)
+{
+    stbi_load_options opt;
+    stbi_load_options_init(&opt);
+    opt.flip_vertically = flip;
+    if (parallel)
+        opt.parallel_for = ParallelFor;
+    int n;
+    stbi_uc* data = stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4);
+    if (!data)
+        return false;
+    out.assign(data, data + (size_t)w * h * 4);
+    stbi_image_free(data);
+    return true;
+}
+
+// Every thread decodes the corpus `rounds` times; odd threads flip. Returns the number of mismatches.
+static int DecodeConcurrently(const std::vector<ImageFile>& corpus, int threads, int rounds)
+{
+    std::atomic<int> errors(0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+        pool.emplace_back([&, t] {
+            int flip = t & 1;
+            std::vector<unsigned char> pixels;
+            for (int r = 0; r < rounds; r++)
+            {
+                for (size_t i = 0; i < corpus.size(); i++)
+                {
+                    const ImageFile& file = corpus[i];
+                    int w, h;
+                    if (!Decode(file, flip, pixels, w, h) || w != file.width || h != file.height
+                        || pixels != (flip ? file.pixelsFlipped : file.pixels))
+                    {
+                        std::fprintf(stderr, "thread %d: %s decoded differently (%s)\n", t, file.path.c_str(),
+                                     stbi_failure_reason() ? stbi_failure_reason() : "no reason");
+                        errors++;
+                    }
+                }
+                // a failing load on this thread must not leak its reason into the others
+                int w, h, n;
+                static const stbi_uc junk[16] = { 0 };
+                if (stbi_load_from_memory(junk, sizeof(junk), &w, &h, &n, 4) || !stbi_failure_reason())
+                    errors++;
+            }
+        });
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+    return errors;
+}
+
+static int BenchConcurrent(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    int cores = (int)std::thread::hardware_concurrency();
+    if (cores < 1)
+        cores = 1;
+
+    int errors = DecodeConcurrently(corpus, cores > 1 ? cores : 2, 4);
+
+    // ops are decoded images; with enough cores ns_per_op should drop close to 1 / cores
+    const int threadCounts[] = { 1, cores };
+    for (int k = 0; k < (cores > 1 ? 2 : 1); k++)
+    {
+        int threads = threadCounts[k];
+        char variant[32];
+        std::snprintf(variant, sizeof(variant), "%d_threads", threads);
+        results.push_back(BenchRun("concurrent", "corpus_rgba", variant, (uint64_t)threads * corpus.size(), [&] {
+            errors += DecodeConcurrently(corpus, threads, 1);
+        }, 0.2, 3));
+    }
+    return errors;
+}
+
+static bool IsPng(const std::vector<unsigned char>& bytes)
+{
+    return bytes.size() > 28 && bytes[0] == 0x89 && bytes[1] == 'P' && bytes[2] == 'N' && bytes[3] == 'G';
+}
+
+// true for JPEGs with a DRI segment before the first scan
+static bool HasRestartMarkers(const std::vector<unsigned char>& bytes)
+{
+    size_t i = 2;
+    if (bytes.size() < 4 || bytes[0] != 0xff || bytes[1] != 0xd8)
+        return false;
+    while (i + 4 <= bytes.size() && bytes[i] == 0xff)
+    {
+        int marker = bytes[i + 1];
+        if (marker == 0xdd)
+            return true;
+        if (marker == 0xda)
+            break;
+        i += 2 + (bytes[i + 2] << 8 | bytes[i + 3]);
+    }
+    return false;
+}
+
+// serial against parallel_for decodes of every corpus file accepted by filter
+static int BenchParallel(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results,
+                         const char* group, bool (*filter)(const std::vector<unsigned char>&))
+{
+    int errors = 0;
+    bool any = false;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        if (!filter(file.bytes))
+            continue;
+        any = true;
+        std::vector<unsigned char> pixels;
+        int w, h;
+        if (!Decode(file, 0, pixels, w, h, true) || pixels != file.pixels)
+        {
+            std::fprintf(stderr, "%s: parallel decode differs from serial\n", file.path.c_str());
+            errors++;
+        }
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        results.push_back(BenchRun(group, name.c_str(), "serial", 1, [&] {
+            Decode(file, 0, pixels, w, h);
+        }, 0.1, 5));
+        results.push_back(BenchRun(group, name.c_str(), "parallel", 1, [&] {
+            Decode(file, 0, pixels, w, h, true);
+        }, 0.1, 5));
+    }
+    if (!any)
+        std::fprintf(stderr, "%s: no matching images, skipped\n", group);
+    return errors;
+}
+
+// stbi_load against stbi_load_mmap on every corpus file
+static int BenchFileLoad(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    int errors = 0;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        int w, h, n;
+        stbi_uc* viaFile = stbi_load(file.path.c_str(), &w, &h, &n, 4);
+        stbi_uc* viaMap = stbi_load_mmap(file.path.c_str(), &w, &h, &n, 4);
+        if (!viaFile || !viaMap || std::memcmp(viaFile, file.pixels.data(), file.pixels.size())
+            || std::memcmp(viaMap, file.pixels.data(), file.pixels.size()))
+        {
+            std::fprintf(stderr, "%s: file and mmap loads differ\n", file.path.c_str());
+            errors++;
+        }
+        stbi_image_free(viaFile);
+        stbi_image_free(viaMap);
+
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        results.push_back(BenchRun("file_load", name.c_str(), "stdio", 1, [&] {
+            stbi_image_free(stbi_load(file.path.c_str(), &w, &h, &n, 4));
+        }, 0.1, 5));
+        results.push_back(BenchRun("file_load", name.c_str(), "mmap", 1, [&] {
+            stbi_image_free(stbi_load_mmap(file.path.c_str(), &w, &h, &n, 4));
+        }, 0.1, 5));
+    }
+    return errors;
+}
+
+// stbi_allocator that counts calls and live bytes, keeping each size in a 16-byte header
+struct HeapCounter
+{
+    uint64_t calls = 0;
+    size_t live = 0, peak = 0;
+
+    static HeapCounter& Get()
+    {
+        static HeapCounter counter;
+        return counter;
+    }
+    static void Track(size_t add, size_t remove)
+    {
+        HeapCounter& c = Get();
+        c.calls++;
+        c.live += add - remove;
+        c.peak = std::max(c.peak, c.live);
+    }
+    static void* Malloc(void*, size_t size)
+    {
+        size_t* p = (size_t*)std::malloc(size + 16);
+        if (!p)
+            return nullptr;
+        *p = size;
+        Track(size, 0);
+        return (char*)p + 16;
+    }
+    static void* Realloc(void*, void* old, size_t, size_t size)
+    {
+        size_t oldSize = old ? *(size_t*)((char*)old - 16) : 0;
+        size_t* p = (size_t*)std::realloc(old ? (char*)old - 16 : nullptr, size + 16);
+        if (!p)
+            return nullptr;
+        *p = size;
+        Track(size, oldSize);
+        return (char*)p + 16;
+    }
+    static void Free(void*, void* ptr)
+    {
+        if (!ptr)
+            return;
+        Track(0, *(size_t*)((char*)ptr - 16));
+        std::free((char*)ptr - 16);
+    }
+};
+
+static int BenchArena(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    const int rounds = 25;
+    int errors = 0;
+    stbi_allocator counting = { HeapCounter::Malloc, HeapCounter::Realloc, HeapCounter::Free, nullptr };
+    stbi_set_allocator(&counting);
+    for (int arena = 0; arena < 2; arena++)
+    {
+        stbi_set_thread_arena(arena);
+        HeapCounter& heap = HeapCounter::Get();
+        std::vector<unsigned char> pixels;
+        int w, h;
+        for (size_t i = 0; i < corpus.size(); i++)
+        {
+            if (!Decode(corpus[i], 0, pixels, w, h) || pixels != corpus[i].pixels)
+            {
+                std::fprintf(stderr, "%s: decode with arena %d differs\n", corpus[i].path.c_str(), arena);
+                errors++;
+            }
+        }
+
+        // one more pass to count; the arena is warm by now, as it would be a few textures into a level
+        heap.calls = 0;
+        heap.peak = heap.live;
+        for (size_t i = 0; i < corpus.size(); i++)
+            Decode(corpus[i], 0, pixels, w, h);
+        std::fprintf(stderr, "arena %s: %.1f heap calls per image, peak %.1f MB live heap\n", arena ? "on" : "off",
+                     (double)heap.calls / (double)corpus.size(), (double)heap.peak / (1024.0 * 1024.0));
+
+        results.push_back(BenchRun("arena", "corpus_rgba", arena ? "arena" : "heap", (uint64_t)rounds * corpus.size(), [&] {
+            for (int r = 0; r < rounds; r++)
+                for (size_t i = 0; i < corpus.size(); i++)
+                    Decode(corpus[i], 0, pixels, w, h);
+        }, 0.2, 3));
+    }
+    stbi_set_thread_arena(0);
+    if (HeapCounter::Get().live != 0)
+    {
+        std::fprintf(stderr, "arena: %zu bytes still allocated\n", HeapCounter::Get().live);
+        errors++;
+    }
+    stbi_set_allocator(nullptr);
+    return errors;
+}
+
+// malloc'd decode plus a copy into the staging buffer, against decoding straight into it
+static std::vector<unsigned char> MakePng(int w, int h, int depth, int colorType, const std::vector<unsigned char>& rows);
+
+// a 16-bit RGB (colorType 2) or RGBA (6) PNG of random pixels, for checking
+// the conversions that happen before narrowing to 8 bits
+static std::vector<unsigned char> MakeRandomPng16(int w, int h, int colorType)
+{
+    size_t rowBytes = (size_t)w * (colorType == 6 ? 8 : 6) + 1;
+    std::vector<unsigned char> rows(rowBytes * h);
+    uint32_t seed = 1234;
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        rows[i] = i % rowBytes ? (unsigned char)(seed >> 24) : 0;  // filter none
+    }
+    return MakePng(w, h, 16, colorType, rows);
+}
+
+static int BenchLoadInto(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    int errors = 0;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        int stride = (file.width * 4 + 255) & ~255;  // rows aligned like a typical staging buffer
+        std::vector<unsigned char> viaCopy((size_t)stride * file.height), viaInto(viaCopy.size());
+        stbi_load_options opt;
+        stbi_load_options_init(&opt);
+        opt.flip_vertically = 1;
+        int w, h, n;
+
+        auto loadAndCopy = [&] {
+            stbi_uc* data = stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4);
+            if (!data)
+                return false;
+            for (int y = 0; y < h; y++)
+                std::memcpy(&viaCopy[(size_t)y * stride], data + (size_t)y * w * 4, (size_t)w * 4);
+            stbi_image_free(data);
+            return true;
+        };
+        auto loadInto = [&] {
+            return stbi_load_into_from_memory(file.bytes.data(), (int)file.bytes.size(), &opt, viaInto.data(), stride, file.height, &w, &h, &n, 4) != 0;
+        };
+
+        bool ok = loadAndCopy() && loadInto() && viaCopy == viaInto;
+        for (int y = 0; ok && y < file.height; y++)
+            ok = std::memcmp(&viaInto[(size_t)y * stride], &file.pixelsFlipped[(size_t)y * file.width * 4], (size_t)file.width * 4) == 0;
+        if (!ok)
+        {
+            std::fprintf(stderr, "%s: stbi_load_into differs\n", file.path.c_str());
+            errors++;
+        }
+
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        results.push_back(BenchRun("load_into", name.c_str(), "load_copy", 1, [&] { loadAndCopy(); }, 0.1, 5));
+        results.push_back(BenchRun("load_into", name.c_str(), "load_into", 1, [&] { loadInto(); }, 0.1, 5));
+    }
+
+    // 16-bit color to every channel count, gray included, has to give what stbi_load gives
+    for (int colorType : { 2, 6 })
+    {
+        const int w = 67, h = 23;
+        std::vector<unsigned char> png = MakeRandomPng16(w, h, colorType);
+        for (int reqComp = 1; reqComp <= 4; reqComp++)
+        {
+            int x, y, n;
+            std::vector<unsigned char> into((size_t)w * h * reqComp);
+            stbi_uc* expected = stbi_load_from_memory(png.data(), (int)png.size(), &x, &y, &n, reqComp);
+            bool ok = expected && stbi_load_into_from_memory(png.data(), (int)png.size(), nullptr, into.data(), w * reqComp, h, &x, &y, &n, reqComp)
+                   && std::memcmp(into.data(), expected, into.size()) == 0;
+            stbi_image_free(expected);
+            if (!ok)
+            {
+                std::fprintf(stderr, "16-bit %s PNG as %d channels: stbi_load_into differs\n", colorType == 6 ? "RGBA" : "RGB", reqComp);
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+// Band sink: copies each band into a whole image, standing in for a sub-image upload
+struct BandSink
+{
+    std::vector<unsigned char>* image;
+    int rows = 0;
+
+    static int Receive(void* user, const stbi_uc* data, int y, int rowCount, int stride)
+    {
+        BandSink* sink = (BandSink*)user;
+        std::memcpy(&(*sink->image)[(size_t)y * stride], data, (size_t)rowCount * stride);
+        sink->rows += rowCount;
+        return 1;
+    }
+};
+
+// whole decode plus per-band copies, against stbi_load_bands
+static int BenchBands(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    const int bandRows = 16;
+    int errors = 0;
+    stbi_allocator counting = { HeapCounter::Malloc, HeapCounter::Realloc, HeapCounter::Free, nullptr };
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        std::vector<unsigned char> viaLoad(file.pixels.size()), viaBands(file.pixels.size());
+        stbi_load_options opt;
+        stbi_load_options_init(&opt);
+        int w, h, n;
+
+        auto loadAndCopy = [&] {
+            stbi_uc* data = stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4);
+            if (!data)
+                return false;
+            for (int y = 0; y < h; y += bandRows)
+                std::memcpy(&viaLoad[(size_t)y * w * 4], data + (size_t)y * w * 4, (size_t)std::min(bandRows, h - y) * w * 4);
+            stbi_image_free(data);
+            return true;
+        };
+        BandSink sink;
+        sink.image = &viaBands;
+        auto loadBands = [&] {
+            sink.rows = 0;
+            return stbi_load_bands_from_memory(file.bytes.data(), (int)file.bytes.size(), &opt, bandRows, BandSink::Receive, &sink, &w, &h, &n, 4) != 0;
+        };
+
+        HeapCounter& heap = HeapCounter::Get();
+        stbi_set_allocator(&counting);
+        heap.peak = heap.live;
+        bool ok = loadAndCopy();
+        size_t loadPeak = heap.peak - heap.live;
+        heap.peak = heap.live;
+        ok = loadBands() && ok;
+        size_t bandsPeak = heap.peak - heap.live;
+        stbi_set_allocator(nullptr);
+
+        if (!ok || sink.rows != file.height || viaLoad != file.pixels || viaBands != file.pixels)
+        {
+            std::fprintf(stderr, "%s: stbi_load_bands differs\n", file.path.c_str());
+            errors++;
+        }
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        std::fprintf(stderr, "bands %s: peak %.2f MB live heap whole, %.2f MB in bands\n", name.c_str(),
+                     (double)loadPeak / (1024.0 * 1024.0), (double)bandsPeak / (1024.0 * 1024.0));
+
+        results.push_back(BenchRun("bands", name.c_str(), "load_copy", 1, [&] { loadAndCopy(); }, 0.1, 5));
+        results.push_back(BenchRun("bands", name.c_str(), "load_bands", 1, [&] { loadBands(); }, 0.1, 5));
+    }
+
+    // 16-bit color to every channel count, as in load_into
+    for (int colorType : { 2, 6 })
+    {
+        const int w = 67, h = 23;
+        std::vector<unsigned char> png = MakeRandomPng16(w, h, colorType);
+        for (int reqComp = 1; reqComp <= 4; reqComp++)
+        {
+            int x, y, n;
+            std::vector<unsigned char> viaBands((size_t)w * h * reqComp);
+            BandSink sink;
+            sink.image = &viaBands;
+            stbi_uc* expected = stbi_load_from_memory(png.data(), (int)png.size(), &x, &y, &n, reqComp);
+            bool ok = expected && stbi_load_bands_from_memory(png.data(), (int)png.size(), nullptr, bandRows, BandSink::Receive, &sink, &x, &y, &n, reqComp)
+                   && sink.rows == h && std::memcmp(viaBands.data(), expected, viaBands.size()) == 0;
+            stbi_image_free(expected);
+            if (!ok)
+            {
+                std::fprintf(stderr, "16-bit %s PNG as %d channels: stbi_load_bands differs\n", colorType == 6 ? "RGBA" : "RGB", reqComp);
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+static bool IsJpeg(const std::vector<unsigned char>& bytes)
+{
+    return bytes.size() > 2 && bytes[0] == 0xFF && bytes[1] == 0xD8;
+}
+
+// full decode plus a copy of the tile, against decoding just the tile
+static int BenchJpegCrop(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    const int tile = 256;
+    int errors = 0;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        if (!IsJpeg(file.bytes))
+            continue;
+        int tileW = std::min(tile, file.width), tileH = std::min(tile, file.height);
+        int x0 = (file.width - tileW) / 2, y0 = (file.height - tileH) / 2;
+        std::vector<unsigned char> viaFull((size_t)tileW * tileH * 4), viaCrop(viaFull.size());
+        stbi_load_options opt;
+        stbi_load_options_init(&opt);
+        int w, h, n;
+
+        auto loadAndCut = [&] {
+            stbi_uc* data = stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4);
+            if (!data)
+                return false;
+            for (int y = 0; y < tileH; y++)
+                std::memcpy(&viaFull[(size_t)y * tileW * 4], data + ((size_t)(y0 + y) * w + x0) * 4, (size_t)tileW * 4);
+            stbi_image_free(data);
+            return true;
+        };
+        stbi_load_options cropOpt = opt;
+        cropOpt.crop_x = x0;
+        cropOpt.crop_y = y0;
+        cropOpt.crop_w = tileW;
+        cropOpt.crop_h = tileH;
+        auto loadCrop = [&] {
+            stbi_uc* data = stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &cropOpt, &w, &h, &n, 4);
+            if (!data)
+                return false;
+            std::memcpy(viaCrop.data(), data, viaCrop.size());
+            stbi_image_free(data);
+            return w == tileW && h == tileH;
+        };
+
+        if (!loadAndCut() || !loadCrop() || viaFull != viaCrop)
+        {
+            std::fprintf(stderr, "%s: cropped decode differs\n", file.path.c_str());
+            errors++;
+        }
+
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        results.push_back(BenchRun("jpeg_crop", name.c_str(), "load_cut", 1, [&] { loadAndCut(); }, 0.1, 5));
+        results.push_back(BenchRun("jpeg_crop", name.c_str(), "crop", 1, [&] { loadCrop(); }, 0.1, 5));
+    }
+    return errors;
+}
+
+static unsigned ReadBigEndian32(const unsigned char* p)
+{
+    return (unsigned)p[0] << 24 | (unsigned)p[1] << 16 | (unsigned)p[2] << 8 | p[3];
+}
+
+// the IDAT chunks of a PNG joined into one zlib stream, and the size it
+// inflates to; false for interlaced or malformed files
+static bool ExtractZlibStream(const std::vector<unsigned char>& png, std::vector<char>& stream, size_t& rawSize)
+{
+    static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    stream.clear();
+    rawSize = 0;
+    for (size_t at = 8; at + 12 <= png.size();)
+    {
+        size_t len = ReadBigEndian32(&png[at]);
+        const unsigned char* type = &png[at + 4];
+        const unsigned char* data = type + 4;
+        if (len > png.size() - at - 12)
+            return false;
+        if (std::memcmp(type, "IHDR", 4) == 0)
+        {
+            int depth = data[8], color = data[9];
+            if (len < 13 || color > 6 || !channels[color] || data[12] != 0)
+                return false;
+            size_t rowBytes = ((size_t)ReadBigEndian32(data) * channels[color] * depth + 7) / 8 + 1;
+            rawSize = rowBytes * ReadBigEndian32(data + 4);
+        }
+        else if (std::memcmp(type, "IDAT", 4) == 0)
+            stream.insert(stream.end(), data, data + len);
+        at += len + 12;
+    }
+    return rawSize != 0 && !stream.empty();
+}
+
+static int BenchInflate(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    int errors = 0;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        std::vector<char> stream;
+        size_t rawSize;
+        if (!IsPng(file.bytes) || !ExtractZlibStream(file.bytes, stream, rawSize))
+            continue;
+        std::vector<char> viaBuffer(rawSize), viaMalloc;
+
+        auto decodeMalloc = [&] {
+            int len = 0;
+            char* data = stbi_zlib_decode_malloc(stream.data(), (int)stream.size(), &len);
+            if (!data)
+                return false;
+            viaMalloc.assign(data, data + len);
+            stbi_image_free(data);
+            return (size_t)len == rawSize;
+        };
+        auto decodeBuffer = [&] {
+            return stbi_zlib_decode_buffer(viaBuffer.data(), (int)viaBuffer.size(), stream.data(), (int)stream.size()) == (int)rawSize;
+        };
+        auto loadPng = [&] {
+            int w, h, n;
+            stbi_uc* data = stbi_load_from_memory(file.bytes.data(), (int)file.bytes.size(), &w, &h, &n, 0);
+            stbi_image_free(data);
+            return data != nullptr;
+        };
+
+        if (!decodeMalloc() || !decodeBuffer() || viaMalloc != viaBuffer)
+        {
+            std::fprintf(stderr, "%s: inflate failed or outputs differ\n", file.path.c_str());
+            errors++;
+        }
+
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        std::fprintf(stderr, "inflate %s: %.2f MB from %.2f MB\n", name.c_str(), rawSize / 1e6, stream.size() / 1e6);
+        results.push_back(BenchRun("inflate", name.c_str(), "decode_malloc", 1, [&] { decodeMalloc(); }, 0.1, 5));
+        results.push_back(BenchRun("inflate", name.c_str(), "decode_buffer", 1, [&] { decodeBuffer(); }, 0.1, 5));
+        results.push_back(BenchRun("inflate", name.c_str(), "load_png", 1, [&] { loadPng(); }, 0.1, 5));
+    }
+    return errors;
+}
+
+#ifdef STBI_SSE2
+static int PaethPredictor(int a, int b, int c)
+{
+    int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// the PNG filters as the spec writes them, for a row of in-byte pixels
+// stored out bytes apart (the extra bytes, an added alpha, set to 255);
+// prior is null on the first row
+static void UnfilterRowReference(int filter, unsigned char* cur, const unsigned char* raw, const unsigned char* prior, int pixels, int in, int out)
+{
+    for (int i = 0; i < pixels; i++)
+        for (int k = 0; k < out; k++)
+        {
+            int at = i * out + k;
+            if (k >= in)
+            {
+                cur[at] = 255;
+                continue;
+            }
+            int x = raw[i * in + k];
+            int a = i > 0 ? cur[at - out] : 0, b = prior ? prior[at] : 0, c = i > 0 && prior ? prior[at - out] : 0;
+            switch (filter)
+            {
+            case 1: x += a; break;
+            case 2: x += b; break;
+            case 3: x += (a + b) / 2; break;
+            case 4: x += PaethPredictor(a, b, c); break;
+            }
+            cur[at] = (unsigned char)x;
+        }
+}
+
+static void AppendBigEndian32(std::vector<unsigned char>& out, uint32_t v)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back((unsigned char)(v >> shift));
+}
+
+static void AppendPngChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data)
+{
+    static uint32_t table[256];
+    if (!table[1])
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    AppendBigEndian32(png, (uint32_t)data.size());
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = start; i < png.size(); i++)
+        crc = table[(crc ^ png[i]) & 0xff] ^ (crc >> 8);
+    AppendBigEndian32(png, crc ^ 0xffffffffu);
+}
+
+// a PNG of already filtered rows (filter byte first), in stored deflate
+// blocks so no compressor is needed
+static std::vector<unsigned char> MakePng(int w, int h, int depth, int colorType, const std::vector<unsigned char>& rows)
+{
+    std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' }, ihdr, idat = { 0x78, 0x01 };
+    AppendBigEndian32(ihdr, w);
+    AppendBigEndian32(ihdr, h);
+    ihdr.insert(ihdr.end(), { (unsigned char)depth, (unsigned char)colorType, 0, 0, 0 });
+    uint32_t s1 = 1, s2 = 0;
+    for (size_t at = 0; at < rows.size();)
+    {
+        size_t len = std::min(rows.size() - at, (size_t)65535);
+        idat.push_back(at + len == rows.size());
+        idat.insert(idat.end(), { (unsigned char)len, (unsigned char)(len >> 8), (unsigned char)~len, (unsigned char)(~len >> 8) });
+        idat.insert(idat.end(), rows.begin() + at, rows.begin() + at + len);
+        at += len;
+    }
+    for (unsigned char c : rows)
+    {
+        s1 = (s1 + c) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    AppendBigEndian32(idat, s2 << 16 | s1);
+    AppendPngChunk(png, "IHDR", ihdr);
+    AppendPngChunk(png, "IDAT", idat);
+    AppendPngChunk(png, "IEND", {});
+    return png;
+}
+
+// random filtered rows of in-byte pixels, and the pixels they unfilter to
+// at out bytes each
+static void MakeFilteredImage(uint32_t (*rnd)(), int w, int h, int in, int out, std::vector<unsigned char>& rows, std::vector<unsigned char>& pixels)
+{
+    rows.resize((size_t)(w * in + 1) * h);
+    pixels.resize((size_t)w * out * h);
+    for (int y = 0; y < h; y++)
+    {
+        unsigned char* row = &rows[(size_t)(w * in + 1) * y];
+        row[0] = (unsigned char)(rnd() % 5);
+        for (int i = 1; i <= w * in; i++)
+            row[i] = (unsigned char)rnd();
+        UnfilterRowReference(row[0], &pixels[(size_t)w * out * y], row + 1, y ? &pixels[(size_t)w * out * (y - 1)] : nullptr, w, in, out);
+    }
+}
+
+static uint32_t UnfilterRandom()
+{
+    static uint32_t seed = 4242;
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+static int BenchPngUnfilter(std::vector<BenchResult>& results)
+{
+    static const int sizes[6][2] = { { 3, 3 }, { 4, 4 }, { 6, 6 }, { 8, 8 }, { 3, 4 }, { 6, 8 } };
+#ifdef STBI_AVX2
+    int avx2 = stbi__avx2_available() != 0;
+#else
+    int avx2 = 0;
+#endif
+    int errors = 0;
+
+    // each kernel on its own, every width up to 40 to cover the row ends
+    for (int s = 0; s < 6; s++)
+        for (int filter = 0; filter <= 4; filter++)
+            for (int w = 1; w <= 40; w++)
+                for (int useAvx2 = 0; useAvx2 <= avx2; useAvx2++)
+                {
+                    int in = sizes[s][0], out = sizes[s][1];
+                    std::vector<unsigned char> raw(w * in), prior(w * out), expected(w * out), cur(w * out);
+                    for (unsigned char& c : raw) c = (unsigned char)UnfilterRandom();
+                    for (unsigned char& c : prior) c = (unsigned char)UnfilterRandom();
+                    UnfilterRowReference(filter, expected.data(), raw.data(), prior.data(), w, in, out);
+                    std::memcpy(cur.data(), expected.data(), out); // the kernels start from the second pixel
+                    if (!stbi__unfilter_row_simd(filter, cur.data() + out, raw.data() + in, prior.data() + out, w - 1, in, out, useAvx2))
+                        continue;
+                    if (cur != expected)
+                    {
+                        std::fprintf(stderr, "png_unfilter: filter %d, %d to %d byte pixels, width %d%s differs\n", filter, in, out, w, useAvx2 ? " (avx2)" : "");
+                        errors++;
+                    }
+                }
+
+    // whole decodes, 8-bit through memory and 16-bit through a temporary file
+    for (int i = 0; i < 300; i++)
+    {
+        int colorType = UnfilterRandom() % 2 ? 6 : 2, depth = UnfilterRandom() % 3 ? 8 : 16;
+        int channels = colorType == 6 ? 4 : 3, bytes = depth / 8;
+        int reqComp = UnfilterRandom() % 2 ? 4 : 0, outChannels = reqComp ? reqComp : channels;
+        int w = 1 + UnfilterRandom() % 70, h = 1 + UnfilterRandom() % 10;
+        std::vector<unsigned char> rows, expected;
+        MakeFilteredImage(UnfilterRandom, w, h, channels * bytes, outChannels * bytes, rows, expected);
+        std::vector<unsigned char> png = MakePng(w, h, depth, colorType, rows);
+        bool same = false;
+        int x, y, n;
+        if (depth == 8)
+        {
+            stbi_load_options opt;
+            stbi_load_options_init(&opt);
+            opt.no_avx2 = i % 2;
+            stbi_uc* data = stbi_load_from_memory_ex(png.data(), (int)png.size(), &opt, &x, &y, &n, reqComp);
+            same = data && std::memcmp(data, expected.data(), expected.size()) == 0;
+            stbi_image_free(data);
+        }
+        else if (FILE* f = std::tmpfile())
+        {
+            std::fwrite(png.data(), 1, png.size(), f);
+            std::rewind(f);
+            stbi_us* data = stbi_load_from_file_16(f, &x, &y, &n, reqComp);
+            std::fclose(f);
+            same = data != nullptr;
+            for (size_t k = 0; same && k < expected.size(); k += 2)
+                same = data[k / 2] == (expected[k] << 8 | expected[k + 1]);
+            stbi_image_free(data);
+        }
+        if (!same)
+        {
+            std::fprintf(stderr, "png_unfilter: %dx%d %d-bit %s PNG as %d channels differs\n", w, h, depth, colorType == 6 ? "RGBA" : "RGB", outChannels);
+            errors++;
+        }
+    }
+
+    static const struct { const char* name; int colorType, depth, reqComp; } images[] = {
+        { "rgb8", 2, 8, 0 }, { "rgba8", 6, 8, 0 }, { "rgb8_as_rgba", 2, 8, 4 }, { "rgba16", 6, 16, 0 },
+    };
+    for (const auto& image : images)
+    {
+        int channels = image.colorType == 6 ? 4 : 3, bytes = image.depth / 8;
+        std::vector<unsigned char> rows, expected;
+        MakeFilteredImage(UnfilterRandom, 1024, 1024, channels * bytes, (image.reqComp ? image.reqComp : channels) * bytes, rows, expected);
+        std::vector<unsigned char> png = MakePng(1024, 1024, image.depth, image.colorType, rows);
+        for (int noAvx2 = 1; noAvx2 >= 1 - avx2; noAvx2--)
+        {
+            stbi_load_options opt;
+            stbi_load_options_init(&opt);
+            opt.no_avx2 = noAvx2;
+            results.push_back(BenchRun("png_unfilter", image.name, noAvx2 ? "sse2" : "avx2", 1, [&] {
+                int x, y, n;
+                stbi_image_free(stbi_load_from_memory_ex(png.data(), (int)png.size(), &opt, &x, &y, &n, image.reqComp));
+            }, 0.1, 5));
+        }
+    }
+    return errors;
+}
+#endif
+
+#ifdef STBI_SSE2
+// stbi__convert_row or stbi__convert_row16 on one row
+static void ConvertRow(int bits, unsigned char* dest, int reqComp, const unsigned char* src, int imgN, int w, int simd)
+{
+    if (bits == 8)
+        stbi__convert_row(dest, reqComp, src, imgN, w, simd);
+    else
+        stbi__convert_row16((stbi__uint16*)dest, reqComp, (const stbi__uint16*)src, imgN, w, simd);
+}
+
+// the flip stbi__vertical_flip replaced, one byte at a time
+static void FlipBytewise(unsigned char* image, int w, int h, int n)
+{
+    for (int row = 0; row < h / 2; row++)
+        for (int i = 0; i < w * n; i++)
+            std::swap(image[(size_t)row * w * n + i], image[(size_t)(h - 1 - row) * w * n + i]);
+}
+
+static int BenchConvert(std::vector<BenchResult>& results)
+{
+    static const char* const levels[3] = { "scalar", "sse2", "avx2" };
+#ifdef STBI_AVX2
+    int top = stbi__avx2_available() ? 2 : 1;
+#else
+    int top = 1;
+#endif
+    int errors = 0;
+
+    // every conversion at every level against the scalar loops, on rows of
+    // random bytes up to 100 pixels wide to cover the row ends
+    for (int bits = 8; bits <= 16; bits += 8)
+        for (int imgN = 1; imgN <= 4; imgN++)
+            for (int reqComp = 1; reqComp <= 4; reqComp++)
+                for (int w = 1; w <= 100 && imgN != reqComp; w++)
+                    for (int simd = 1; simd <= top; simd++)
+                    {
+                        int bytes = bits / 8;
+                        std::vector<unsigned char> src(w * imgN * bytes), expected(w * reqComp * bytes), out(w * reqComp * bytes);
+                        for (unsigned char& c : src) c = (unsigned char)UnfilterRandom();
+                        ConvertRow(bits, expected.data(), reqComp, src.data(), imgN, w, 0);
+                        ConvertRow(bits, out.data(), reqComp, src.data(), imgN, w, simd);
+                        if (out != expected)
+                        {
+                            std::fprintf(stderr, "convert: %d-bit %d to %d channels, width %d (%s) differs\n", bits, imgN, reqComp, w, levels[simd]);
+                            errors++;
+                        }
+                    }
+
+    static const struct { int bits, imgN, reqComp; } rows[] = {
+        { 8, 1, 2 }, { 8, 1, 3 }, { 8, 1, 4 }, { 8, 2, 1 }, { 8, 2, 3 }, { 8, 2, 4 },
+        { 8, 3, 1 }, { 8, 3, 2 }, { 8, 3, 4 }, { 8, 4, 1 }, { 8, 4, 2 }, { 8, 4, 3 },
+        { 16, 1, 4 }, { 16, 3, 4 }, { 16, 4, 3 }, { 16, 4, 1 },
+    };
+    const int w = 1024, h = 64;
+    for (const auto& row : rows)
+    {
+        int bytes = row.bits / 8;
+        std::vector<unsigned char> src((size_t)w * h * row.imgN * bytes), dest((size_t)w * h * row.reqComp * bytes);
+        for (unsigned char& c : src) c = (unsigned char)UnfilterRandom();
+        char name[32];
+        std::snprintf(name, sizeof(name), "%dbit_%dto%d", row.bits, row.imgN, row.reqComp);
+        for (int simd = 0; simd <= top; simd++)
+        {
+            results.push_back(BenchRun("convert", name, levels[simd], (uint64_t)w * h, [&] {
+                for (int y = 0; y < h; y++)
+                    ConvertRow(row.bits, &dest[(size_t)y * w * row.reqComp * bytes], row.reqComp, &src[(size_t)y * w * row.imgN * bytes], row.imgN, w, simd);
+            }, 0.1, 5));
+        }
+    }
+
+    // the end of a flipped RGB to RGBA load of a 1024x1024 image: the
+    // conversion followed by the old byte-at-a-time flip pass or by the row
+    // swapping one, and the conversion with the flip folded in
+    std::vector<unsigned char> rgb((size_t)1024 * 1024 * 3);
+    for (unsigned char& c : rgb) c = (unsigned char)UnfilterRandom();
+    for (int variant = 0; variant < 3; variant++)
+    {
+        static const char* const variants[3] = { "bytewise_pass", "row_pass", "folded" };
+        stbi__context s;
+        stbi__start_mem(&s, rgb.data(), (int)rgb.size());
+        s.opt.flip_vertically = variant == 2;
+        results.push_back(BenchRun("convert", "flip_rgb_to_rgba", variants[variant], (uint64_t)1024 * 1024, [&] {
+            stbi__result_info ri = {};
+            unsigned char* data = (unsigned char*)stbi__malloc(rgb.size());
+            std::memcpy(data, rgb.data(), rgb.size());
+            data = stbi__convert_format(&s, &ri, data, 3, 4, 1024, 1024);
+            if (variant == 0)
+                FlipBytewise(data, 1024, 1024, 4);
+            else if (variant == 1)
+                stbi__vertical_flip(data, 1024, 1024, 4);
+            stbi_image_free(data);
+        }, 0.1, 5));
+    }
+    return errors;
+}
+#endif
+
+static void AppendLittleEndian16(std::vector<unsigned char>& out, int v)
+{
+    out.push_back((unsigned char)v);
+    out.push_back((unsigned char)(v >> 8));
+}
+
+// LZW codes 8-bit palette indices and appends them as GIF sub-blocks,
+// starting over with a clear code whenever the code table fills up
+static void AppendGifLzw(std::vector<unsigned char>& out, const std::vector<unsigned char>& indices)
+{
+    const int clear = 256, end = 257;
+    std::vector<short> next(4096 * 256);    // next[code * 256 + index]: code of that string plus index, 0 if none
+    std::vector<unsigned char> data;
+    uint32_t bits = 0;
+    int bitCount = 0, codeSize = 9, avail = end + 1;
+    auto put = [&](int code) {
+        bits |= (uint32_t)code << bitCount;
+        for (bitCount += codeSize; bitCount >= 8; bitCount -= 8, bits >>= 8)
+            data.push_back((unsigned char)bits);
+    };
+
+    put(clear);
+    int prefix = indices[0];
+    for (size_t i = 1; i < indices.size(); i++)
+    {
+        short& slot = next[prefix * 256 + indices[i]];
+        if (slot)
+        {
+            prefix = slot;
+            continue;
+        }
+        put(prefix);
+        prefix = indices[i];
+        if (avail == 4096)
+        {
+            put(clear);
+            std::fill(next.begin(), next.end(), 0);
+            codeSize = 9;
+            avail = end + 1;
+            continue;
+        }
+        // the decoder adds this entry a code later, so it widens a code later too
+        slot = (short)avail++;
+        if (avail == (1 << codeSize) + 1 && codeSize < 12)
+            codeSize++;
+    }
+    put(prefix);
+    put(end);
+    if (bitCount > 0)
+        data.push_back((unsigned char)bits);
+
+    out.push_back(8);
+    for (size_t at = 0; at < data.size(); at += 255)
+    {
+        size_t len = std::min(data.size() - at, (size_t)255);
+        out.push_back((unsigned char)len);
+        out.insert(out.end(), data.begin() + at, data.begin() + at + len);
+    }
+    out.push_back(0);
+}
+
+struct GifFrame
+{
+    int x, y, w, h;
+    int disposal;                       // 0-3, as in the graphic control extension
+    std::vector<unsigned char> indices; // w * h, 255 is transparent
+};
+
+// an animated GIF with one 256-color palette; frames without a disposal
+// (-1) get no graphic control extension
+static std::vector<unsigned char> MakeGif(int w, int h, const unsigned char palette[256][3], const std::vector<GifFrame>& frames)
+{
+    std::vector<unsigned char> gif = { 'G', 'I', 'F', '8', '9', 'a' };
+    AppendLittleEndian16(gif, w);
+    AppendLittleEndian16(gif, h);
+    gif.insert(gif.end(), { 0xF7, 0, 0 });  // global palette of 256 colors, background 0
+    for (int i = 0; i < 256; i++)
+        gif.insert(gif.end(), palette[i], palette[i] + 3);
+    for (const GifFrame& frame : frames)
+    {
+        if (frame.disposal >= 0)
+        {
+            gif.insert(gif.end(), { 0x21, 0xF9, 4, (unsigned char)(frame.disposal << 2 | 1) });
+            AppendLittleEndian16(gif, 4);     // 40 ms
+            gif.insert(gif.end(), { 255, 0 });
+        }
+        gif.push_back(0x2C);
+        AppendLittleEndian16(gif, frame.x);
+        AppendLittleEndian16(gif, frame.y);
+        AppendLittleEndian16(gif, frame.w);
+        AppendLittleEndian16(gif, frame.h);
+        gif.push_back(0);
+        AppendGifLzw(gif, frame.indices);
+    }
+    gif.push_back(0x3B);
+    return gif;
+}
+
+// Plays frames back the way the GIF89a spec describes, one canvas per
+// frame, to check stbi_gif_stream against
+static std::vector<std::vector<unsigned char>> ComposeGif(int w, int h, const unsigned char palette[256][3], const std::vector<GifFrame>& frames)
+{
+    std::vector<std::vector<unsigned char>> canvases;
+    std::vector<unsigned char> canvas((size_t)w * h * 4), saved;
+    for (size_t i = 0; i < canvas.size(); i += 4)
+        canvas[i + 0] = palette[0][0], canvas[i + 1] = palette[0][1], canvas[i + 2] = palette[0][2], canvas[i + 3] = 0;
+    for (size_t k = 0; k < frames.size(); k++)
+    {
+        const GifFrame& frame = frames[k];
+        if (k > 0 && frames[k - 1].disposal == 2)
+        {
+            const GifFrame& last = frames[k - 1];
+            for (int y = last.y; y < last.y + last.h; y++)
+                for (int x = last.x; x < last.x + last.w; x++)
+                {
+                    unsigned char* p = &canvas[((size_t)y * w + x) * 4];
+                    p[0] = palette[0][0], p[1] = palette[0][1], p[2] = palette[0][2], p[3] = 0;
+                }
+        }
+        else if (k > 0 && frames[k - 1].disposal == 3)
+            canvas = saved;
+        if (frame.disposal == 3)
+            saved = canvas;
+        for (int y = 0; y < frame.h; y++)
+            for (int x = 0; x < frame.w; x++)
+            {
+                int index = frame.indices[(size_t)y * frame.w + x];
+                if (index == 255 && frame.disposal >= 0)
+                    continue;
+                unsigned char* p = &canvas[((size_t)(frame.y + y) * w + frame.x + x) * 4];
+                p[0] = palette[index][0], p[1] = palette[index][1], p[2] = palette[index][2], p[3] = 255;
+            }
+        canvases.push_back(canvas);
+    }
+    return canvases;
+}
+
+static int BenchGifStream(std::vector<BenchResult>& results)
+{
+    const int w = 512, h = 512, sprite = 128, frameCount = 24;
+    unsigned char palette[256][3];
+    for (int i = 0; i < 256; i++)
+        palette[i][0] = (unsigned char)i, palette[i][1] = (unsigned char)(i * 7), palette[i][2] = (unsigned char)(255 - i);
+
+    // a full first frame of gradients and noise, then a sprite moving over
+    // it that is left in place, cleared or taken off again in turn
+    std::vector<GifFrame> frames;
+    for (int k = 0; k < frameCount; k++)
+    {
+        GifFrame frame;
+        frame.x = k ? (k * 37) % (w - sprite) : 0;
+        frame.y = k ? (k * 53) % (h - sprite) : 0;
+        frame.w = k ? sprite : w;
+        frame.h = k ? sprite : h;
+        frame.disposal = k ? k % 3 + 1 : 1;
+        frame.indices.resize((size_t)frame.w * frame.h);
+        for (int y = 0; y < frame.h; y++)
+            for (int x = 0; x < frame.w; x++)
+            {
+                int index = ((x >> 3) + (y >> 4) + k * 16) % 255;
+                if (UnfilterRandom() % 8 == 0)
+                    index = (index + UnfilterRandom() % 5) % 255;
+                if (k && (x - sprite / 2) * (x - sprite / 2) + (y - sprite / 2) * (y - sprite / 2) > sprite * sprite / 4)
+                    index = 255;                // round sprite
+                frame.indices[(size_t)y * frame.w + x] = (unsigned char)index;
+            }
+        frames.push_back(frame);
+    }
+    std::vector<unsigned char> gif = MakeGif(w, h, palette, frames);
+    std::vector<std::vector<unsigned char>> expected = ComposeGif(w, h, palette, frames);
+
+    // what playback took before: every frame stored as its own whole GIF,
+    // each decoded into a new image
+    std::vector<std::vector<unsigned char>> stills;
+    for (const auto& canvas : expected)
+    {
+        GifFrame still;
+        still.x = still.y = 0;
+        still.w = w;
+        still.h = h;
+        still.disposal = -1;
+        for (size_t i = 0; i < canvas.size(); i += 4)
+            still.indices.push_back(canvas[i + 3] ? canvas[i] : 0);
+        stills.push_back(MakeGif(w, h, palette, { still }));
+    }
+
+    int errors = 0;
+    int gw, gh, delay, n;
+    stbi_gif_stream* stream = stbi_gif_stream_open_memory(gif.data(), (int)gif.size(), &gw, &gh);
+    for (int pass = 0; pass < 2 && stream; pass++)
+    {
+        int k = 0;
+        while (const stbi_uc* frame = stbi_gif_stream_next(stream, &delay))
+        {
+            if (k >= frameCount || delay != 40 || std::memcmp(frame, expected[k].data(), expected[k].size()) != 0)
+            {
+                std::fprintf(stderr, "gif_stream: frame %d (pass %d) differs\n", k, pass);
+                errors++;
+            }
+            k++;
+        }
+        if (k != frameCount)
+        {
+            std::fprintf(stderr, "gif_stream: %d of %d frames (pass %d): %s\n", k, frameCount, pass, stbi_failure_reason());
+            errors++;
+        }
+        stbi_gif_stream_rewind(stream);
+    }
+    if (!stream || gw != w || gh != h)
+    {
+        std::fprintf(stderr, "gif_stream: could not open: %s\n", stbi_failure_reason());
+        return errors + 1;
+    }
+    for (int k = 0; k < frameCount; k++)
+    {
+        stbi_uc* still = stbi_load_from_memory(stills[k].data(), (int)stills[k].size(), &gw, &gh, &n, 4);
+        for (size_t i = 0; still && i < expected[k].size(); i += 4)
+            if (expected[k][i + 3] && std::memcmp(&still[i], &expected[k][i], 4) != 0)
+            {
+                std::fprintf(stderr, "gif_stream: still %d differs\n", k);
+                errors++;
+                break;
+            }
+        stbi_image_free(still);
+    }
+
+    stbi_allocator counting = { HeapCounter::Malloc, HeapCounter::Realloc, HeapCounter::Free, nullptr };
+    auto loadStills = [&] {
+        for (const auto& still : stills)
+            stbi_image_free(stbi_load_from_memory(still.data(), (int)still.size(), &gw, &gh, &n, 4));
+    };
+    auto playStream = [&] {
+        stbi_gif_stream_rewind(stream);
+        while (stbi_gif_stream_next(stream, &delay))
+            ;
+    };
+    HeapCounter& heap = HeapCounter::Get();
+    stbi_set_allocator(&counting);
+    heap.calls = 0;
+    loadStills();
+    uint64_t stillCalls = heap.calls;
+    heap.calls = 0;
+    playStream();
+    uint64_t streamCalls = heap.calls;
+    stbi_set_allocator(nullptr);
+    std::fprintf(stderr, "gif_stream: %d frames, %llu heap calls as stills, %llu playing the stream\n", frameCount,
+                 (unsigned long long)stillCalls, (unsigned long long)streamCalls);
+
+    results.push_back(BenchRun("gif_stream", "512x512_sprite", "load_stills", frameCount, [&] { loadStills(); }, 0.1, 5));
+    results.push_back(BenchRun("gif_stream", "512x512_sprite", "stream", frameCount, [&] { playStream(); }, 0.1, 5));
+    stbi_gif_stream_close(stream);
+    return errors;
+}
+
+static int BenchJpegScaled(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    int errors = 0;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        if (!IsJpeg(file.bytes))
+            continue;
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        for (int denom = 1; denom <= 8; denom *= 2)
+        {
+            stbi_load_options opt;
+            stbi_load_options_init(&opt);
+            opt.scale_denom = denom;
+            int w, h, n;
+            stbi_uc* scaled = stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4);
+            if (!scaled || w != (file.width + denom - 1) / denom || h != (file.height + denom - 1) / denom)
+            {
+                std::fprintf(stderr, "%s: 1/%d decode failed or has the wrong size\n", file.path.c_str(), denom);
+                errors++;
+                stbi_image_free(scaled);
+                continue;
+            }
+
+            // mean absolute difference to the full decode averaged over denom x denom boxes
+            uint64_t diff = 0;
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                    for (int c = 0; c < 4; c++)
+                    {
+                        int sum = 0, count = 0;
+                        for (int yy = y * denom; yy < std::min((y + 1) * denom, file.height); yy++)
+                            for (int xx = x * denom; xx < std::min((x + 1) * denom, file.width); xx++, count++)
+                                sum += file.pixels[((size_t)yy * file.width + xx) * 4 + c];
+                        diff += std::abs(scaled[((size_t)y * w + x) * 4 + c] - (sum + count / 2) / count);
+                    }
+            stbi_image_free(scaled);
+            double mean = (double)diff / ((double)w * h * 4);
+            std::fprintf(stderr, "%s 1/%d: mean difference %.2f\n", name.c_str(), denom, mean);
+            if (mean > 4.0)
+                errors++;
+
+            char variant[8];
+            std::snprintf(variant, sizeof(variant), "1_%d", denom);
+            results.push_back(BenchRun("jpeg_scaled", name.c_str(), variant, 1, [&] {
+                stbi_image_free(stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4));
+            }, 0.1, 5));
+        }
+    }
+    return errors;
+}
+
+#ifdef STBI_AVX2
+static int BenchJpegAvx2(const std::vector<ImageFile>& corpus, std::vector<BenchResult>& results)
+{
+    if (!stbi__avx2_available())
+    {
+        std::fprintf(stderr, "jpeg_avx2: no AVX2 on this CPU, skipped\n");
+        return 0;
+    }
+
+    int errors = 0;
+    const int BLOCKS = 1024, ROW = 1920;
+    std::vector<short> coeffs(BLOCKS * 64 + 8);
+    short* blocks = (short*)(((uintptr_t)coeffs.data() + 15) & ~(uintptr_t)15);
+    std::vector<stbi_uc> near(ROW + 1), far(ROW + 1), y(ROW), cb(ROW), cr(ROW);
+    std::vector<stbi_uc> out1(BLOCKS * 64), out2(BLOCKS * 64), rgb1(ROW * 4), rgb2(ROW * 4);
+    uint32_t seed = 12345;
+    auto rnd = [&] { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    for (int i = 0; i < BLOCKS * 64; i++)
+        // mostly small dequantized coefficients, with the odd extreme one to hit saturation
+        blocks[i] = (short)(rnd() % 16 == 0 ? (int)(rnd() & 0xffff) - 32768 : (int)(rnd() % 512) - 256);
+    for (int i = 0; i < ROW; i++)
+    {
+        near[i] = (stbi_uc)rnd(); far[i] = (stbi_uc)rnd();
+        y[i] = (stbi_uc)rnd(); cb[i] = (stbi_uc)rnd(); cr[i] = (stbi_uc)rnd();
+    }
+
+    // every width up to 64 covers the loop remainders
+    for (int w = 1; w <= 64; w++)
+    {
+        stbi__resample_row_hv_2_simd(rgb1.data(), near.data(), far.data(), w, 2);
+        stbi__resample_row_hv_2_avx2(rgb2.data(), near.data(), far.data(), w, 2);
+        stbi__YCbCr_to_RGB_simd(out1.data(), y.data(), cb.data(), cr.data(), w, 4);
+        stbi__YCbCr_to_RGB_avx2(out2.data(), y.data(), cb.data(), cr.data(), w, 4);
+        if (std::memcmp(rgb1.data(), rgb2.data(), w * 2) || std::memcmp(out1.data(), out2.data(), w * 4))
+        {
+            std::fprintf(stderr, "jpeg_avx2: row kernels differ at width %d\n", w);
+            errors++;
+        }
+    }
+
+    results.push_back(BenchRun("jpeg_avx2", "idct", "sse2", BLOCKS, [&] {
+        for (int b = 0; b < BLOCKS; b++)
+            stbi__idct_simd(out1.data() + b * 64, 8, blocks + b * 64);
+    }, 0.1, 5));
+    results.push_back(BenchRun("jpeg_avx2", "idct", "avx2", BLOCKS, [&] {
+        for (int b = 0; b < BLOCKS; b++)
+            stbi__idct_avx2(out2.data() + b * 64, 8, blocks + b * 64);
+    }, 0.1, 5));
+    if (out1 != out2)
+    {
+        std::fprintf(stderr, "jpeg_avx2: IDCT output differs\n");
+        errors++;
+    }
+
+    results.push_back(BenchRun("jpeg_avx2", "ycbcr_to_rgb", "sse2", ROW, [&] {
+        stbi__YCbCr_to_RGB_simd(rgb1.data(), y.data(), cb.data(), cr.data(), ROW, 4);
+    }, 0.1, 5));
+    results.push_back(BenchRun("jpeg_avx2", "ycbcr_to_rgb", "avx2", ROW, [&] {
+        stbi__YCbCr_to_RGB_avx2(rgb2.data(), y.data(), cb.data(), cr.data(), ROW, 4);
+    }, 0.1, 5));
+    if (rgb1 != rgb2)
+    {
+        std::fprintf(stderr, "jpeg_avx2: YCbCr to RGB output differs\n");
+        errors++;
+    }
+
+    results.push_back(BenchRun("jpeg_avx2", "upsample_hv_2", "sse2", ROW / 2, [&] {
+        stbi__resample_row_hv_2_simd(rgb1.data(), near.data(), far.data(), ROW / 2, 2);
+    }, 0.1, 5));
+    results.push_back(BenchRun("jpeg_avx2", "upsample_hv_2", "avx2", ROW / 2, [&] {
+        stbi__resample_row_hv_2_avx2(rgb2.data(), near.data(), far.data(), ROW / 2, 2);
+    }, 0.1, 5));
+    if (std::memcmp(rgb1.data(), rgb2.data(), ROW))
+    {
+        std::fprintf(stderr, "jpeg_avx2: upsampler output differs\n");
+        errors++;
+    }
+
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const ImageFile& file = corpus[i];
+        if (!IsJpeg(file.bytes))
+            continue;
+        std::string name = file.path.substr(file.path.find_last_of("/\\") + 1);
+        stbi_load_options opt;
+        stbi_load_options_init(&opt);
+        opt.no_avx2 = 1;
+        int w, h, n;
+        stbi_uc* sse2 = stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4);
+        if (!sse2 || std::memcmp(sse2, file.pixels.data(), file.pixels.size()))
+        {
+            std::fprintf(stderr, "%s: SSE2 and AVX2 decodes differ\n", file.path.c_str());
+            errors++;
+        }
+        stbi_image_free(sse2);
+
+        results.push_back(BenchRun("jpeg_avx2", name.c_str(), "sse2", 1, [&] {
+            stbi_image_free(stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4));
+        }, 0.1, 5));
+        opt.no_avx2 = 0;
+        results.push_back(BenchRun("jpeg_avx2", name.c_str(), "avx2", 1, [&] {
+            stbi_image_free(stbi_load_from_memory_ex(file.bytes.data(), (int)file.bytes.size(), &opt, &w, &h, &n, 4));
+        }, 0.1, 5));
+    }
+    return errors;
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    std::string root = argc > 2 ? argv[2] : "..";
+    std::vector<std::string> paths;
+    for (int i = 0; i < CORPUS_SIZE; i++)
+        paths.push_back(root + "/" + CORPUS[i]);
+    for (int i = 3; i < argc; i++)
+        paths.push_back(argv[i]);
+
+    std::vector<ImageFile> corpus;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        ImageFile file;
+        file.path = paths[i];
+        if (!ReadFile(file.path, file.bytes))
+        {
+            std::fprintf(stderr, "could not read %s\n", file.path.c_str());
+            return 1;
+        }
+        int w, h;
+        if (!Decode(file, 0, file.pixels, file.width, file.height) || !Decode(file, 1, file.pixelsFlipped, w, h))
+        {
+            std::fprintf(stderr, "could not decode %s: %s\n", file.path.c_str(), stbi_failure_reason());
+            return 1;
+        }
+        corpus.push_back(file);
+    }
+
+    std::vector<BenchResult> results;
+    int errors = BenchConcurrent(corpus, results);
+    errors += BenchParallel(corpus, results, "jpeg_restart", HasRestartMarkers);
+    errors += BenchParallel(corpus, results, "png_pipeline", IsPng);
+    errors += BenchFileLoad(corpus, results);
+    errors += BenchArena(corpus, results);
+    errors += BenchLoadInto(corpus, results);
+    errors += BenchBands(corpus, results);
+    errors += BenchJpegScaled(corpus, results);
+    errors += BenchJpegCrop(corpus, results);
+    errors += BenchInflate(corpus, results);
+    errors += BenchGifStream(results);
+#ifdef STBI_SSE2
+    errors += BenchPngUnfilter(results);
+    errors += BenchConvert(results);
+#endif
+#ifdef STBI_AVX2
+    errors += BenchJpegAvx2(corpus, results);
+#endif
+
+    int status = BenchFinish(argc, argv, "image", results);
+    if (errors)
+    {
+        std::fprintf(stderr, "%d mismatching decodes\n", errors);
+        return 1;
+    }
+    return status;
+}
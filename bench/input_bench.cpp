@@ -0,0 +1,56 @@
+// Cost of feeding a high polling rate mouse into Camera: one
+// ProcessMouseMovement per event (what the callbacks did) against the
+// per-frame CameraInputBuffer modes. Simulates an 8 kHz mouse at 60 fps,
+// i.e. ~133 events per frame; ops in the report are frames.
+//
+// Usage: input_bench [out.json]
+
+#include "bench.h"
+#include "../learnOpengl/camera_input.h"
+
+const int POLL_HZ = 8000;
+const int FRAME_HZ = 60;
+const int EVENTS_PER_FRAME = POLL_HZ / FRAME_HZ;
+
+int main(int argc, char** argv)
+{
+    std::vector<BenchResult> results;
+
+    // a slow circular sweep with a little sensor noise
+    std::vector<float> dx(EVENTS_PER_FRAME), dy(EVENTS_PER_FRAME);
+    uint32_t seed = 1u;
+    for (int i = 0; i < EVENTS_PER_FRAME; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        float noise = ((seed >> 8) * (1.0f / 16777216.0f) - 0.5f) * 0.2f;
+        dx[i] = std::cos(i * 0.05f) + noise;
+        dy[i] = std::sin(i * 0.05f) * 0.1f - noise;
+    }
+
+    Camera perEvent;
+    results.push_back(BenchRun("camera_input", "8khz_60fps", "per_event", 1, [&] {
+        for (int i = 0; i < EVENTS_PER_FRAME; i++)
+            perEvent.ProcessMouseMovement(dx[i], dy[i]);
+        benchSink = perEvent.Front.x;
+    }));
+
+    const Camera_Input_Mode modes[] = { COALESCED, SMOOTHED };
+    const char* names[] = { "coalesced", "smoothed" };
+    for (int m = 0; m < 2; m++)
+    {
+        Camera camera;
+        CameraInputBuffer buffer;
+        double time = 0.0;
+        results.push_back(BenchRun("camera_input", "8khz_60fps", names[m], 1, [&] {
+            for (int i = 0; i < EVENTS_PER_FRAME; i++)
+            {
+                time += 1.0 / POLL_HZ;
+                buffer.Push(dx[i], dy[i], time);
+            }
+            buffer.ApplyFrame(camera, modes[m]);
+            benchSink = camera.Front.x;
+        }));
+    }
+
+    return BenchFinish(argc, argv, "camera_input", results);
+}
@@ -0,0 +1,332 @@
+// Microbenchmarks for the two math paths in this project: linmath.h (used by
+// main.cpp) and glm (used by learnOpengl/camera.h).
+//
+// Every operation is measured two ways:
+//   scalar - one call at a time, each call fed by the previous result, so the
+//            number reflects latency
+//   batch  - independent calls over BATCH inputs, so the number reflects
+//            throughput
+//
+// The "trig" group times the fasttrig.h accuracy modes the same way, plus
+// the 360-vertex circle tessellation main.cpp used to do per ball.
+//
+// Usage: math_bench [out.json]
+// Define MATH_BENCH_NO_GLM to build the linmath half without glm installed.
+
+#include <cmath>
+
+#include "../linmath.h"
+#include "bench.h"
+
+#ifndef MATH_BENCH_NO_GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#endif
+
+const int BATCH = 128;  // 3 arrays of 128 mat4 stay inside L1/L2
+
+// Deterministic input so runs are comparable
+static uint32_t rngState = 12345u;
+static float RandomFloat(float lo, float hi)
+{
+    rngState = rngState * 1664525u + 1013904223u;
+    return lo + (hi - lo) * ((rngState >> 8) * (1.0f / 16777216.0f));
+}
+
+static void RandomMat(mat4x4 m)
+{
+    // well conditioned: random rotation-ish plus a translation, so invert is meaningful
+    mat4x4 base;
+    mat4x4_identity(base);
+    mat4x4_rotate(m, base, RandomFloat(-1, 1), RandomFloat(-1, 1), RandomFloat(0.1f, 1), RandomFloat(0, 6.28f));
+    mat4x4_translate_in_place(m, RandomFloat(-5, 5), RandomFloat(-5, 5), RandomFloat(-5, 5));
+}
+
+static void BenchLinmath(std::vector<BenchResult>& results)
+{
+    static mat4x4 a[BATCH], b[BATCH], out[BATCH];
+    static vec3 eye[BATCH], center[BATCH], v[BATCH], vout[BATCH];
+    static quat q[BATCH], p[BATCH], qout[BATCH];
+    static float fov[BATCH];
+    vec3 up = { 0.f, 1.f, 0.f };
+
+    for (int i = 0; i < BATCH; i++)
+    {
+        RandomMat(a[i]);
+        RandomMat(b[i]);
+        for (int k = 0; k < 3; k++)
+        {
+            eye[i][k] = RandomFloat(-10, 10);
+            center[i][k] = RandomFloat(-10, 10);
+            v[i][k] = RandomFloat(-10, 10);
+        }
+        vec3 axis = { RandomFloat(-1, 1), RandomFloat(-1, 1), RandomFloat(0.1f, 1) };
+        vec3_norm(axis, axis);
+        quat_rotate(q[i], RandomFloat(0, 6.28f), axis);
+        quat_rotate(p[i], RandomFloat(0, 6.28f), axis);
+        fov[i] = RandomFloat(0.5f, 1.5f);
+    }
+
+    // scalar: dependent chains
+    {
+        mat4x4 acc;
+        mat4x4_dup(acc, a[0]);
+        results.push_back(BenchRun("linmath", "mat4_mul", "scalar", 1, [&] {
+            mat4x4_mul(acc, acc, b[0]);
+            benchSink = acc[3][3];
+        }));
+        mat4x4_dup(acc, a[0]);
+        results.push_back(BenchRun("linmath", "mat4_invert", "scalar", 1, [&] {
+            mat4x4 t;
+            mat4x4_invert(t, acc);
+            mat4x4_dup(acc, t);
+            benchSink = acc[0][0];
+        }));
+        vec3 e = { 1.f, 2.f, 3.f };
+        results.push_back(BenchRun("linmath", "look_at", "scalar", 1, [&] {
+            mat4x4_look_at(acc, e, center[0], up);
+            e[0] += acc[3][0] * 1e-9f;
+            benchSink = acc[3][2];
+        }));
+        float f = 1.0f;
+        results.push_back(BenchRun("linmath", "perspective", "scalar", 1, [&] {
+            mat4x4_perspective(acc, f, 16.f / 9.f, 0.1f, 100.f);
+            f += acc[0][0] * 1e-9f;
+            benchSink = acc[3][2];
+        }));
+        vec3 n = { 3.f, 4.f, 5.f };
+        results.push_back(BenchRun("linmath", "vec3_normalize", "scalar", 1, [&] {
+            vec3_norm(n, n);
+            benchSink = n[0];
+        }));
+        quat r;
+        std::memcpy(r, q[0], sizeof(r));
+        results.push_back(BenchRun("linmath", "quat_mul", "scalar", 1, [&] {
+            quat t;
+            quat_mul(t, r, p[0]);
+            std::memcpy(r, t, sizeof(r));
+            benchSink = r[3];
+        }));
+        vec3 w = { 1.f, 0.f, 0.f };
+        results.push_back(BenchRun("linmath", "quat_mul_vec3", "scalar", 1, [&] {
+            vec3 t;
+            quat_mul_vec3(t, q[0], w);
+            std::memcpy(w, t, sizeof(w));
+            benchSink = w[0];
+        }));
+        float ang = 0.5f;
+        results.push_back(BenchRun("linmath", "quat_rotate", "scalar", 1, [&] {
+            quat_rotate(r, ang, up);
+            ang += r[3] * 1e-9f;
+            benchSink = r[3];
+        }));
+    }
+
+    // batch: independent ops
+    results.push_back(BenchRun("linmath", "mat4_mul", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            mat4x4_mul(out[i], a[i], b[i]);
+        benchSink = out[BATCH - 1][3][3];
+    }));
+    results.push_back(BenchRun("linmath", "mat4_invert", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            mat4x4_invert(out[i], a[i]);
+        benchSink = out[BATCH - 1][0][0];
+    }));
+    results.push_back(BenchRun("linmath", "look_at", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            mat4x4_look_at(out[i], eye[i], center[i], up);
+        benchSink = out[BATCH - 1][3][2];
+    }));
+    results.push_back(BenchRun("linmath", "perspective", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            mat4x4_perspective(out[i], fov[i], 16.f / 9.f, 0.1f, 100.f);
+        benchSink = out[BATCH - 1][0][0];
+    }));
+    results.push_back(BenchRun("linmath", "vec3_normalize", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            vec3_norm(vout[i], v[i]);
+        benchSink = vout[BATCH - 1][0];
+    }));
+    results.push_back(BenchRun("linmath", "quat_mul", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            quat_mul(qout[i], q[i], p[i]);
+        benchSink = qout[BATCH - 1][3];
+    }));
+    results.push_back(BenchRun("linmath", "quat_mul_vec3", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            quat_mul_vec3(vout[i], q[i], v[i]);
+        benchSink = vout[BATCH - 1][0];
+    }));
+    results.push_back(BenchRun("linmath", "quat_rotate", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            quat_rotate(qout[i], fov[i], up);
+        benchSink = qout[BATCH - 1][3];
+    }));
+}
+
+static void BenchTrig(std::vector<BenchResult>& results)
+{
+    static const char* names[] = { "sincos_exact", "sincos_poly", "sincos_table" };
+    static float x[BATCH], s[BATCH], c[BATCH];
+    for (int i = 0; i < BATCH; i++)
+        x[i] = RandomFloat(-6.28f, 6.28f);
+
+    for (int a = TRIG_EXACT; a <= TRIG_TABLE; a++)
+    {
+        trig_accuracy acc = (trig_accuracy)a;
+        float ang = 0.5f;
+        results.push_back(BenchRun("trig", names[a], "scalar", 1, [&] {
+            float ss, cc;
+            trig_sincos(ang, &ss, &cc, acc);
+            ang += ss * 1e-3f;
+            benchSink = cc;
+        }));
+        results.push_back(BenchRun("trig", names[a], "batch", BATCH, [&] {
+            trig_sincos_batch(s, c, x, BATCH, acc);
+            benchSink = s[BATCH - 1] + c[BATCH - 1];
+        }));
+    }
+
+    // what Circle::DrawCircle computed for every ball, every frame
+    results.push_back(BenchRun("trig", "circle_360_libm", "batch", 360, [&] {
+        float sum = 0.f;
+        for (int i = 0; i < 360; i++)
+        {
+            float degInRad = i * (3.14159f / 180);
+            sum += cos(degInRad) + sin(degInRad);
+        }
+        benchSink = sum;
+    }));
+}
+
+#ifndef MATH_BENCH_NO_GLM
+static void BenchGlm(std::vector<BenchResult>& results)
+{
+    static glm::mat4 a[BATCH], b[BATCH], out[BATCH];
+    static glm::vec3 eye[BATCH], center[BATCH], v[BATCH], vout[BATCH];
+    static glm::quat q[BATCH], p[BATCH], qout[BATCH];
+    static float fov[BATCH];
+    const glm::vec3 up(0.f, 1.f, 0.f);
+
+    rngState = 12345u;  // same inputs as the linmath run
+    for (int i = 0; i < BATCH; i++)
+    {
+        mat4x4 la, lb;
+        RandomMat(la);
+        RandomMat(lb);
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+            {
+                a[i][c][r] = la[c][r];
+                b[i][c][r] = lb[c][r];
+            }
+        eye[i] = glm::vec3(RandomFloat(-10, 10), RandomFloat(-10, 10), RandomFloat(-10, 10));
+        center[i] = glm::vec3(RandomFloat(-10, 10), RandomFloat(-10, 10), RandomFloat(-10, 10));
+        v[i] = glm::vec3(RandomFloat(-10, 10), RandomFloat(-10, 10), RandomFloat(-10, 10));
+        glm::vec3 axis = glm::normalize(glm::vec3(RandomFloat(-1, 1), RandomFloat(-1, 1), RandomFloat(0.1f, 1)));
+        q[i] = glm::angleAxis(RandomFloat(0, 6.28f), axis);
+        p[i] = glm::angleAxis(RandomFloat(0, 6.28f), axis);
+        fov[i] = RandomFloat(0.5f, 1.5f);
+    }
+
+    {
+        glm::mat4 acc = a[0];
+        results.push_back(BenchRun("glm", "mat4_mul", "scalar", 1, [&] {
+            acc = acc * b[0];
+            benchSink = acc[3][3];
+        }));
+        acc = a[0];
+        results.push_back(BenchRun("glm", "mat4_invert", "scalar", 1, [&] {
+            acc = glm::inverse(acc);
+            benchSink = acc[0][0];
+        }));
+        glm::vec3 e(1.f, 2.f, 3.f);
+        results.push_back(BenchRun("glm", "look_at", "scalar", 1, [&] {
+            acc = glm::lookAt(e, center[0], up);
+            e.x += acc[3][0] * 1e-9f;
+            benchSink = acc[3][2];
+        }));
+        float f = 1.0f;
+        results.push_back(BenchRun("glm", "perspective", "scalar", 1, [&] {
+            acc = glm::perspective(f, 16.f / 9.f, 0.1f, 100.f);
+            f += acc[0][0] * 1e-9f;
+            benchSink = acc[3][2];
+        }));
+        glm::vec3 n(3.f, 4.f, 5.f);
+        results.push_back(BenchRun("glm", "vec3_normalize", "scalar", 1, [&] {
+            n = glm::normalize(n);
+            benchSink = n.x;
+        }));
+        glm::quat r = q[0];
+        results.push_back(BenchRun("glm", "quat_mul", "scalar", 1, [&] {
+            r = r * p[0];
+            benchSink = r.w;
+        }));
+        glm::vec3 w(1.f, 0.f, 0.f);
+        results.push_back(BenchRun("glm", "quat_mul_vec3", "scalar", 1, [&] {
+            w = q[0] * w;
+            benchSink = w.x;
+        }));
+        float ang = 0.5f;
+        results.push_back(BenchRun("glm", "quat_rotate", "scalar", 1, [&] {
+            r = glm::angleAxis(ang, up);
+            ang += r.w * 1e-9f;
+            benchSink = r.w;
+        }));
+    }
+
+    results.push_back(BenchRun("glm", "mat4_mul", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            out[i] = a[i] * b[i];
+        benchSink = out[BATCH - 1][3][3];
+    }));
+    results.push_back(BenchRun("glm", "mat4_invert", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            out[i] = glm::inverse(a[i]);
+        benchSink = out[BATCH - 1][0][0];
+    }));
+    results.push_back(BenchRun("glm", "look_at", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            out[i] = glm::lookAt(eye[i], center[i], up);
+        benchSink = out[BATCH - 1][3][2];
+    }));
+    results.push_back(BenchRun("glm", "perspective", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            out[i] = glm::perspective(fov[i], 16.f / 9.f, 0.1f, 100.f);
+        benchSink = out[BATCH - 1][0][0];
+    }));
+    results.push_back(BenchRun("glm", "vec3_normalize", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            vout[i] = glm::normalize(v[i]);
+        benchSink = vout[BATCH - 1].x;
+    }));
+    results.push_back(BenchRun("glm", "quat_mul", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            qout[i] = q[i] * p[i];
+        benchSink = qout[BATCH - 1].w;
+    }));
+    results.push_back(BenchRun("glm", "quat_mul_vec3", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            vout[i] = q[i] * v[i];
+        benchSink = vout[BATCH - 1].x;
+    }));
+    results.push_back(BenchRun("glm", "quat_rotate", "batch", BATCH, [&] {
+        for (int i = 0; i < BATCH; i++)
+            qout[i] = glm::angleAxis(fov[i], up);
+        benchSink = qout[BATCH - 1].w;
+    }));
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    std::vector<BenchResult> results;
+    BenchLinmath(results);
+    BenchTrig(results);
+#ifndef MATH_BENCH_NO_GLM
+    BenchGlm(results);
+#endif
+    return BenchFinish(argc, argv, "math", results);
+}
@@ -0,0 +1,167 @@
+#ifndef FASTTRIG_H
+#define FASTTRIG_H
+
+#include <cmath>
+#include <cstdint>
+
+#ifdef LINMATH_NO_INLINE
+#define FASTTRIG_FUNC static
+#else
+#define FASTTRIG_FUNC static inline
+#endif
+
+#if !defined(FASTTRIG_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define FASTTRIG_SSE2
+#include <emmintrin.h>
+#endif
+
+/* sin/cos with selectable accuracy. Max absolute error measured against
+ * double precision sin/cos:
+ *
+ *                                                  |x| <= 2pi   |x| <= 1000
+ *   TRIG_EXACT  libm sinf/cosf                        3.3e-8       3.3e-8
+ *   TRIG_POLY   Cody-Waite reduction to [-pi/4, pi/4]
+ *               plus degree 7/8 minimax polynomials   9.2e-8       9.2e-8
+ *               (cephes); degrades past |x| ~ 1e4
+ *   TRIG_TABLE  1024 entry table, linear interp       4.8e-6       8.8e-5
+ *               (large |x| loses index precision)
+ *
+ * Angles are in radians, like the rest of linmath.h. */
+typedef enum { TRIG_EXACT, TRIG_POLY, TRIG_TABLE } trig_accuracy;
+
+#define FASTTRIG_TABLE_SIZE 1024
+
+FASTTRIG_FUNC void trig_sincos_exact(float x, float* s, float* c)
+{
+	*s = sinf(x);
+	*c = cosf(x);
+}
+
+/* shared by the scalar and SSE2 polynomial paths */
+#define FASTTRIG_2_OVER_PI 0.636619772367581343f
+#define FASTTRIG_PIO2_1    1.5703125f
+#define FASTTRIG_PIO2_2    4.837512969970703125e-4f
+#define FASTTRIG_PIO2_3    7.54978995489188216e-8f
+#define FASTTRIG_S1       -1.6666654611e-1f
+#define FASTTRIG_S2        8.3321608736e-3f
+#define FASTTRIG_S3       -1.9515295891e-4f
+#define FASTTRIG_C1        4.166664568298827e-2f
+#define FASTTRIG_C2       -1.388731625493765e-3f
+#define FASTTRIG_C3        2.443315711809948e-5f
+
+FASTTRIG_FUNC void trig_sincos_poly(float x, float* s, float* c)
+{
+	/* floor(t + 0.5) without a libm call */
+	float t = x * FASTTRIG_2_OVER_PI + 0.5f;
+	int q = (int)t - (t < (float)(int)t);
+	float fq = (float)q;
+	float r = ((x - fq * FASTTRIG_PIO2_1) - fq * FASTTRIG_PIO2_2) - fq * FASTTRIG_PIO2_3;
+	float z = r * r;
+
+	float ps = r + r * z * (FASTTRIG_S1 + z * (FASTTRIG_S2 + z * FASTTRIG_S3));
+	float pc = 1.f - 0.5f * z + z * z * (FASTTRIG_C1 + z * (FASTTRIG_C2 + z * FASTTRIG_C3));
+
+	/* quadrant q rotates by q * 90 degrees */
+	float sv = (q & 1) ? pc : ps;
+	float cv = (q & 1) ? ps : pc;
+	*s = (q & 2) ? -sv : sv;
+	*c = ((q + 1) & 2) ? -cv : cv;
+}
+
+/* sin over one turn plus a quarter turn of padding so cos can index it too */
+struct trig__sin_table
+{
+	float v[FASTTRIG_TABLE_SIZE + FASTTRIG_TABLE_SIZE / 4 + 1];
+
+	trig__sin_table()
+	{
+		int i;
+		for (i = 0; i < FASTTRIG_TABLE_SIZE + FASTTRIG_TABLE_SIZE / 4 + 1; ++i)
+			v[i] = (float)sin(i * (6.283185307179586 / FASTTRIG_TABLE_SIZE));
+	}
+};
+
+FASTTRIG_FUNC float const* trig__table()
+{
+	/* filled on first use; concurrent first callers wait for it (C++11) */
+	static const trig__sin_table table;
+	return table.v;
+}
+
+FASTTRIG_FUNC void trig_sincos_table(float x, float* s, float* c)
+{
+	float const* table = trig__table();
+	float t = x * (FASTTRIG_TABLE_SIZE / 6.283185307179586f);
+	int64_t it = (int64_t)t - (t < (float)(int64_t)t);
+	float f = t - (float)it;
+	int i = (int)(it & (FASTTRIG_TABLE_SIZE - 1));
+	float const* ps = table + i;
+	float const* pc = table + i + FASTTRIG_TABLE_SIZE / 4;
+	*s = ps[0] + f * (ps[1] - ps[0]);
+	*c = pc[0] + f * (pc[1] - pc[0]);
+}
+
+FASTTRIG_FUNC void trig_sincos(float x, float* s, float* c, trig_accuracy accuracy)
+{
+	switch (accuracy) {
+	case TRIG_POLY:  trig_sincos_poly(x, s, c); break;
+	case TRIG_TABLE: trig_sincos_table(x, s, c); break;
+	default:         trig_sincos_exact(x, s, c); break;
+	}
+}
+
+/* s[i], c[i] = sin(x[i]), cos(x[i]) for n angles. The polynomial path runs
+ * four lanes at a time with SSE2 and produces the same results as
+ * trig_sincos_poly. s, c and x may not overlap. */
+FASTTRIG_FUNC void trig_sincos_batch(float* s, float* c, float const* x, int n, trig_accuracy accuracy)
+{
+	int i = 0;
+	if (accuracy == TRIG_POLY) {
+#ifdef FASTTRIG_SSE2
+		const __m128 two_over_pi = _mm_set1_ps(FASTTRIG_2_OVER_PI);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128i i1 = _mm_set1_epi32(1);
+		const __m128i i2 = _mm_set1_epi32(2);
+		const __m128 sign = _mm_set1_ps(-0.f);
+		for (; i + 4 <= n; i += 4) {
+			__m128 vx = _mm_loadu_ps(x + i);
+			/* floor(v + 0.5): truncate, then fix up negatives */
+			__m128 t = _mm_add_ps(_mm_mul_ps(vx, two_over_pi), half);
+			__m128i qi = _mm_cvttps_epi32(t);
+			__m128 fq = _mm_cvtepi32_ps(qi);
+			__m128 fix = _mm_cmplt_ps(t, fq);
+			fq = _mm_sub_ps(fq, _mm_and_ps(fix, one));
+			qi = _mm_add_epi32(qi, _mm_castps_si128(fix)); /* fix lanes are -1 */
+
+			__m128 r = _mm_sub_ps(vx, _mm_mul_ps(fq, _mm_set1_ps(FASTTRIG_PIO2_1)));
+			r = _mm_sub_ps(r, _mm_mul_ps(fq, _mm_set1_ps(FASTTRIG_PIO2_2)));
+			r = _mm_sub_ps(r, _mm_mul_ps(fq, _mm_set1_ps(FASTTRIG_PIO2_3)));
+			__m128 z = _mm_mul_ps(r, r);
+
+			__m128 ps = _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(FASTTRIG_S3)), _mm_set1_ps(FASTTRIG_S2));
+			ps = _mm_add_ps(_mm_mul_ps(z, ps), _mm_set1_ps(FASTTRIG_S1));
+			ps = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, z), ps));
+
+			__m128 pc = _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(FASTTRIG_C3)), _mm_set1_ps(FASTTRIG_C2));
+			pc = _mm_add_ps(_mm_mul_ps(z, pc), _mm_set1_ps(FASTTRIG_C1));
+			pc = _mm_add_ps(_mm_sub_ps(one, _mm_mul_ps(half, z)), _mm_mul_ps(_mm_mul_ps(z, z), pc));
+
+			__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(qi, i1), i1));
+			__m128 sv = _mm_or_ps(_mm_and_ps(swap, pc), _mm_andnot_ps(swap, ps));
+			__m128 cv = _mm_or_ps(_mm_and_ps(swap, ps), _mm_andnot_ps(swap, pc));
+			__m128 sneg = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(qi, i2), i2));
+			__m128 cneg = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_add_epi32(qi, i1), i2), i2));
+			_mm_storeu_ps(s + i, _mm_xor_ps(sv, _mm_and_ps(sneg, sign)));
+			_mm_storeu_ps(c + i, _mm_xor_ps(cv, _mm_and_ps(cneg, sign)));
+		}
+#endif
+		for (; i < n; ++i)
+			trig_sincos_poly(x[i], s + i, c + i);
+		return;
+	}
+	for (; i < n; ++i)
+		trig_sincos(x[i], s + i, c + i, accuracy);
+}
+
+#endif
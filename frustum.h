@@ -0,0 +1,185 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "linmath.h"
+
+#include <cmath>
+
+#if !defined(FRUSTUM_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define FRUSTUM_SSE2
+#include <emmintrin.h>
+#endif
+
+/* View frustum as six planes (a, b, c, d) with normals pointing inside, so
+ * a point p is inside a plane when a*p.x + b*p.y + c*p.z + d >= 0.
+ * Order: left, right, bottom, top, near, far. */
+enum { FRUSTUM_LEFT, FRUSTUM_RIGHT, FRUSTUM_BOTTOM, FRUSTUM_TOP, FRUSTUM_NEAR, FRUSTUM_FAR, FRUSTUM_PLANES };
+typedef vec4 frustum[FRUSTUM_PLANES];
+
+/* Number of 32-bit words a visibility mask for n objects needs */
+#define FRUSTUM_MASK_WORDS(n) (((n) + 31) / 32)
+
+/* normalize so plane distances are in world units (needed for spheres) */
+LINMATH_H_FUNC void frustum__normalize_plane(vec4 p)
+{
+	float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+	if (len > 0.f)
+		vec4_scale(p, p, 1.f / len);
+}
+
+/* Gribb/Hartmann plane extraction. M is a view-projection (or just a
+ * projection, giving view-space planes) built with mat4x4_perspective /
+ * mat4x4_look_at, i.e. OpenGL clip space with -w <= z <= w. */
+LINMATH_H_FUNC void frustum_from_mat4x4(frustum F, mat4x4 M)
+{
+	vec4 r0, r1, r2, r3;
+	mat4x4_row(r0, M, 0);
+	mat4x4_row(r1, M, 1);
+	mat4x4_row(r2, M, 2);
+	mat4x4_row(r3, M, 3);
+
+	vec4_add(F[FRUSTUM_LEFT], r3, r0);
+	vec4_sub(F[FRUSTUM_RIGHT], r3, r0);
+	vec4_add(F[FRUSTUM_BOTTOM], r3, r1);
+	vec4_sub(F[FRUSTUM_TOP], r3, r1);
+	vec4_add(F[FRUSTUM_NEAR], r3, r2);
+	vec4_sub(F[FRUSTUM_FAR], r3, r2);
+
+	int i;
+	for (i = 0; i < FRUSTUM_PLANES; ++i)
+		frustum__normalize_plane(F[i]);
+}
+
+/* Same for the reversed-Z matrices from mat4x4_perspective_reversed*,
+ * whose clip depth range is [0, 1] with near at z = w and far at z = 0.
+ * With the infinite variant the far plane has no normal and never rejects. */
+LINMATH_H_FUNC void frustum_from_mat4x4_reversed(frustum F, mat4x4 M)
+{
+	vec4 r2, r3;
+	frustum_from_mat4x4(F, M); /* side planes are the same */
+	mat4x4_row(r2, M, 2);
+	mat4x4_row(r3, M, 3);
+	vec4_sub(F[FRUSTUM_NEAR], r3, r2);
+	vec4_scale(F[FRUSTUM_FAR], r2, 1.f);
+	frustum__normalize_plane(F[FRUSTUM_NEAR]);
+	frustum__normalize_plane(F[FRUSTUM_FAR]);
+}
+
+LINMATH_H_FUNC int frustum_test_sphere(frustum const F, float x, float y, float z, float r)
+{
+	int i;
+	for (i = 0; i < FRUSTUM_PLANES; ++i)
+		if (F[i][0] * x + F[i][1] * y + F[i][2] * z + F[i][3] < -r)
+			return 0;
+	return 1;
+}
+
+/* AABB given as center and half extents */
+LINMATH_H_FUNC int frustum_test_aabb(frustum const F, float cx, float cy, float cz, float ex, float ey, float ez)
+{
+	int i;
+	for (i = 0; i < FRUSTUM_PLANES; ++i) {
+		float d = F[i][0] * cx + F[i][1] * cy + F[i][2] * cz + F[i][3];
+		float e = fabsf(F[i][0]) * ex + fabsf(F[i][1]) * ey + fabsf(F[i][2]) * ez;
+		if (d + e < 0.f)
+			return 0;
+	}
+	return 1;
+}
+
+/* Batch tests over structure-of-arrays bounds. Bit i of mask (word i/32,
+ * bit i%32) is set when object i is at least partly inside. mask must hold
+ * FRUSTUM_MASK_WORDS(count) words. Returns the number of visible objects. */
+LINMATH_H_FUNC int frustum_cull_spheres(uint32_t* mask, frustum const F,
+	float const* x, float const* y, float const* z, float const* r, int count)
+{
+	int i = 0, visible = 0;
+	std::memset(mask, 0, FRUSTUM_MASK_WORDS(count) * sizeof(uint32_t));
+#ifdef FRUSTUM_SSE2
+	__m128 pa[FRUSTUM_PLANES], pb[FRUSTUM_PLANES], pc[FRUSTUM_PLANES], pd[FRUSTUM_PLANES];
+	int p;
+	for (p = 0; p < FRUSTUM_PLANES; ++p) {
+		pa[p] = _mm_set1_ps(F[p][0]);
+		pb[p] = _mm_set1_ps(F[p][1]);
+		pc[p] = _mm_set1_ps(F[p][2]);
+		pd[p] = _mm_set1_ps(F[p][3]);
+	}
+	for (; i + 4 <= count; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 vy = _mm_loadu_ps(y + i);
+		__m128 vz = _mm_loadu_ps(z + i);
+		__m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+		__m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (p = 0; p < FRUSTUM_PLANES; ++p) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pa[p], vx), _mm_mul_ps(pb[p], vy)),
+				_mm_add_ps(_mm_mul_ps(pc[p], vz), pd[p]));
+			in = _mm_and_ps(in, _mm_cmpge_ps(d, nr));
+		}
+		uint32_t bits = (uint32_t)_mm_movemask_ps(in);
+		mask[i >> 5] |= bits << (i & 31);
+		visible += (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + (bits >> 3);
+	}
+#endif
+	for (; i < count; ++i) {
+		if (frustum_test_sphere(F, x[i], y[i], z[i], r[i])) {
+			mask[i >> 5] |= 1u << (i & 31);
+			++visible;
+		}
+	}
+	return visible;
+}
+
+LINMATH_H_FUNC int frustum_cull_aabbs(uint32_t* mask, frustum const F,
+	float const* cx, float const* cy, float const* cz,
+	float const* ex, float const* ey, float const* ez, int count)
+{
+	int i = 0, visible = 0;
+	std::memset(mask, 0, FRUSTUM_MASK_WORDS(count) * sizeof(uint32_t));
+#ifdef FRUSTUM_SSE2
+	__m128 pa[FRUSTUM_PLANES], pb[FRUSTUM_PLANES], pc[FRUSTUM_PLANES], pd[FRUSTUM_PLANES];
+	__m128 aa[FRUSTUM_PLANES], ab[FRUSTUM_PLANES], ac[FRUSTUM_PLANES];
+	int p;
+	for (p = 0; p < FRUSTUM_PLANES; ++p) {
+		pa[p] = _mm_set1_ps(F[p][0]);
+		pb[p] = _mm_set1_ps(F[p][1]);
+		pc[p] = _mm_set1_ps(F[p][2]);
+		pd[p] = _mm_set1_ps(F[p][3]);
+		aa[p] = _mm_set1_ps(fabsf(F[p][0]));
+		ab[p] = _mm_set1_ps(fabsf(F[p][1]));
+		ac[p] = _mm_set1_ps(fabsf(F[p][2]));
+	}
+	for (; i + 4 <= count; i += 4) {
+		__m128 vx = _mm_loadu_ps(cx + i);
+		__m128 vy = _mm_loadu_ps(cy + i);
+		__m128 vz = _mm_loadu_ps(cz + i);
+		__m128 wx = _mm_loadu_ps(ex + i);
+		__m128 wy = _mm_loadu_ps(ey + i);
+		__m128 wz = _mm_loadu_ps(ez + i);
+		__m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (p = 0; p < FRUSTUM_PLANES; ++p) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pa[p], vx), _mm_mul_ps(pb[p], vy)),
+				_mm_add_ps(_mm_mul_ps(pc[p], vz), pd[p]));
+			__m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(aa[p], wx), _mm_mul_ps(ab[p], wy)),
+				_mm_mul_ps(ac[p], wz));
+			in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(d, e), _mm_setzero_ps()));
+		}
+		uint32_t bits = (uint32_t)_mm_movemask_ps(in);
+		mask[i >> 5] |= bits << (i & 31);
+		visible += (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + (bits >> 3);
+	}
+#endif
+	for (; i < count; ++i) {
+		if (frustum_test_aabb(F, cx[i], cy[i], cz[i], ex[i], ey[i], ez[i])) {
+			mask[i >> 5] |= 1u << (i & 31);
+			++visible;
+		}
+	}
+	return visible;
+}
+
+LINMATH_H_FUNC int frustum_mask_test(uint32_t const* mask, int i)
+{
+	return (mask[i >> 5] >> (i & 31)) & 1;
+}
+
+#endif
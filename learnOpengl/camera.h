@@ -22,6 +22,9 @@ const float PITCH       =  0.0f;
 const float SPEED       =  2.5f;
 const float SENSITIVITY =  0.1f;
 const float ZOOM        =  45.0f;
+const float ASPECT      =  4.0f / 3.0f;
+const float NEAR_PLANE  =  0.1f;
+const float FAR_PLANE   =  100.0f;
 
 
 // An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
@@ -43,7 +46,7 @@ public:
     float Zoom;
 
     // constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), AspectRatio(ASPECT), NearPlane(NEAR_PLANE), FarPlane(FAR_PLANE), Version(0)
     {
         Position = position;
         WorldUp = up;
@@ -52,7 +55,7 @@ public:
         updateCameraVectors();
     }
     // constructor with scalar values
-    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), AspectRatio(ASPECT), NearPlane(NEAR_PLANE), FarPlane(FAR_PLANE), Version(0)
     {
         Position = glm::vec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
@@ -61,10 +64,97 @@ public:
         updateCameraVectors();
     }
 
-    // returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    glm::mat4 GetViewMatrix()
+    // returns the view matrix calculated using Euler Angles and the LookAt Matrix, rebuilt only after the camera changed
+    const glm::mat4& GetViewMatrix()
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        if (viewDirty)
+        {
+            viewMatrix = glm::lookAt(Position, Position + Front, Up);
+            viewDirty = false;
+        }
+        return viewMatrix;
+    }
+
+    // returns the perspective projection for the current Zoom, aspect ratio and clip planes
+    const glm::mat4& GetProjectionMatrix()
+    {
+        if (projectionDirty)
+        {
+            if (ReversedZ)
+            {
+                // same as mat4x4_perspective_reversed_infinite in linmath.h: depth = near / -z, FarPlane is unused
+                float f = 1.0f / tan(glm::radians(Zoom) * 0.5f);
+                projectionMatrix = glm::mat4(0.0f);
+                projectionMatrix[0][0] = f / AspectRatio;
+                projectionMatrix[1][1] = f;
+                projectionMatrix[2][3] = -1.0f;
+                projectionMatrix[3][2] = NearPlane;
+            }
+            else
+                projectionMatrix = glm::perspective(glm::radians(Zoom), AspectRatio, NearPlane, FarPlane);
+            projectionDirty = false;
+        }
+        return projectionMatrix;
+    }
+
+    // returns projection * view
+    const glm::mat4& GetViewProjectionMatrix()
+    {
+        if (viewProjectionVersion != Version)
+        {
+            viewProjectionMatrix = GetProjectionMatrix() * GetViewMatrix();
+            viewProjectionVersion = Version;
+        }
+        return viewProjectionMatrix;
+    }
+
+    // bumped on every change to the view or projection, so downstream caches (culling, uniforms) can compare it and skip work
+    unsigned int GetVersion() const
+    {
+        return Version;
+    }
+
+    // call when the framebuffer is resized
+    void SetAspectRatio(float aspect)
+    {
+        if (aspect != AspectRatio)
+        {
+            AspectRatio = aspect;
+            invalidateProjection();
+        }
+    }
+
+    void SetClipPlanes(float nearPlane, float farPlane)
+    {
+        if (nearPlane != NearPlane || farPlane != FarPlane)
+        {
+            NearPlane = nearPlane;
+            FarPlane = farPlane;
+            invalidateProjection();
+        }
+    }
+
+    // switches to a reversed-Z, infinite far plane projection; needs the depth state from reversed_z.h
+    void SetReversedZ(bool enabled)
+    {
+        if (enabled != ReversedZ)
+        {
+            ReversedZ = enabled;
+            invalidateProjection();
+        }
+    }
+
+    bool IsReversedZ() const
+    {
+        return ReversedZ;
+    }
+
+    // call after writing Position, Yaw, Pitch, WorldUp or Zoom directly instead of through the Process* functions
+    void MarkDirty()
+    {
+        updateCameraVectors();
+        invalidateView();
+        invalidateProjection();
     }
 
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
@@ -83,6 +173,8 @@ public:
             Position += UPWARD * velocity;
         if (direction == DOWNWARD)
             Position -= DOWNWARD * velocity;
+        if (velocity != 0.0f)
+            invalidateView();
     }
 
     // processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -105,19 +197,50 @@ public:
 
         // update Front, Right and Up Vectors using the updated Euler angles
         updateCameraVectors();
+        invalidateView();
     }
 
     // processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
+        float oldZoom = Zoom;
         Zoom -= (float)yoffset;
         if (Zoom < 1.0f)
             Zoom = 1.0f;
         if (Zoom > 45.0f)
             Zoom = 45.0f;
+        if (Zoom != oldZoom)
+            invalidateProjection();
     }
 
 private:
+    // projection parameters, change them through SetAspectRatio / SetClipPlanes so the cache notices
+    float AspectRatio;
+    float NearPlane;
+    float FarPlane;
+    bool ReversedZ = false;
+
+    // cached matrices and the version they were built for
+    glm::mat4 viewMatrix;
+    glm::mat4 projectionMatrix;
+    glm::mat4 viewProjectionMatrix;
+    bool viewDirty = true;
+    bool projectionDirty = true;
+    unsigned int Version;
+    unsigned int viewProjectionVersion = ~0u;
+
+    void invalidateView()
+    {
+        viewDirty = true;
+        Version++;
+    }
+
+    void invalidateProjection()
+    {
+        projectionDirty = true;
+        Version++;
+    }
+
     // calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors()
     {
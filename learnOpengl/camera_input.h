@@ -0,0 +1,107 @@
+#ifndef CAMERA_INPUT_H
+#define CAMERA_INPUT_H
+
+#include "camera.h"
+
+#include <cmath>
+#include <vector>
+
+// How queued mouse samples are turned into camera motion
+enum Camera_Input_Mode {
+    COALESCED,  // sum all deltas, one camera update per frame
+    SMOOTHED    // run every sample through a time-based low-pass filter first, still one camera update;
+                // trades a few ms of lag (and the tail of a flick) for less jitter
+};
+
+// Buffers raw mouse deltas with timestamps so high polling rate mice (1-8 kHz)
+// cost one Camera::ProcessMouseMovement per frame - one trig and normalize
+// pass - instead of one per event. Push from the cursor callback, apply once
+// per frame on the same thread.
+class CameraInputBuffer
+{
+public:
+    // time constant of the SMOOTHED filter in seconds
+    float SmoothingTime = 0.008f;
+
+    CameraInputBuffer()
+    {
+        samples.reserve(256);
+    }
+
+    // queue one raw mouse delta; time is in seconds on any monotonic clock
+    void Push(float xoffset, float yoffset, double time)
+    {
+        Sample s = { xoffset, yoffset, time };
+        samples.push_back(s);
+    }
+
+    size_t Pending() const
+    {
+        return samples.size();
+    }
+
+    // timestamp of the oldest queued sample, only meaningful while Pending() > 0
+    double OldestTime() const
+    {
+        return samples.empty() ? 0.0 : samples.front().Time;
+    }
+
+    // Applies everything queued since the last call. Returns the number of samples consumed.
+    size_t ApplyFrame(Camera& camera, Camera_Input_Mode mode = COALESCED, GLboolean constrainPitch = true)
+    {
+        size_t count = samples.size();
+        if (count == 0)
+            return 0;
+
+        float x = 0.0f, y = 0.0f;
+        if (mode == COALESCED)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                x += samples[i].X;
+                y += samples[i].Y;
+            }
+        }
+        else
+        {
+            // exponential moving average of mouse velocity, integrated back
+            // into a delta; uneven sample spacing is handled through dt
+            for (size_t i = 0; i < count; i++)
+            {
+                double dt = samples[i].Time - lastTime;
+                if (dt <= 0.0 || dt > 0.1)
+                    dt = 1.0 / 1000.0;  // first sample, clock jump or long idle: assume 1 kHz
+                float alpha = 1.0f - std::exp(-(float)dt / SmoothingTime);
+                velocityX += alpha * (samples[i].X / (float)dt - velocityX);
+                velocityY += alpha * (samples[i].Y / (float)dt - velocityY);
+                x += velocityX * (float)dt;
+                y += velocityY * (float)dt;
+                lastTime = samples[i].Time;
+            }
+        }
+        samples.clear();
+        camera.ProcessMouseMovement(x, y, constrainPitch);
+        return count;
+    }
+
+    // drops queued samples and filter state, e.g. when the cursor is released
+    void Reset()
+    {
+        samples.clear();
+        velocityX = velocityY = 0.0f;
+        lastTime = 0.0;
+    }
+
+private:
+    struct Sample
+    {
+        float X, Y;
+        double Time;
+    };
+
+    std::vector<Sample> samples;
+    float velocityX = 0.0f;
+    float velocityY = 0.0f;
+    double lastTime = 0.0;
+};
+#endif
@@ -0,0 +1,304 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include "camera.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// One recorded camera state
+struct CameraPathKey
+{
+    float Time;   // seconds since recording started
+    float PosX, PosY, PosZ;
+    float Yaw, Pitch, Zoom;
+};
+
+// File layout: "CPTH", uint32 version, uint32 key count, then the keys as
+// 7 little-endian floats each (28 bytes per key).
+const char CAMERA_PATH_MAGIC[4] = { 'C', 'P', 'T', 'H' };
+const uint32_t CAMERA_PATH_VERSION = 1;
+const size_t CAMERA_PATH_KEY_BYTES = 28;
+
+// The file is little-endian whatever the host is, so paths can be shared
+// between machines; values go through these byte by byte.
+inline void cameraPathPutU32(unsigned char* p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+inline uint32_t cameraPathGetU32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline void cameraPathPutKey(unsigned char* p, const CameraPathKey& k)
+{
+    const float v[7] = { k.Time, k.PosX, k.PosY, k.PosZ, k.Yaw, k.Pitch, k.Zoom };
+    for (int i = 0; i < 7; i++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &v[i], 4);
+        cameraPathPutU32(p + i * 4, bits);
+    }
+}
+
+inline void cameraPathGetKey(const unsigned char* p, CameraPathKey& k)
+{
+    float v[7];
+    for (int i = 0; i < 7; i++)
+    {
+        uint32_t bits = cameraPathGetU32(p + i * 4);
+        memcpy(&v[i], &bits, 4);
+    }
+    k.Time = v[0];
+    k.PosX = v[1]; k.PosY = v[2]; k.PosZ = v[3];
+    k.Yaw = v[4]; k.Pitch = v[5]; k.Zoom = v[6];
+}
+
+// Records the camera once per frame. Frames where the camera did not move
+// are not stored, except the last one of a still stretch so playback holds
+// the pose instead of drifting towards the next key.
+class CameraPathRecorder
+{
+public:
+    void Record(const Camera& camera, float time)
+    {
+        CameraPathKey key = { time, camera.Position.x, camera.Position.y, camera.Position.z, camera.Yaw, camera.Pitch, camera.Zoom };
+        if (!Keys.empty() && samePose(Keys.back(), key))
+        {
+            held = key;
+            hasHeld = true;
+            return;
+        }
+        if (hasHeld)
+            Keys.push_back(held);
+        hasHeld = false;
+        Keys.push_back(key);
+    }
+
+    bool Save(const char* path)
+    {
+        if (hasHeld)
+        {
+            Keys.push_back(held);
+            hasHeld = false;
+        }
+        std::vector<unsigned char> bytes(12 + Keys.size() * CAMERA_PATH_KEY_BYTES);
+        memcpy(&bytes[0], CAMERA_PATH_MAGIC, 4);
+        cameraPathPutU32(&bytes[4], CAMERA_PATH_VERSION);
+        cameraPathPutU32(&bytes[8], (uint32_t)Keys.size());
+        for (size_t i = 0; i < Keys.size(); i++)
+            cameraPathPutKey(&bytes[12 + i * CAMERA_PATH_KEY_BYTES], Keys[i]);
+
+        FILE* f = fopen(path, "wb");
+        if (!f)
+            return false;
+        bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+        return fclose(f) == 0 && ok;
+    }
+
+    std::vector<CameraPathKey> Keys;
+
+private:
+    CameraPathKey held;
+    bool hasHeld = false;
+
+    static bool samePose(const CameraPathKey& a, const CameraPathKey& b)
+    {
+        return a.PosX == b.PosX && a.PosY == b.PosY && a.PosZ == b.PosZ
+            && a.Yaw == b.Yaw && a.Pitch == b.Pitch && a.Zoom == b.Zoom;
+    }
+};
+
+// Frame time distribution for a benchmark run, in milliseconds
+class FrameTimeStats
+{
+public:
+    void Add(double ms)
+    {
+        samples.push_back(ms);
+    }
+
+    size_t Count() const
+    {
+        return samples.size();
+    }
+
+    // p in [0, 100]
+    double Percentile(double p) const
+    {
+        if (samples.empty())
+            return 0.0;
+        std::vector<double> sorted(samples);
+        std::sort(sorted.begin(), sorted.end());
+        size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(i, sorted.size() - 1)];
+    }
+
+    double Mean() const
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < samples.size(); i++)
+            sum += samples[i];
+        return samples.empty() ? 0.0 : sum / samples.size();
+    }
+
+    void WriteJson(FILE* out, const char* pathName) const
+    {
+        fprintf(out, "{\n  \"suite\": \"camera_path\",\n  \"path\": \"%s\",\n  \"frames\": %u,\n", pathName, (unsigned)samples.size());
+        fprintf(out, "  \"frame_ms\": {\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}\n}\n",
+                Percentile(0), Mean(), Percentile(50), Percentile(90), Percentile(95), Percentile(99), Percentile(100));
+    }
+
+private:
+    std::vector<double> samples;
+};
+
+// Plays a recorded path back with Catmull-Rom style (cubic Hermite) interpolation, so every run sees the same views
+class CameraPathPlayer
+{
+public:
+    bool Load(const char* path)
+    {
+        Keys.clear();
+        FILE* f = fopen(path, "rb");
+        if (!f)
+            return false;
+        unsigned char header[12];
+        bool ok = fread(header, 12, 1, f) == 1 && memcmp(header, CAMERA_PATH_MAGIC, 4) == 0
+               && cameraPathGetU32(header + 4) == CAMERA_PATH_VERSION;
+        if (ok)
+        {
+            // the count comes from the file: check it against what is
+            // actually there before allocating for it
+            uint32_t count = cameraPathGetU32(header + 8);
+            long here = ftell(f);
+            ok = here >= 0 && fseek(f, 0, SEEK_END) == 0;
+            long end = ok ? ftell(f) : -1;
+            ok = ok && end >= here && (uint64_t)(end - here) >= (uint64_t)count * CAMERA_PATH_KEY_BYTES
+                    && fseek(f, here, SEEK_SET) == 0;
+            if (ok && count > 0)
+            {
+                std::vector<unsigned char> bytes((size_t)count * CAMERA_PATH_KEY_BYTES);
+                ok = fread(bytes.data(), 1, bytes.size(), f) == bytes.size();
+                if (ok)
+                {
+                    Keys.resize(count);
+                    for (uint32_t i = 0; i < count; i++)
+                        cameraPathGetKey(&bytes[(size_t)i * CAMERA_PATH_KEY_BYTES], Keys[i]);
+                }
+            }
+        }
+        fclose(f);
+        if (!ok)
+            Keys.clear();
+        return ok && !Keys.empty();
+    }
+
+    float Duration() const
+    {
+        return Keys.empty() ? 0.0f : Keys.back().Time - Keys.front().Time;
+    }
+
+    // poses the camera at time t (seconds from the start of the path)
+    void Evaluate(float t, Camera& camera) const
+    {
+        if (Keys.empty())
+            return;
+        t += Keys.front().Time;
+        size_t n = Keys.size();
+        float pose[6];
+        if (n == 1 || t <= Keys.front().Time)
+            toArray(Keys.front(), pose);
+        else if (t >= Keys.back().Time)
+            toArray(Keys.back(), pose);
+        else
+        {
+            // segment k with Keys[k].Time <= t < Keys[k + 1].Time
+            size_t k = 0, hi = n - 1;
+            while (hi - k > 1)
+            {
+                size_t mid = (k + hi) / 2;
+                if (Keys[mid].Time <= t)
+                    k = mid;
+                else
+                    hi = mid;
+            }
+            const CameraPathKey& a = Keys[k];
+            const CameraPathKey& b = Keys[k + 1];
+            const CameraPathKey& prev = Keys[k > 0 ? k - 1 : k];
+            const CameraPathKey& next = Keys[k + 2 < n ? k + 2 : k + 1];
+            float h = b.Time - a.Time;
+            float u = h > 0.0f ? (t - a.Time) / h : 0.0f;
+            float u2 = u * u, u3 = u2 * u;
+            float h00 = 2 * u3 - 3 * u2 + 1, h10 = u3 - 2 * u2 + u;
+            float h01 = -2 * u3 + 3 * u2,    h11 = u3 - u2;
+
+            float pa[6], pb[6], pp[6], pn[6];
+            toArray(a, pa); toArray(b, pb); toArray(prev, pp); toArray(next, pn);
+            float spanA = b.Time - prev.Time, spanB = next.Time - a.Time;
+            for (int i = 0; i < 6; i++)
+            {
+                // finite-difference tangents, scaled to the segment length
+                float ma = spanA > 0.0f ? (pb[i] - pp[i]) / spanA * h : 0.0f;
+                float mb = spanB > 0.0f ? (pn[i] - pa[i]) / spanB * h : 0.0f;
+                pose[i] = h00 * pa[i] + h10 * ma + h01 * pb[i] + h11 * mb;
+            }
+        }
+        camera.Position = glm::vec3(pose[0], pose[1], pose[2]);
+        camera.Yaw = pose[3];
+        camera.Pitch = pose[4];
+        camera.Zoom = pose[5];
+        camera.MarkDirty();
+    }
+
+    // Benchmark mode: replay the path at a fixed step regardless of how long frames take
+    void StartBenchmark(float fixedDt)
+    {
+        step = fixedDt;
+        playTime = 0.0f;
+        frameTimes = FrameTimeStats();
+        started = false;
+    }
+
+    // Call once per frame before drawing, passing how long the previous
+    // frame took. Returns false when the path is finished.
+    bool BenchmarkFrame(Camera& camera, double lastFrameSeconds)
+    {
+        if (started)
+            frameTimes.Add(lastFrameSeconds * 1000.0);
+        started = true;
+        if (playTime > Duration())
+            return false;
+        Evaluate(playTime, camera);
+        playTime += step;
+        return true;
+    }
+
+    const FrameTimeStats& GetFrameTimes() const
+    {
+        return frameTimes;
+    }
+
+    std::vector<CameraPathKey> Keys;
+
+private:
+    float step = 1.0f / 60.0f;
+    float playTime = 0.0f;
+    bool started = false;
+    FrameTimeStats frameTimes;
+
+    static void toArray(const CameraPathKey& k, float* out)
+    {
+        out[0] = k.PosX; out[1] = k.PosY; out[2] = k.PosZ;
+        out[3] = k.Yaw;  out[4] = k.Pitch; out[5] = k.Zoom;
+    }
+};
+#endif
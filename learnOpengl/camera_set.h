@@ -0,0 +1,284 @@
+#ifndef CAMERA_SET_H
+#define CAMERA_SET_H
+
+#include "camera.h"
+#include "../frustum.h"
+
+#include <cstring>
+#include <vector>
+
+// A set of viewpoints (split-screen players, minimap, shadow views) kept as
+// structure-of-arrays. Update() rebuilds the basis vectors and matrices of
+// every view in one pass of branch-free loops the compiler can vectorize,
+// and the Cull* functions walk the objects once and produce a visibility
+// mask per view, instead of one Camera and one culling pass per view.
+class CameraSet
+{
+public:
+    // adds a view that starts out as a copy of camera; returns its index
+    int Add(const Camera& camera, float aspect = ASPECT, float nearPlane = NEAR_PLANE, float farPlane = FAR_PLANE)
+    {
+        posX.push_back(camera.Position.x);
+        posY.push_back(camera.Position.y);
+        posZ.push_back(camera.Position.z);
+        upX.push_back(camera.WorldUp.x);
+        upY.push_back(camera.WorldUp.y);
+        upZ.push_back(camera.WorldUp.z);
+        yaw.push_back(camera.Yaw);
+        pitch.push_back(camera.Pitch);
+        zoom.push_back(camera.Zoom);
+        aspectRatio.push_back(aspect);
+        nearPlanes.push_back(nearPlane);
+        farPlanes.push_back(farPlane);
+        for (int k = 0; k < 3; k++)
+        {
+            front[k].push_back(0.0f);
+            right[k].push_back(0.0f);
+            up[k].push_back(0.0f);
+        }
+        views.push_back(glm::mat4(1.0f));
+        projections.push_back(glm::mat4(1.0f));
+        viewProjections.push_back(glm::mat4(1.0f));
+        Frustum f;
+        frustums.push_back(f);
+        dirty = true;
+        return Count() - 1;
+    }
+
+    int Count() const
+    {
+        return (int)posX.size();
+    }
+
+    void SetPose(int i, glm::vec3 position, float yawDegrees, float pitchDegrees)
+    {
+        posX[i] = position.x;
+        posY[i] = position.y;
+        posZ[i] = position.z;
+        yaw[i] = yawDegrees;
+        pitch[i] = pitchDegrees;
+        dirty = true;
+    }
+
+    void SetProjection(int i, float zoomDegrees, float aspect, float nearPlane, float farPlane)
+    {
+        zoom[i] = zoomDegrees;
+        aspectRatio[i] = aspect;
+        nearPlanes[i] = nearPlane;
+        farPlanes[i] = farPlane;
+        dirty = true;
+    }
+
+    // recomputes Front/Right/Up, view, projection, view-projection and frustum planes for all views
+    void Update()
+    {
+        if (!dirty)
+            return;
+        int n = Count();
+        std::vector<float> angles(3 * n), sines(3 * n), cosines(3 * n);
+        for (int i = 0; i < n; i++)
+        {
+            angles[i] = glm::radians(yaw[i]);
+            angles[n + i] = glm::radians(pitch[i]);
+            angles[2 * n + i] = glm::radians(zoom[i]) * 0.5f;
+        }
+        trig_sincos_batch(sines.data(), cosines.data(), angles.data(), 3 * n, TRIG_POLY);
+
+        // same math as Camera::updateCameraVectors, one view per lane
+        float* fx = front[0].data(); float* fy = front[1].data(); float* fz = front[2].data();
+        float* rx = right[0].data(); float* ry = right[1].data(); float* rz = right[2].data();
+        float* ux = up[0].data();    float* uy = up[1].data();    float* uz = up[2].data();
+        for (int i = 0; i < n; i++)
+        {
+            float cp = cosines[n + i];
+            float x = cosines[i] * cp;
+            float y = sines[n + i];
+            float z = sines[i] * cp;
+            float inv = 1.0f / std::sqrt(x * x + y * y + z * z);
+            fx[i] = x * inv; fy[i] = y * inv; fz[i] = z * inv;
+
+            x = fy[i] * upZ[i] - fz[i] * upY[i];
+            y = fz[i] * upX[i] - fx[i] * upZ[i];
+            z = fx[i] * upY[i] - fy[i] * upX[i];
+            inv = 1.0f / std::sqrt(x * x + y * y + z * z);
+            rx[i] = x * inv; ry[i] = y * inv; rz[i] = z * inv;
+
+            x = ry[i] * fz[i] - rz[i] * fy[i];
+            y = rz[i] * fx[i] - rx[i] * fz[i];
+            z = rx[i] * fy[i] - ry[i] * fx[i];
+            inv = 1.0f / std::sqrt(x * x + y * y + z * z);
+            ux[i] = x * inv; uy[i] = y * inv; uz[i] = z * inv;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            // glm::lookAt(Position, Position + Front, Up) with the basis already known
+            glm::mat4& v = views[i];
+            v[0][0] = rx[i]; v[1][0] = ry[i]; v[2][0] = rz[i];
+            v[0][1] = ux[i]; v[1][1] = uy[i]; v[2][1] = uz[i];
+            v[0][2] = -fx[i]; v[1][2] = -fy[i]; v[2][2] = -fz[i];
+            v[0][3] = 0.0f; v[1][3] = 0.0f; v[2][3] = 0.0f;
+            v[3][0] = -(rx[i] * posX[i] + ry[i] * posY[i] + rz[i] * posZ[i]);
+            v[3][1] = -(ux[i] * posX[i] + uy[i] * posY[i] + uz[i] * posZ[i]);
+            v[3][2] = fx[i] * posX[i] + fy[i] * posY[i] + fz[i] * posZ[i];
+            v[3][3] = 1.0f;
+
+            // glm::perspective(radians(Zoom), aspect, near, far)
+            glm::mat4& p = projections[i];
+            float cotHalf = cosines[2 * n + i] / sines[2 * n + i];
+            float range = nearPlanes[i] - farPlanes[i];
+            p = glm::mat4(0.0f);
+            p[0][0] = cotHalf / aspectRatio[i];
+            p[1][1] = cotHalf;
+            p[2][2] = (farPlanes[i] + nearPlanes[i]) / range;
+            p[2][3] = -1.0f;
+            p[3][2] = 2.0f * farPlanes[i] * nearPlanes[i] / range;
+
+            viewProjections[i] = p * v;
+            mat4x4 m;
+            std::memcpy(m, &viewProjections[i][0][0], sizeof(m));
+            frustum_from_mat4x4(frustums[i].planes, m);
+        }
+        dirty = false;
+        version++;
+    }
+
+    const glm::mat4& GetViewMatrix(int i) const { return views[i]; }
+    const glm::mat4& GetProjectionMatrix(int i) const { return projections[i]; }
+    const glm::mat4& GetViewProjectionMatrix(int i) const { return viewProjections[i]; }
+    glm::vec3 GetFront(int i) const { return glm::vec3(front[0][i], front[1][i], front[2][i]); }
+    glm::vec3 GetRight(int i) const { return glm::vec3(right[0][i], right[1][i], right[2][i]); }
+    glm::vec3 GetUp(int i) const { return glm::vec3(up[0][i], up[1][i], up[2][i]); }
+    unsigned int GetVersion() const { return version; }
+
+    // Words per view in the masks written by the Cull* functions
+    static int MaskWords(int objectCount)
+    {
+        return FRUSTUM_MASK_WORDS(objectCount);
+    }
+
+    // Tests every sphere against every view in a single walk over the
+    // objects. masks holds Count() * MaskWords(count) words; view v's mask
+    // starts at masks + v * MaskWords(count). Call Update() first.
+    void CullSpheres(uint32_t* masks, const float* x, const float* y, const float* z, const float* r, int count) const
+    {
+        int viewCount = Count();
+        int words = MaskWords(count);
+        std::memset(masks, 0, sizeof(uint32_t) * words * viewCount);
+        int i = 0;
+#ifdef FRUSTUM_SSE2
+        std::vector<Broadcast> planes;
+        BroadcastPlanes(planes, false);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 vx = _mm_loadu_ps(x + i);
+            __m128 vy = _mm_loadu_ps(y + i);
+            __m128 vz = _mm_loadu_ps(z + i);
+            __m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+            const Broadcast* pl = planes.data();
+            for (int v = 0; v < viewCount; v++)
+            {
+                __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int p = 0; p < FRUSTUM_PLANES; p++, pl += 4)
+                {
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl[0].v, vx), _mm_mul_ps(pl[1].v, vy)),
+                                          _mm_add_ps(_mm_mul_ps(pl[2].v, vz), pl[3].v));
+                    in = _mm_and_ps(in, _mm_cmpge_ps(d, nr));
+                }
+                masks[v * words + (i >> 5)] |= (uint32_t)_mm_movemask_ps(in) << (i & 31);
+            }
+        }
+#endif
+        for (; i < count; i++)
+            for (int v = 0; v < viewCount; v++)
+                if (frustum_test_sphere(frustums[v].planes, x[i], y[i], z[i], r[i]))
+                    masks[v * words + (i >> 5)] |= 1u << (i & 31);
+    }
+
+    // Same as CullSpheres for AABBs given as center and half extents
+    void CullAabbs(uint32_t* masks, const float* cx, const float* cy, const float* cz,
+                   const float* ex, const float* ey, const float* ez, int count) const
+    {
+        int viewCount = Count();
+        int words = MaskWords(count);
+        std::memset(masks, 0, sizeof(uint32_t) * words * viewCount);
+        int i = 0;
+#ifdef FRUSTUM_SSE2
+        std::vector<Broadcast> planes;
+        BroadcastPlanes(planes, true);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 vx = _mm_loadu_ps(cx + i);
+            __m128 vy = _mm_loadu_ps(cy + i);
+            __m128 vz = _mm_loadu_ps(cz + i);
+            __m128 wx = _mm_loadu_ps(ex + i);
+            __m128 wy = _mm_loadu_ps(ey + i);
+            __m128 wz = _mm_loadu_ps(ez + i);
+            const Broadcast* pl = planes.data();
+            for (int v = 0; v < viewCount; v++)
+            {
+                __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int p = 0; p < FRUSTUM_PLANES; p++, pl += 7)
+                {
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl[0].v, vx), _mm_mul_ps(pl[1].v, vy)),
+                                          _mm_add_ps(_mm_mul_ps(pl[2].v, vz), pl[3].v));
+                    __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl[4].v, wx), _mm_mul_ps(pl[5].v, wy)),
+                                          _mm_mul_ps(pl[6].v, wz));
+                    in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(d, e), _mm_setzero_ps()));
+                }
+                masks[v * words + (i >> 5)] |= (uint32_t)_mm_movemask_ps(in) << (i & 31);
+            }
+        }
+#endif
+        for (; i < count; i++)
+            for (int v = 0; v < viewCount; v++)
+                if (frustum_test_aabb(frustums[v].planes, cx[i], cy[i], cz[i], ex[i], ey[i], ez[i]))
+                    masks[v * words + (i >> 5)] |= 1u << (i & 31);
+    }
+
+private:
+    struct Frustum
+    {
+        frustum planes;
+    };
+
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> upX, upY, upZ;         // world up per view
+    std::vector<float> yaw, pitch, zoom;      // degrees, like Camera
+    std::vector<float> aspectRatio, nearPlanes, farPlanes;
+    std::vector<float> front[3], right[3], up[3];
+    std::vector<glm::mat4> views, projections, viewProjections;
+    std::vector<Frustum> frustums;
+    bool dirty = true;
+    unsigned int version = 0;
+
+#ifdef FRUSTUM_SSE2
+    struct Broadcast
+    {
+        __m128 v;
+    };
+
+    // a, b, c, d broadcast per plane per view (plus |a|, |b|, |c| for boxes)
+    void BroadcastPlanes(std::vector<Broadcast>& out, bool withAbs) const
+    {
+        out.clear();
+        out.reserve(Count() * FRUSTUM_PLANES * (withAbs ? 7 : 4));
+        for (int v = 0; v < Count(); v++)
+            for (int p = 0; p < FRUSTUM_PLANES; p++)
+            {
+                const float* plane = frustums[v].planes[p];
+                out.push_back(Broadcast{ _mm_set1_ps(plane[0]) });
+                out.push_back(Broadcast{ _mm_set1_ps(plane[1]) });
+                out.push_back(Broadcast{ _mm_set1_ps(plane[2]) });
+                out.push_back(Broadcast{ _mm_set1_ps(plane[3]) });
+                if (withAbs)
+                {
+                    out.push_back(Broadcast{ _mm_set1_ps(std::fabs(plane[0])) });
+                    out.push_back(Broadcast{ _mm_set1_ps(std::fabs(plane[1])) });
+                    out.push_back(Broadcast{ _mm_set1_ps(std::fabs(plane[2])) });
+                }
+            }
+    }
+#endif
+};
+#endif
@@ -0,0 +1,129 @@
+#ifndef LATE_LATCH_H
+#define LATE_LATCH_H
+
+#include "camera.h"
+#include "camera_input.h"
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+// Input-to-submit latency numbers, in milliseconds
+struct LatchStats
+{
+    double lastMs = 0.0;      // age of the oldest input folded into the last submitted latch
+    double averageMs = 0.0;
+    double maxMs = 0.0;
+    unsigned long long latches = 0;  // submitted latches that consumed at least one input
+};
+
+// Late latching for mouse look. Instead of turning the camera when events
+// arrive (usually at the top of the frame), mouse deltas are queued and
+// applied right before the draw that uses the view-projection matrix, which
+// is then written straight into a mapped uniform slot. The view the GPU sees
+// is as fresh as the last sample, not a frame old.
+//
+// The queue is a CameraInputBuffer behind a mutex, so Mode and SmoothingTime
+// work the same as there. PushMouseDelta may be called from any thread
+// (input callback, input thread); Latch and Submitted are called on the
+// render thread.
+class LateLatchInput
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    Camera_Input_Mode Mode = COALESCED;
+
+    LateLatchInput()
+    {
+        start = Clock::now();
+    }
+
+    // queue a raw mouse offset, same units as Camera::ProcessMouseMovement
+    void PushMouseDelta(float xoffset, float yoffset)
+    {
+        double now = Seconds(Clock::now());
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.Push(xoffset, yoffset, now);
+    }
+
+    // Applies every queued delta to the camera and writes its view-projection
+    // (16 floats, column-major like glm) to mappedSlot, e.g. a persistently
+    // mapped uniform buffer range for this frame. Poll the window system
+    // (glfwPollEvents) just before calling this so the newest input is in.
+    // Returns the camera version after the latch.
+    unsigned int Latch(Camera& camera, void* mappedSlot, GLboolean constrainPitch = true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (buffer.Pending() > 0)
+            {
+                if (!latchPending)
+                    latchedOldest = buffer.OldestTime();
+                latchPending = true;
+                buffer.ApplyFrame(camera, Mode, constrainPitch);
+            }
+        }
+
+        const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+        if (mappedSlot)
+            std::memcpy(mappedSlot, &viewProjection[0][0], sizeof(float) * 16);
+        return camera.GetVersion();
+    }
+
+    // Call right after submitting the draw (or flush) that reads the latched
+    // slot; the time from the oldest input it consumed to here goes into the
+    // stats. Latches that are never submitted carry their input over to the
+    // next Submitted call.
+    void Submitted()
+    {
+        if (!latchPending)
+            return;
+        double ms = (Seconds(Clock::now()) - latchedOldest) * 1000.0;
+        latchPending = false;
+        stats.latches++;
+        stats.lastMs = ms;
+        stats.averageMs += (ms - stats.averageMs) / (double)stats.latches;
+        if (ms > stats.maxMs)
+            stats.maxMs = ms;
+    }
+
+    const LatchStats& GetStats() const
+    {
+        return stats;
+    }
+
+    void ResetStats()
+    {
+        stats = LatchStats();
+    }
+
+    // drops queued input and smoothing state, e.g. when the cursor is released
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.Reset();
+        latchPending = false;
+    }
+
+    void SetSmoothingTime(float seconds)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.SmoothingTime = seconds;
+    }
+
+private:
+    // seconds since construction, the CameraInputBuffer timestamp
+    double Seconds(Clock::time_point t) const
+    {
+        return std::chrono::duration<double>(t - start).count();
+    }
+
+    std::mutex mutex;
+    CameraInputBuffer buffer;
+    Clock::time_point start;
+    double latchedOldest = 0.0;
+    bool latchPending = false;
+    LatchStats stats;
+};
+#endif
@@ -0,0 +1,92 @@
+#ifndef REVERSED_Z_H
+#define REVERSED_Z_H
+
+// Depth buffer setup for reversed-Z rendering (Camera::SetReversedZ,
+// mat4x4_perspective_reversed_infinite). Include your GL loader (glad)
+// before this header, like camera.h expects.
+//
+// Reversed-Z only pays off with a [0, 1] clip depth range and a float depth
+// buffer: near maps to 1, far (or infinity) to 0, and float precision is
+// densest near 0 where perspective depth is sparsest. The bundled glad is
+// generated for GL 4.3, so glClipControl (GL 4.5 / ARB_clip_control) is
+// fetched by hand.
+
+#ifndef GL_LOWER_LEFT
+#define GL_LOWER_LEFT 0x8CA1
+#endif
+#ifndef GL_NEGATIVE_ONE_TO_ONE
+#define GL_NEGATIVE_ONE_TO_ONE 0x935E
+#endif
+#ifndef GL_ZERO_TO_ONE
+#define GL_ZERO_TO_ONE 0x935F
+#endif
+
+typedef void (APIENTRYP PFN_REVERSEDZ_CLIPCONTROL)(GLenum origin, GLenum depth);
+
+inline PFN_REVERSEDZ_CLIPCONTROL& ReversedZClipControl()
+{
+    static PFN_REVERSEDZ_CLIPCONTROL proc = 0;
+    return proc;
+}
+
+// Looks up glClipControl through the same loader passed to gladLoadGLLoader
+// (e.g. glfwGetProcAddress). Returns false when the driver lacks it; keep
+// the standard projection in that case.
+inline bool ReversedZInit(void* (*getProcAddress)(const char* name))
+{
+    ReversedZClipControl() = (PFN_REVERSEDZ_CLIPCONTROL)getProcAddress("glClipControl");
+    return ReversedZClipControl() != 0;
+}
+
+// Sets clip depth to [0, 1], depth test to GL_GREATER and depth clear to 0.
+// Call once after ReversedZInit succeeded (the state is per context).
+inline void ReversedZApplyDepthState()
+{
+    ReversedZClipControl()(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GREATER);
+    glClearDepth(0.0);
+}
+
+// Back to the GL defaults, for passes that still use a standard projection
+inline void ReversedZRestoreDepthState()
+{
+    ReversedZClipControl()(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+    glDepthFunc(GL_LESS);
+    glClearDepth(1.0);
+}
+
+// Maps a depth function written for standard depth to its reversed-Z equivalent
+inline GLenum ReversedZDepthFunc(GLenum standardFunc)
+{
+    switch (standardFunc)
+    {
+    case GL_LESS:    return GL_GREATER;
+    case GL_LEQUAL:  return GL_GEQUAL;
+    case GL_GREATER: return GL_LESS;
+    case GL_GEQUAL:  return GL_LEQUAL;
+    default:         return standardFunc;  // GL_EQUAL, GL_NOTEQUAL, GL_ALWAYS, GL_NEVER
+    }
+}
+
+// The default framebuffer usually has a 24-bit fixed point depth buffer,
+// which gains little from reversed-Z. This attaches a 32-bit float depth
+// renderbuffer to fbo and returns it (0 if the framebuffer is incomplete).
+inline GLuint ReversedZAttachFloatDepth(GLuint fbo, GLsizei width, GLsizei height)
+{
+    GLuint depth = 0;
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        glDeleteRenderbuffers(1, &depth);
+        return 0;
+    }
+    return depth;
+}
+#endif
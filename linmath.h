@@ -11,6 +11,13 @@
 #define LINMATH_H_FUNC static inline
 #endif
 
+#include "fasttrig.h"
+
+/* Accuracy used by the rotation builders, see fasttrig.h */
+#ifndef LINMATH_TRIG_ACCURACY
+#define LINMATH_TRIG_ACCURACY TRIG_POLY
+#endif
+
 #define LINMATH_H_DEFINE_VEC(n) \
 typedef float vec##n[n]; \
 LINMATH_H_FUNC void vec##n##_add(vec##n r, vec##n const a, vec##n const b) \
@@ -203,8 +210,8 @@ LINMATH_H_FUNC void mat4x4_from_vec3_mul_outer(mat4x4 M, vec3 a, vec3 b)
 }
 LINMATH_H_FUNC void mat4x4_rotate(mat4x4 R, mat4x4 M, float x, float y, float z, float angle)
 {
-	float s = sinf(angle);
-	float c = cosf(angle);
+	float s, c;
+	trig_sincos(angle, &s, &c, LINMATH_TRIG_ACCURACY);
 	vec3 u = { x, y, z };
 
 	if (vec3_len(u) > 1e-4) {
@@ -238,8 +245,8 @@ LINMATH_H_FUNC void mat4x4_rotate(mat4x4 R, mat4x4 M, float x, float y, float z,
 }
 LINMATH_H_FUNC void mat4x4_rotate_X(mat4x4 Q, mat4x4 M, float angle)
 {
-	float s = sinf(angle);
-	float c = cosf(angle);
+	float s, c;
+	trig_sincos(angle, &s, &c, LINMATH_TRIG_ACCURACY);
 	mat4x4 R = {
 		{1.f, 0.f, 0.f, 0.f},
 		{0.f,   c,   s, 0.f},
@@ -250,8 +257,8 @@ LINMATH_H_FUNC void mat4x4_rotate_X(mat4x4 Q, mat4x4 M, float angle)
 }
 LINMATH_H_FUNC void mat4x4_rotate_Y(mat4x4 Q, mat4x4 M, float angle)
 {
-	float s = sinf(angle);
-	float c = cosf(angle);
+	float s, c;
+	trig_sincos(angle, &s, &c, LINMATH_TRIG_ACCURACY);
 	mat4x4 R = {
 		{   c, 0.f,  -s, 0.f},
 		{ 0.f, 1.f, 0.f, 0.f},
@@ -262,8 +269,8 @@ LINMATH_H_FUNC void mat4x4_rotate_Y(mat4x4 Q, mat4x4 M, float angle)
 }
 LINMATH_H_FUNC void mat4x4_rotate_Z(mat4x4 Q, mat4x4 M, float angle)
 {
-	float s = sinf(angle);
-	float c = cosf(angle);
+	float s, c;
+	trig_sincos(angle, &s, &c, LINMATH_TRIG_ACCURACY);
 	mat4x4 R = {
 		{   c,   s, 0.f, 0.f},
 		{  -s,   c, 0.f, 0.f},
@@ -394,6 +401,61 @@ LINMATH_H_FUNC void mat4x4_perspective(mat4x4 m, float y_fov, float aspect, floa
 	m[3][2] = -((2.f * f * n) / (f - n));
 	m[3][3] = 0.f;
 }
+/* Reversed-Z projections map the near plane to depth 1 and the far plane
+ * to depth 0. Floating point is densest near 0, which cancels the 1/z
+ * falloff of perspective depth, so a 32-bit float depth buffer keeps
+ * precision over the whole range. They expect a [0, 1] clip-space depth
+ * range (glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE)) and a GL_GREATER
+ * depth test cleared to 0. */
+LINMATH_H_FUNC void mat4x4_perspective_reversed(mat4x4 m, float y_fov, float aspect, float n, float f)
+{
+	float const a = 1.f / tan(y_fov / 2.f);
+
+	m[0][0] = a / aspect;
+	m[0][1] = 0.f;
+	m[0][2] = 0.f;
+	m[0][3] = 0.f;
+
+	m[1][0] = 0.f;
+	m[1][1] = a;
+	m[1][2] = 0.f;
+	m[1][3] = 0.f;
+
+	m[2][0] = 0.f;
+	m[2][1] = 0.f;
+	m[2][2] = n / (f - n);
+	m[2][3] = -1.f;
+
+	m[3][0] = 0.f;
+	m[3][1] = 0.f;
+	m[3][2] = (f * n) / (f - n);
+	m[3][3] = 0.f;
+}
+/* Limit of mat4x4_perspective_reversed as f goes to infinity: depth = n / -z */
+LINMATH_H_FUNC void mat4x4_perspective_reversed_infinite(mat4x4 m, float y_fov, float aspect, float n)
+{
+	float const a = 1.f / tan(y_fov / 2.f);
+
+	m[0][0] = a / aspect;
+	m[0][1] = 0.f;
+	m[0][2] = 0.f;
+	m[0][3] = 0.f;
+
+	m[1][0] = 0.f;
+	m[1][1] = a;
+	m[1][2] = 0.f;
+	m[1][3] = 0.f;
+
+	m[2][0] = 0.f;
+	m[2][1] = 0.f;
+	m[2][2] = 0.f;
+	m[2][3] = -1.f;
+
+	m[3][0] = 0.f;
+	m[3][1] = 0.f;
+	m[3][2] = n;
+	m[3][3] = 0.f;
+}
 LINMATH_H_FUNC void mat4x4_look_at(mat4x4 m, vec3 eye, vec3 center, vec3 up)
 {
 	/* Adapted from Android's OpenGL Matrix.java.                        */
@@ -487,11 +549,13 @@ LINMATH_H_FUNC void quat_conj(quat r, quat q)
 }
 LINMATH_H_FUNC void quat_rotate(quat r, float angle, vec3 axis) {
 	vec3 v;
-	vec3_scale(v, axis, sinf(angle / 2));
+	float s, c;
+	trig_sincos(angle / 2, &s, &c, LINMATH_TRIG_ACCURACY);
+	vec3_scale(v, axis, s);
 	int i;
 	for (i = 0; i < 3; ++i)
 		r[i] = v[i];
-	r[3] = cosf(angle / 2);
+	r[3] = c;
 }
 #define quat_norm vec4_norm
 LINMATH_H_FUNC void quat_mul_vec3(vec3 r, quat q, vec3 v)
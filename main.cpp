@@ -1,5 +1,6 @@
 #include <GLFW\glfw3.h>
 #include "linmath.h"
+#include "packed_state.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <conio.h>
@@ -11,6 +12,23 @@
 using namespace std;
 
 const float DEG2RAD = 3.14159 / 180;
+const int CIRCLE_SEGMENTS = 360;
+
+// Unit circle shared by every ball, so drawing one costs no trig calls
+struct UnitCircle
+{
+	float cosines[CIRCLE_SEGMENTS];
+	float sines[CIRCLE_SEGMENTS];
+
+	UnitCircle()
+	{
+		float angles[CIRCLE_SEGMENTS];
+		for (int i = 0; i < CIRCLE_SEGMENTS; i++)
+			angles[i] = i * DEG2RAD;
+		trig_sincos_batch(sines, cosines, angles, CIRCLE_SEGMENTS, TRIG_POLY);
+	}
+};
+const UnitCircle unitCircle;
 
 void processInput(GLFWwindow* window);
 
@@ -124,6 +142,32 @@ public:
 		angle = 45.0f; // Initial angle of movement
 	}
 
+	// Quantized copy of the state for snapshots and uploads, see packed_state.h
+	PackedCircle Pack() const
+	{
+		PackedCircle p;
+		p.x = PackSnorm16(x);
+		p.y = PackSnorm16(y);
+		p.radius = PackUnorm16(radius);
+		p.velocity = PackVelocity(direction, speed);
+		p.red = PackUnorm8(red);
+		p.green = PackUnorm8(green);
+		p.blue = PackUnorm8(blue);
+		p.reserved = 0;
+		return p;
+	}
+
+	void Unpack(const PackedCircle& p)
+	{
+		x = UnpackSnorm16(p.x);
+		y = UnpackSnorm16(p.y);
+		radius = UnpackUnorm16(p.radius);
+		UnpackVelocity(p.velocity, &direction, &speed);
+		red = UnpackUnorm8(p.red);
+		green = UnpackUnorm8(p.green);
+		blue = UnpackUnorm8(p.blue);
+	}
+
 	void CheckCollision(Brick* brk, Paddle* paddle, vector<Circle>& circles)
 	{
 		if (brk->onoff == ON && brk->hitCount > 0)
@@ -237,9 +281,8 @@ public:
 	{
 		glColor3f(red, green, blue);
 		glBegin(GL_POLYGON);
-		for (int i = 0; i < 360; i++) {
-			float degInRad = i * DEG2RAD;
-			glVertex2f((cos(degInRad) * radius) + x, (sin(degInRad) * radius) + y);
+		for (int i = 0; i < CIRCLE_SEGMENTS; i++) {
+			glVertex2f((unitCircle.cosines[i] * radius) + x, (unitCircle.sines[i] * radius) + y);
 		}
 		glEnd();
 	}
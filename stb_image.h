@@ -32,8 +32,8 @@ HDR (radiance rgbE format)
 PIC (Softimage PIC)
 PNM (PPM and PGM binary only)
 
-Animated GIF still needs a proper API, but here's one way to do it:
-http://gist.github.com/urraka/685d9a6340b26b830d49
+Animated GIFs play back a frame at a time through stbi_gif_stream_*
+(see "animated GIF playback" below).
 
 - decode from memory or through FILE (define STBI_NO_STDIO to remove code)
 - decode from arbitrary I/O callbacks
@@ -299,15 +299,22 @@ publish, and distribute this file as you see fit.
 //
 // SIMD support
 //
-// The JPEG decoder will try to automatically use SIMD kernels on x86 when
-// supported by the compiler. For ARM Neon support, you must explicitly
-// request it.
+// The JPEG decoder, PNG unfiltering and the conversions between channel
+// counts (desired_channels) will try to automatically use SIMD kernels on
+// x86 when supported by the compiler. For ARM Neon support (JPEG only), you
+// must explicitly request it.
 //
 // (The old do-it-yourself SIMD API is no longer supported in the current
 // code.)
 //
 // On x86, SSE2 will automatically be used when available based on a run-time
-// test; if not, the generic C versions are used as a fall-back. On ARM targets,
+// test; if not, the generic C versions are used as a fall-back. AVX2 versions
+// of the IDCT, YCbCr conversion, 2x2 chroma upsampling, the PNG Up filter and
+// the channel conversions to and from RGB are picked the same way on CPUs
+// (and OSes) that support them; they are compiled with function target
+// attributes, so no -mavx2 is needed. They give bit-identical results;
+// define STBI_NO_AVX2 to leave them out, or set stbi_load_options::no_avx2
+// to skip them per load. On ARM targets,
 // the typical path is to have separate builds for NEON and non-NEON devices
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
@@ -361,6 +368,32 @@ publish, and distribute this file as you see fit.
 //
 // ===========================================================================
 //
+// Threads:
+//
+// Decoding is safe to run on several threads at once. The failure reason
+// is kept per thread, and each load reads its flip / unpremultiply /
+// iPhone settings once into its own context. The stbi_set_* and
+// stbi_*_gamma/scale functions change process-wide defaults; call them
+// before starting worker threads. To use different settings per load
+// without touching the defaults, pass a stbi_load_options:
+//
+//     stbi_load_options opt;
+//     stbi_load_options_init(&opt);   // current defaults
+//     opt.flip_vertically = 1;
+//     data = stbi_load_ex(filename, &opt, &x, &y, &n, 0);
+//
+// A single large image can also be decoded on several threads: set
+// opt.parallel_for to your job system's parallel loop. This splits
+// baseline JPEGs with restart markers (DRI), read from memory, and
+// pipelines non-interlaced PNGs (inflate on one thread, unfilter on
+// another, which spins while it waits for data).
+//
+// Define STBI_NO_THREAD_LOCALS if your compiler or platform cannot do
+// thread-local storage; stbi_failure_reason() and the scratch arena from
+// stbi_set_thread_arena are then shared, so only load on one thread.
+//
+// ===========================================================================
+//
 // iPhone PNG support:
 //
 // By default we convert iphone-formatted PNGs back to RGB, even though
@@ -379,6 +412,7 @@ publish, and distribute this file as you see fit.
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif // STBI_NO_STDIO
+#include <stddef.h> // size_t
 
 #define STBI_VERSION 1
 
@@ -480,7 +514,7 @@ extern "C" {
 
 
     // get a VERY brief reason for failure
-    // NOT THREADSAFE
+    // per thread: reports the last failure on the calling thread
     STBIDEF const char *stbi_failure_reason(void);
 
     // free the loaded image -- this is just free()
@@ -510,6 +544,188 @@ extern "C" {
     // flip the image vertically, so the first pixel in the output array is the bottom left
     STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+    ////////////////////////////////////
+    //
+    // per-load options, for decoding with different settings on several threads
+    //
+
+    typedef struct
+    {
+        int flip_vertically;      // as stbi_set_flip_vertically_on_load
+        int unpremultiply;        // as stbi_set_unpremultiply_on_load
+        int convert_iphone_png;   // as stbi_convert_iphone_png_to_rgb
+
+        // 1, 2, 4 or 8: JPEGs decode at 1/scale_denom of their size, rounded
+        // up, through a reduced IDCT, which is much faster than decoding at
+        // full size and downsampling (1/8 only computes the DC terms). Other
+        // formats ignore it, so check the returned size.
+        int scale_denom;
+
+        // 1 keeps JPEG decoding, PNG unfiltering and channel conversion on
+        // the SSE2 kernels on CPUs with AVX2 (output is the same either way)
+        int no_avx2;
+
+        // Optional crop: when crop_w and crop_h are both > 0, only that
+        // rectangle of the image (as it would otherwise be returned, so
+        // after scale_denom and flip_vertically) is returned, clipped to
+        // the image; *x and *y get its size. JPEGs still entropy-decode
+        // every block (DC prediction runs through all of them) but only
+        // IDCT the MCUs under the rectangle, and only upsample and color
+        // convert the rectangle itself. Other formats decode whole and are
+        // cropped. A rectangle entirely outside the image fails.
+        int crop_x, crop_y, crop_w, crop_h;
+
+        // Optional. Runs task(task_data, i) for every i in [0, count), in any
+        // order and on any threads, and returns once all of them finished.
+        // When set, baseline JPEGs with restart markers that are decoded
+        // from memory split their scan into independent pieces, which gives
+        // byte-identical results to the serial decoder. Non-interlaced PNGs
+        // run inflate and unfiltering as two overlapping tasks.
+        void (*parallel_for)(void *parallel_user, int count, void (*task)(void *task_data, int index), void *task_data);
+        void *parallel_user;
+    } stbi_load_options;
+
+    // fills opt with the current process-wide defaults; passing NULL
+    // options to the _ex functions below is the same
+    STBIDEF void stbi_load_options_init(stbi_load_options *opt);
+
+    STBIDEF stbi_uc *stbi_load_from_memory_ex(stbi_uc const *buffer, int len, stbi_load_options const *opt, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF stbi_uc *stbi_load_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, stbi_load_options const *opt, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+    STBIDEF stbi_uc *stbi_load_ex(char const *filename, stbi_load_options const *opt, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF stbi_uc *stbi_load_from_file_ex(FILE *f, stbi_load_options const *opt, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+    ////////////////////////////////////
+    //
+    // decode into a caller-provided buffer
+    //
+    // Decodes into dst (a mapped pixel buffer object, a staging buffer, a
+    // texture atlas...) instead of a malloc'd image, with dst_stride bytes
+    // from one row to the next; opt->flip_vertically picks the orientation.
+    // Every output byte is written once and dst is never read back, so
+    // write-combined memory is fine. JPEGs are color converted straight
+    // into dst; other formats decode to scratch memory first and are
+    // converted, flipped and copied in a single pass. desired_channels must
+    // be 1-4 since the layout has to be known up front (get the size from
+    // stbi_info). An image wider than dst_stride / desired_channels or
+    // taller than dst_height fails without touching dst. Returns 1 on
+    // success, 0 on failure.
+    STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+    STBIDEF int stbi_load_into(char const *filename, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF int stbi_load_into_from_file(FILE *f, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+    ////////////////////////////////////
+    //
+    // decode in bands of rows
+    //
+    // Hands the image to band(band_user, rows, y, row_count, stride) while it
+    // decodes, band_rows rows at a time: output rows y to y + row_count - 1
+    // (after opt->flip_vertically), stride bytes apart. rows is only valid
+    // during the call; return 0 from it to stop decoding, which makes the
+    // load fail. Bands come top to bottom, except from files stored
+    // bottom-up (most BMPs, some TGAs), which come bottom to top.
+    //
+    // Baseline JPEGs, non-interlaced PNGs, TGAs and BMPs (but not those with
+    // an alpha mask that may turn out to be all zero) stream: instead of
+    // the whole image, memory holds one band plus three MCU rows of JPEG
+    // component planes, or a ~100 KB inflate window and the compressed data
+    // for PNG, and the first band is out before the rest of the file is
+    // decoded, so uploading or resizing it overlaps decoding. Other formats,
+    // progressive JPEGs and interlaced PNGs decode whole first and are then
+    // handed out in bands. desired_channels must be 1-4 (use stbi_info for
+    // the size up front). Returns 1 once every row was delivered.
+    typedef int (*stbi_band_callback)(void *user, stbi_uc const *rows, int y, int row_count, int stride);
+
+    STBIDEF int stbi_load_bands_from_memory(stbi_uc const *buffer, int len, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF int stbi_load_bands_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+    STBIDEF int stbi_load_bands(char const *filename, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF int stbi_load_bands_from_file(FILE *f, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+    ////////////////////////////////////
+    //
+    // animated GIF playback
+    //
+    // Opens a GIF and hands out its frames one at a time: each call to
+    // stbi_gif_stream_next decodes the next frame over the previous one,
+    // after disposing of that as the file asks, and returns the x * y RGBA
+    // canvas (top row first, flip_vertically does not apply) and the frame
+    // delay in milliseconds. The pixels belong to the stream and are
+    // overwritten by the next call. NULL means the last frame was returned,
+    // or the file is corrupt (then stbi_failure_reason is set); the stream
+    // keeps returning NULL until stbi_gif_stream_rewind, which starts over
+    // from the first frame for streams opened from memory or a file.
+    //
+    // The stream holds the canvas, a second one that is only allocated if a
+    // frame is to be restored after it is shown ("dispose to previous"), and
+    // ~23 KB of decoder state; playing the frames allocates nothing. The
+    // memory, callbacks or FILE * must stay valid until stbi_gif_stream_close.
+    typedef struct stbi_gif_stream stbi_gif_stream;
+
+    STBIDEF stbi_gif_stream *stbi_gif_stream_open_memory(stbi_uc const *buffer, int len, int *x, int *y);
+    STBIDEF stbi_gif_stream *stbi_gif_stream_open_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y);
+#ifndef STBI_NO_STDIO
+    STBIDEF stbi_gif_stream *stbi_gif_stream_open(char const *filename, int *x, int *y);
+    STBIDEF stbi_gif_stream *stbi_gif_stream_open_file(FILE *f, int *x, int *y);
+#endif
+    STBIDEF stbi_uc const *stbi_gif_stream_next(stbi_gif_stream *gif, int *delay_ms);
+    STBIDEF int stbi_gif_stream_rewind(stbi_gif_stream *gif);
+    STBIDEF void stbi_gif_stream_close(stbi_gif_stream *gif);
+
+    ////////////////////////////////////
+    //
+    // memory
+    //
+
+    // Replaces STBI_MALLOC / STBI_REALLOC_SIZED / STBI_FREE at run time, for
+    // all threads. Set all three functions and call this before loading
+    // anything, since memory goes back to the allocator that made it
+    // (stbi_image_free included). NULL restores the compile-time defaults.
+    typedef struct
+    {
+        void *(*malloc_fn)(void *user, size_t size);
+        void *(*realloc_fn)(void *user, void *p, size_t old_size, size_t new_size);
+        void  (*free_fn)(void *user, void *p);
+        void *user;
+    } stbi_allocator;
+
+    STBIDEF void stbi_set_allocator(stbi_allocator const *alloc);
+
+    // Gives the calling thread a scratch arena. Loads on that thread then
+    // take their temporary buffers (JPEG planes, PNG compressed and inflated
+    // data, images that still need a format conversion) from a bump
+    // allocator that is rewound after every image, instead of from the heap.
+    // It grows to what the largest image needed and keeps that memory until
+    // it is turned off again; do that before the thread exits. Returned
+    // images always come from the allocator above. Needs thread locals, see
+    // STBI_NO_THREAD_LOCALS.
+    STBIDEF void stbi_set_thread_arena(int flag_true_if_should_use_arena);
+
+    ////////////////////////////////////
+    //
+    // memory-mapped file interface
+    //
+    // Maps the file and decodes it like stbi_load_from_memory instead of
+    // reading it through stdio 128 bytes at a time. Since the decoder sees
+    // memory, parallel_for also applies to JPEGs loaded this way. As with
+    // any mapping, truncating the file during the load crashes it. Define
+    // STBI_NO_MMAP to leave these out; the implementation includes
+    // <windows.h> on Windows.
+    //
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+    STBIDEF stbi_uc *stbi_load_mmap(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF stbi_uc *stbi_load_mmap_ex(char const *filename, stbi_load_options const *opt, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF stbi_us *stbi_load_mmap_16(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_LINEAR
+    STBIDEF float *stbi_loadf_mmap(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+#endif
+
     // ZLIB client - used by PNG, available for other purposes
 
     STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -584,6 +800,23 @@ extern "C" {
 #include <stdio.h>
 #endif
 
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
 #ifndef STBI_ASSERT
 #include <assert.h>
 #define STBI_ASSERT(x) assert(x)
@@ -606,12 +839,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -623,6 +858,44 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32) == 4 ? 1 : -1];
 #define STBI_NOTUSED(v)  (void)sizeof(v)
 #endif
 
+// thread-local storage for the failure reason
+#ifndef STBI_NO_THREAD_LOCALS
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define STBI_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define STBI_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define STBI_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define STBI_THREAD_LOCAL __thread
+#endif
+#endif
+
+#ifndef STBI_THREAD_LOCAL
+#define STBI_THREAD_LOCAL
+#endif
+
+// atomics for the tasks run through stbi_load_options::parallel_for;
+// without them those loads stay on the calling thread
+#if !defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define STBI__ATOMICS
+static long stbi__atomic_load(volatile long *p) { return _InterlockedCompareExchange(p, 0, 0); }
+static void stbi__atomic_store(volatile long *p, long v) { _InterlockedExchange(p, v); }
+#if !defined(STBI_NO_PNG) && !defined(STBI_NO_PNG_PIPELINE)
+static long stbi__atomic_increment(volatile long *p) { return _InterlockedIncrement(p); }
+#endif
+#elif defined(__ATOMIC_ACQUIRE)
+#define STBI__ATOMICS
+static long stbi__atomic_load(volatile long *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static void stbi__atomic_store(volatile long *p, long v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+#if !defined(STBI_NO_PNG) && !defined(STBI_NO_PNG_PIPELINE)
+static long stbi__atomic_increment(volatile long *p) { return __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL); }
+#endif
+#endif
+#endif
+
 #ifdef _MSC_VER
 #define STBI_HAS_LROTL
 #endif
@@ -731,6 +1004,35 @@ static int stbi__sse2_available()
 #endif
 }
 #endif
+
+// AVX2 needs VS2012, GCC 4.9 or clang for intrinsics in functions compiled
+// for a different target than the rest of the file
+#if !defined(STBI_NO_AVX2) && (defined(_MSC_VER) ? _MSC_VER >= 1700 : (defined(__clang__) || (__GNUC__ * 100 + __GNUC_MINOR__) >= 409))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return 0;
+    // the OS has to save the YMM registers: OSXSAVE and AVX set, XCR0 bits 1 and 2
+    __cpuid(info, 1);
+    if ((info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6) return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+    // checks OS support for the YMM state as well
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
 #endif
 
 // ARM NEON
@@ -748,10 +1050,44 @@ static int stbi__sse2_available()
 #define STBI_SIMD_ALIGN(type, name) type name
 #endif
 
+///////////////////////////////////////////////
+//
+//  scratch arena (stbi_set_thread_arena)
+
+// Blocks are cut from the top of the newest chunk behind a 16-byte header
+// holding their size. Freeing or growing the most recent block happens in
+// place, anything else waits for the rewind after the image.
+typedef struct stbi__arena_chunk
+{
+    struct stbi__arena_chunk *prev;
+    size_t size, used;      // bytes of data after the chunk header
+} stbi__arena_chunk;
+
+typedef struct
+{
+    stbi__arena_chunk *top;
+    size_t reserve;         // size of the next first chunk
+    size_t in_use, peak;    // used bytes over all chunks since the last rewind
+    int enabled, depth;
+} stbi__arena;
+
 ///////////////////////////////////////////////
 //
 //  stbi__context struct and start_xxx functions
 
+// stbi_load_bands state: rows are gathered here and handed out a band at a time
+typedef struct
+{
+    stbi_band_callback callback;
+    void *user;
+    stbi_uc *buf;               // band_rows rows of w * comp bytes
+    int band_rows, comp, w, h;
+    int up;                     // bands run from the bottom row up
+    int first, count, filled;   // the band being filled: output rows [first, first + count)
+    int delivered;              // rows handed to the callback so far
+    int simd;                   // stbi__simd_level, for the row converters
+} stbi__band;
+
 // stbi__context structure is our basic context used by all images, so it
 // contains all the IO context, plus some basic image information
 typedef struct
@@ -768,11 +1104,25 @@ typedef struct
 
     stbi_uc *img_buffer, *img_buffer_end;
     stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+    stbi_load_options opt;
+    stbi__arena *arena;     // scratch for the running load, NULL for the heap
+
+    stbi_uc *into;          // stbi_load_into destination, NULL to return a malloc'd image
+    int into_stride, into_rows;
+    stbi__band *band;       // stbi_load_bands state, NULL to return a whole image
 } stbi__context;
 
 
 static void stbi__refill_buffer(stbi__context *s);
 
+// start_xxx take the process-wide defaults; the _ex entry points overwrite s->opt afterwards
+static void stbi__use_options(stbi__context *s, stbi_load_options const *opt)
+{
+    if (opt)
+        s->opt = *opt;
+}
+
 // initialize a memory-decode context
 static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
@@ -780,6 +1130,10 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
     s->read_from_callbacks = 0;
     s->img_buffer = s->img_buffer_original = (stbi_uc *)buffer;
     s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *)buffer + len;
+    stbi_load_options_init(&s->opt);
+    s->arena = NULL;
+    s->into = NULL;
+    s->band = NULL;
 }
 
 // initialize a callback-based context
@@ -790,10 +1144,42 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
     s->buflen = sizeof(s->buffer_start);
     s->read_from_callbacks = 1;
     s->img_buffer_original = s->buffer_start;
+    stbi_load_options_init(&s->opt);
+    s->arena = NULL;
+    s->into = NULL;
+    s->band = NULL;
     stbi__refill_buffer(s);
     s->img_buffer_original_end = s->img_buffer_end;
 }
 
+static int stbi__into_fits(stbi__context *s, int w, int h, int comp)
+{
+    return w <= s->into_stride / comp && h <= s->into_rows;
+}
+
+// row y (in file order) of an h-row image in the stbi_load_into buffer
+static stbi_uc *stbi__into_row(stbi__context *s, int y, int h)
+{
+    if (s->opt.flip_vertically) y = h - 1 - y;
+    return s->into + (size_t)y * s->into_stride;
+}
+
+// 0 for the plain C format converters, 1 for the SSE2 kernels, 2 with the
+// AVX2 ones as well
+static int stbi__simd_level(stbi__context *s)
+{
+#ifdef STBI_SSE2
+    if (stbi__sse2_available()) {
+#ifdef STBI_AVX2
+        if (!s->opt.no_avx2 && stbi__avx2_available()) return 2;
+#endif
+        return 1;
+    }
+#endif
+    STBI_NOTUSED(s);
+    return 0;
+}
+
 #ifndef STBI_NO_STDIO
 
 static int stbi__stdio_read(void *user, char *data, int size)
@@ -847,6 +1233,8 @@ typedef struct
     int bits_per_channel;
     int num_channels;
     int channel_order;
+    int cropped;        // the decoder already cut out the stbi_load_options crop
+    int flipped;        // the rows are already in flip_vertically order
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -903,8 +1291,7 @@ static void    *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
-// this is not threadsafe
-static const char *stbi__g_failure_reason;
+static STBI_THREAD_LOCAL const char *stbi__g_failure_reason;
 
 STBIDEF const char *stbi_failure_reason(void)
 {
@@ -917,11 +1304,41 @@ static int stbi__err(const char *str)
     return 0;
 }
 
+// all NULL: STBI_MALLOC and friends
+static stbi_allocator stbi__g_allocator;
+
+STBIDEF void stbi_set_allocator(stbi_allocator const *alloc)
+{
+    if (alloc)
+        stbi__g_allocator = *alloc;
+    else
+        memset(&stbi__g_allocator, 0, sizeof(stbi__g_allocator));
+}
+
 static void *stbi__malloc(size_t size)
 {
+    if (stbi__g_allocator.malloc_fn)
+        return stbi__g_allocator.malloc_fn(stbi__g_allocator.user, size);
     return STBI_MALLOC(size);
 }
 
+static void *stbi__heap_realloc(void *p, size_t oldsz, size_t newsz)
+{
+    if (stbi__g_allocator.realloc_fn)
+        return stbi__g_allocator.realloc_fn(stbi__g_allocator.user, p, oldsz, newsz);
+    STBI_NOTUSED(oldsz);
+    return STBI_REALLOC_SIZED(p, oldsz, newsz);
+}
+
+static void stbi__heap_free(void *p)
+{
+    if (!p) return;
+    if (stbi__g_allocator.free_fn)
+        stbi__g_allocator.free_fn(stbi__g_allocator.user, p);
+    else
+        STBI_FREE(p);
+}
+
 // stb_image uses ints pervasively, including for offset calculations.
 // therefore the largest decoded image size we can support with the
 // current code, even on 64-bit targets, is INT_MAX. this is not a
@@ -975,12 +1392,6 @@ static int stbi__mad4sizes_valid(int a, int b, int c, int d, int add)
 }
 
 // mallocs with size overflow checking
-static void *stbi__malloc_mad2(int a, int b, int add)
-{
-    if (!stbi__mad2sizes_valid(a, b, add)) return NULL;
-    return stbi__malloc(a*b + add);
-}
-
 static void *stbi__malloc_mad3(int a, int b, int c, int add)
 {
     if (!stbi__mad3sizes_valid(a, b, c, add)) return NULL;
@@ -993,6 +1404,181 @@ static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
     return stbi__malloc(a*b*c*d + add);
 }
 
+#define STBI__ARENA_ALIGN(n)        (((n) + 15) & ~(size_t)15)
+#define STBI__ARENA_CHUNK_HEADER    STBI__ARENA_ALIGN(sizeof(stbi__arena_chunk))
+#define STBI__ARENA_BLOCK_HEADER    16
+#define STBI__ARENA_MIN_CHUNK       (256 * 1024)
+
+static STBI_THREAD_LOCAL stbi__arena stbi__g_arena;
+
+static stbi_uc *stbi__arena_data(stbi__arena_chunk *c)
+{
+    return (stbi_uc *)c + STBI__ARENA_CHUNK_HEADER;
+}
+
+static size_t stbi__arena_block_size(void *p)
+{
+    return *(size_t *)((stbi_uc *)p - STBI__ARENA_BLOCK_HEADER);
+}
+
+static int stbi__arena_owns(stbi__arena *a, void *p)
+{
+    stbi__arena_chunk *c;
+    for (c = a->top; c; c = c->prev)
+        if ((stbi_uc *)p >= stbi__arena_data(c) && (stbi_uc *)p < stbi__arena_data(c) + c->used)
+            return 1;
+    return 0;
+}
+
+// true if p is the block right below the top of the newest chunk
+static int stbi__arena_is_last(stbi__arena *a, void *p)
+{
+    stbi__arena_chunk *c = a->top;
+    return c && (stbi_uc *)p + STBI__ARENA_ALIGN(stbi__arena_block_size(p)) == stbi__arena_data(c) + c->used;
+}
+
+static void stbi__arena_grew(stbi__arena *a, size_t n)
+{
+    a->in_use += n;
+    if (a->in_use > a->peak) a->peak = a->in_use;
+}
+
+static void *stbi__arena_alloc(stbi__arena *a, size_t size)
+{
+    stbi__arena_chunk *c = a->top;
+    size_t need = STBI__ARENA_BLOCK_HEADER + STBI__ARENA_ALIGN(size);
+    stbi_uc *block;
+    if (need < size) return NULL;
+    if (!c || c->size - c->used < need) {
+        size_t csize = c ? c->size * 2 : a->reserve;
+        if (csize < STBI__ARENA_MIN_CHUNK) csize = STBI__ARENA_MIN_CHUNK;
+        if (csize < need) csize = need;
+        c = (stbi__arena_chunk *)stbi__malloc(STBI__ARENA_CHUNK_HEADER + csize);
+        if (!c) return NULL;
+        c->prev = a->top;
+        c->size = csize;
+        c->used = 0;
+        a->top = c;
+    }
+    block = stbi__arena_data(c) + c->used;
+    *(size_t *)block = size;
+    c->used += need;
+    stbi__arena_grew(a, need);
+    return block + STBI__ARENA_BLOCK_HEADER;
+}
+
+static void stbi__arena_free(stbi__arena *a, void *p)
+{
+    if (stbi__arena_is_last(a, p)) {
+        size_t need = STBI__ARENA_BLOCK_HEADER + STBI__ARENA_ALIGN(stbi__arena_block_size(p));
+        a->top->used -= need;
+        a->in_use -= need;
+    }
+}
+
+static void *stbi__arena_realloc(stbi__arena *a, void *p, size_t newsz)
+{
+    size_t oldsz, oldcap, newcap;
+    void *q;
+    if (!p) return stbi__arena_alloc(a, newsz);
+    oldsz = stbi__arena_block_size(p);
+    oldcap = STBI__ARENA_ALIGN(oldsz);
+    newcap = STBI__ARENA_ALIGN(newsz);
+    if (newcap >= newsz && stbi__arena_is_last(a, p) && (newcap <= oldcap || newcap - oldcap <= a->top->size - a->top->used)) {
+        a->top->used = a->top->used - oldcap + newcap;
+        if (newcap > oldcap)
+            stbi__arena_grew(a, newcap - oldcap);
+        else
+            a->in_use -= oldcap - newcap;
+        *(size_t *)((stbi_uc *)p - STBI__ARENA_BLOCK_HEADER) = newsz;
+        return p;
+    }
+    q = stbi__arena_alloc(a, newsz);
+    if (q) {
+        memcpy(q, p, oldsz < newsz ? oldsz : newsz);
+        stbi__arena_free(a, p);
+    }
+    return q;
+}
+
+static void stbi__arena_release(stbi__arena *a)
+{
+    while (a->top) {
+        stbi__arena_chunk *prev = a->top->prev;
+        stbi__heap_free(a->top);
+        a->top = prev;
+    }
+    a->in_use = a->peak = 0;
+}
+
+STBIDEF void stbi_set_thread_arena(int flag_true_if_should_use_arena)
+{
+    stbi__arena *a = &stbi__g_arena;
+    a->enabled = flag_true_if_should_use_arena;
+    if (!a->enabled) {
+        stbi__arena_release(a);
+        a->reserve = 0;
+    }
+}
+
+// returns the calling thread's arena for one load, or NULL if it has none
+static stbi__arena *stbi__arena_begin(void)
+{
+    stbi__arena *a = &stbi__g_arena;
+    if (!a->enabled) return NULL;
+    ++a->depth;
+    return a;
+}
+
+// rewinds after the outermost load; if the image needed more than one
+// chunk they are merged, so the next image of that size needs one
+static void stbi__arena_end(stbi__arena *a)
+{
+    if (!a || --a->depth > 0) return;
+    if (a->top && a->top->prev) {
+        size_t peak = a->peak;
+        stbi__arena_release(a);
+        a->reserve = peak;
+    }
+    else if (a->top) {
+        a->top->used = 0;
+    }
+    a->in_use = a->peak = 0;
+}
+
+// decoder temporaries: from the load's arena if it has one, else the heap
+static void *stbi__scratch_malloc(stbi__arena *a, size_t size)
+{
+    return a ? stbi__arena_alloc(a, size) : stbi__malloc(size);
+}
+
+static void *stbi__scratch_realloc(stbi__arena *a, void *p, size_t oldsz, size_t newsz)
+{
+    return a ? stbi__arena_realloc(a, p, newsz) : stbi__heap_realloc(p, oldsz, newsz);
+}
+
+static void *stbi__scratch_malloc_mad2(stbi__arena *arena, int a, int b, int add)
+{
+    if (!stbi__mad2sizes_valid(a, b, add)) return NULL;
+    return stbi__scratch_malloc(arena, a*b + add);
+}
+
+static void *stbi__scratch_malloc_mad3(stbi__arena *arena, int a, int b, int c, int add)
+{
+    if (!stbi__mad3sizes_valid(a, b, c, add)) return NULL;
+    return stbi__scratch_malloc(arena, a*b*c + add);
+}
+
+// frees anything from stbi__malloc or the calling thread's arena; scratch
+// is only ever freed on the thread that started the load
+static void stbi__free(void *p)
+{
+    if (p && stbi__arena_owns(&stbi__g_arena, p))
+        stbi__arena_free(&stbi__g_arena, p);
+    else
+        stbi__heap_free(p);
+}
+
 // stbi__err - error
 // stbi__errpf - error returning pointer to float
 // stbi__errpuc - error returning pointer to unsigned char
@@ -1010,7 +1596,7 @@ static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 
 STBIDEF void stbi_image_free(void *retval_from_stbi_load)
 {
-    STBI_FREE(retval_from_stbi_load);
+    stbi__heap_free(retval_from_stbi_load);
 }
 
 #ifndef STBI_NO_LINEAR
@@ -1021,14 +1607,34 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
 static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
 
+static void    *stbi__store_into(stbi__context *s, void *data, int w, int h, int req_comp, stbi__result_info *ri);
+static void    *stbi__band_store(stbi__context *s, void *data, int w, int h, int req_comp, stbi__result_info *ri);
+static void    *stbi__crop(stbi__context *s, void *data, int *x, int *y, int n, int bytes);
+static void     stbi__convert_row16(stbi__uint16 *dest, int req_comp, stbi__uint16 const *src, int img_n, unsigned int x, int simd);
+
+// process-wide defaults, copied into each stbi__context when a load starts
 static int stbi__vertically_flip_on_load = 0;
+static int stbi__unpremultiply_on_load = 0;
+static int stbi__de_iphone_flag = 0;
 
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 {
     stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
-static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
+STBIDEF void stbi_load_options_init(stbi_load_options *opt)
+{
+    opt->flip_vertically = stbi__vertically_flip_on_load;
+    opt->unpremultiply = stbi__unpremultiply_on_load;
+    opt->convert_iphone_png = stbi__de_iphone_flag;
+    opt->scale_denom = 1;
+    opt->no_avx2 = 0;
+    opt->crop_x = opt->crop_y = opt->crop_w = opt->crop_h = 0;
+    opt->parallel_for = NULL;
+    opt->parallel_user = NULL;
+}
+
+static void *stbi__load_format(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
     memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
     ri->bits_per_channel = 8; // default is 8 so most paths don't have to be changed
@@ -1073,71 +1679,147 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
     return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
 }
 
-static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
+static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
-    int i;
-    int img_len = w * h * channels;
+    void *result;
+    s->arena = stbi__arena_begin();
+    result = stbi__load_format(s, x, y, comp, req_comp, ri, bpc);
+    // only the JPEG decoder crops as it goes
+    if (result && s->opt.crop_w > 0 && s->opt.crop_h > 0 && !ri->cropped)
+        result = stbi__crop(s, result, x, y, ri->num_channels ? ri->num_channels : req_comp ? req_comp : *comp, ri->bits_per_channel / 8);
+    // decoders that can't write to s->into directly return their own
+    // image, which may live in the arena
+    if (s->into && result && result != s->into)
+        result = stbi__store_into(s, result, *x, *y, req_comp, ri);
+    // likewise for decoders that don't stream bands
+    else if (s->band && result && result != s->band->buf)
+        result = stbi__band_store(s, result, *x, *y, req_comp, ri);
+    stbi__arena_end(s->arena);
+    s->arena = NULL;
+    return result;
+}
+
+// keeps the top byte of each of n 16-bit values, which is a sufficient
+// approximation of 16->8 bit scaling; dest may be src, as byte i is only
+// written once value i has been read
+static void stbi__narrow_16_to_8(stbi_uc *dest, stbi__uint16 const *src, int n, int simd)
+{
+    int i = 0;
+#ifdef STBI_SSE2
+    if (simd) {
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_srli_epi16(_mm_loadu_si128((__m128i const *)(src + i)), 8);
+            __m128i b = _mm_srli_epi16(_mm_loadu_si128((__m128i const *)(src + i + 8)), 8);
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(a, b));
+        }
+    }
+#else
+    STBI_NOTUSED(simd);
+#endif
+    for (; i < n; ++i)
+        dest[i] = (stbi_uc)((src[i] >> 8) & 0xFF);
+}
+
+// replicates each of n bytes to the high and low byte, maps 0->0, 255->0xffff
+static void stbi__widen_8_to_16(stbi__uint16 *dest, stbi_uc const *src, int n, int simd)
+{
+    int i = 0;
+#ifdef STBI_SSE2
+    if (simd) {
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((__m128i const *)(src + i));
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_unpacklo_epi8(v, v));
+            _mm_storeu_si128((__m128i *)(dest + i + 8), _mm_unpackhi_epi8(v, v));
+        }
+    }
+#else
+    STBI_NOTUSED(simd);
+#endif
+    for (; i < n; ++i)
+        dest[i] = (stbi__uint16)((src[i] << 8) + src[i]);
+}
+
+// the rows go out bottom-up when flip is set
+static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels, int flip, int simd)
+{
+    int j;
+    int row_len = w * channels;
     stbi_uc *reduced;
 
-    reduced = (stbi_uc *)stbi__malloc(img_len);
+    reduced = (stbi_uc *)stbi__malloc(row_len * h);
     if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
 
-    for (i = 0; i < img_len; ++i)
-        reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+    for (j = 0; j < h; ++j)
+        stbi__narrow_16_to_8(reduced + (size_t)(flip ? h - 1 - j : j) * row_len, orig + (size_t)j * row_len, row_len, simd);
 
-    STBI_FREE(orig);
+    stbi__free(orig);
     return reduced;
 }
 
-static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels)
+static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels, int flip, int simd)
 {
-    int i;
-    int img_len = w * h * channels;
+    int j;
+    int row_len = w * channels;
     stbi__uint16 *enlarged;
 
-    enlarged = (stbi__uint16 *)stbi__malloc(img_len * 2);
+    enlarged = (stbi__uint16 *)stbi__malloc(row_len * h * 2);
     if (enlarged == NULL) return (stbi__uint16 *)stbi__errpuc("outofmem", "Out of memory");
 
-    for (i = 0; i < img_len; ++i)
-        enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
+    for (j = 0; j < h; ++j)
+        stbi__widen_8_to_16(enlarged + (size_t)(flip ? h - 1 - j : j) * row_len, orig + (size_t)j * row_len, row_len, simd);
 
-    STBI_FREE(orig);
+    stbi__free(orig);
     return enlarged;
 }
 
+static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
+{
+    int row;
+    size_t bytes_per_row = (size_t)w * bytes_per_pixel;
+    stbi_uc temp[2048];
+    stbi_uc *bytes = (stbi_uc *)image;
+
+    for (row = 0; row < (h >> 1); row++) {
+        stbi_uc *row0 = bytes + row * bytes_per_row;
+        stbi_uc *row1 = bytes + (h - row - 1) * bytes_per_row;
+        // swap row0 with row1
+        size_t bytes_left = bytes_per_row;
+        while (bytes_left) {
+            size_t bytes_copy = (bytes_left < sizeof(temp)) ? bytes_left : sizeof(temp);
+            memcpy(temp, row0, bytes_copy);
+            memcpy(row0, row1, bytes_copy);
+            memcpy(row1, temp, bytes_copy);
+            row0 += bytes_copy;
+            row1 += bytes_copy;
+            bytes_left -= bytes_copy;
+        }
+    }
+}
+
 static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
     stbi__result_info ri;
     void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+    int channels, flip;
 
     if (result == NULL)
         return NULL;
 
+    // @TODO: move stbi__convert_format to here
+
+    // the decoder may have done the flip already (see stbi__fold_flip);
+    // otherwise it rides along with the narrowing if there is one
+    channels = req_comp ? req_comp : *comp;
+    flip = s->opt.flip_vertically && !ri.flipped;
     if (ri.bits_per_channel != 8) {
         STBI_ASSERT(ri.bits_per_channel == 16);
-        result = stbi__convert_16_to_8((stbi__uint16 *)result, *x, *y, req_comp == 0 ? *comp : req_comp);
+        result = stbi__convert_16_to_8((stbi__uint16 *)result, *x, *y, channels, flip, stbi__simd_level(s));
         ri.bits_per_channel = 8;
+        flip = 0;
     }
 
-    // @TODO: move stbi__convert_format to here
-
-    if (stbi__vertically_flip_on_load) {
-        int w = *x, h = *y;
-        int channels = req_comp ? req_comp : *comp;
-        int row, col, z;
-        stbi_uc *image = (stbi_uc *)result;
-
-        // @OPTIMIZE: use a bigger temp buffer and memcpy multiple pixels at once
-        for (row = 0; row < (h >> 1); row++) {
-            for (col = 0; col < w; col++) {
-                for (z = 0; z < channels; z++) {
-                    stbi_uc temp = image[(row * w + col) * channels + z];
-                    image[(row * w + col) * channels + z] = image[((h - row - 1) * w + col) * channels + z];
-                    image[((h - row - 1) * w + col) * channels + z] = temp;
-                }
-            }
-        }
-    }
+    if (flip)
+        stbi__vertical_flip(result, *x, *y, channels);
 
     return (unsigned char *)result;
 }
@@ -1146,59 +1828,35 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
 {
     stbi__result_info ri;
     void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
+    int channels, flip;
 
     if (result == NULL)
         return NULL;
 
+    // @TODO: move stbi__convert_format16 to here
+    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
+
+    channels = req_comp ? req_comp : *comp;
+    flip = s->opt.flip_vertically && !ri.flipped;
     if (ri.bits_per_channel != 16) {
         STBI_ASSERT(ri.bits_per_channel == 8);
-        result = stbi__convert_8_to_16((stbi_uc *)result, *x, *y, req_comp == 0 ? *comp : req_comp);
+        result = stbi__convert_8_to_16((stbi_uc *)result, *x, *y, channels, flip, stbi__simd_level(s));
         ri.bits_per_channel = 16;
+        flip = 0;
     }
 
-    // @TODO: move stbi__convert_format16 to here
-    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
-
-    if (stbi__vertically_flip_on_load) {
-        int w = *x, h = *y;
-        int channels = req_comp ? req_comp : *comp;
-        int row, col, z;
-        stbi__uint16 *image = (stbi__uint16 *)result;
-
-        // @OPTIMIZE: use a bigger temp buffer and memcpy multiple pixels at once
-        for (row = 0; row < (h >> 1); row++) {
-            for (col = 0; col < w; col++) {
-                for (z = 0; z < channels; z++) {
-                    stbi__uint16 temp = image[(row * w + col) * channels + z];
-                    image[(row * w + col) * channels + z] = image[((h - row - 1) * w + col) * channels + z];
-                    image[((h - row - 1) * w + col) * channels + z] = temp;
-                }
-            }
-        }
-    }
+    if (flip)
+        stbi__vertical_flip(result, *x, *y, channels * (int)sizeof(stbi__uint16));
 
     return (stbi__uint16 *)result;
 }
 
 #ifndef STBI_NO_HDR
-static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, int req_comp)
-{
-    if (stbi__vertically_flip_on_load && result != NULL) {
-        int w = *x, h = *y;
-        int depth = req_comp ? req_comp : *comp;
-        int row, col, z;
-        float temp;
-
-        // @OPTIMIZE: use a bigger temp buffer and memcpy multiple pixels at once
-        for (row = 0; row < (h >> 1); row++) {
-            for (col = 0; col < w; col++) {
-                for (z = 0; z < depth; z++) {
-                    temp = result[(row * w + col) * depth + z];
-                    result[(row * w + col) * depth + z] = result[((h - row - 1) * w + col) * depth + z];
-                    result[((h - row - 1) * w + col) * depth + z] = temp;
-                }
-            }
-        }
+static void stbi__float_postprocess(stbi__context *s, float *result, int *x, int *y, int *comp, int req_comp)
+{
+    if (s->opt.flip_vertically && result != NULL) {
+        int channels = req_comp ? req_comp : *comp;
+        stbi__vertical_flip(result, *x, *y, channels * (int)sizeof(float));
     }
 }
 #endif
@@ -1230,9 +1888,25 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
 
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
-    unsigned char *result;
+    return stbi_load_from_file_ex(f, NULL, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_ex(char const *filename, stbi_load_options const *opt, int *x, int *y, int *comp, int req_comp)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    unsigned char *result;
+    if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+    result = stbi_load_from_file_ex(f, opt, x, y, comp, req_comp);
+    fclose(f);
+    return result;
+}
+
+STBIDEF stbi_uc *stbi_load_from_file_ex(FILE *f, stbi_load_options const *opt, int *x, int *y, int *comp, int req_comp)
+{
+    unsigned char *result;
     stbi__context s;
     stbi__start_file(&s, f);
+    stbi__use_options(&s, opt);
     result = stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
     if (result) {
         // need to 'unget' all the characters in the IO buffer
@@ -1268,19 +1942,240 @@ STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, i
 #endif //!STBI_NO_STDIO
 
 STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_from_memory_ex(buffer, len, NULL, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_from_callbacks_ex(clbk, user, NULL, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_from_memory_ex(stbi_uc const *buffer, int len, stbi_load_options const *opt, int *x, int *y, int *comp, int req_comp)
 {
     stbi__context s;
     stbi__start_mem(&s, buffer, len);
+    stbi__use_options(&s, opt);
     return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
-STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+STBIDEF stbi_uc *stbi_load_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, stbi_load_options const *opt, int *x, int *y, int *comp, int req_comp)
 {
     stbi__context s;
     stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+    stbi__use_options(&s, opt);
     return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
+static int stbi__load_into(stbi__context *s, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__result_info ri;
+    if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "stbi_load_into needs desired_channels 1-4");
+    if (dst == NULL || dst_stride <= 0 || dst_height <= 0) return stbi__err("bad dst", "Invalid stbi_load_into buffer");
+    s->into = dst;
+    s->into_stride = dst_stride;
+    s->into_rows = dst_height;
+    return stbi__load_main(s, x, y, comp, req_comp, &ri, 8) != NULL;
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__context s;
+    stbi__start_mem(&s, buffer, len);
+    stbi__use_options(&s, opt);
+    return stbi__load_into(&s, dst, dst_stride, dst_height, x, y, comp, req_comp);
+}
+
+STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+    stbi__use_options(&s, opt);
+    return stbi__load_into(&s, dst, dst_stride, dst_height, x, y, comp, req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into(char const *filename, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *comp, int req_comp)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_load_into_from_file(f, opt, dst, dst_stride, dst_height, x, y, comp, req_comp);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_load_into_from_file(FILE *f, stbi_load_options const *opt, stbi_uc *dst, int dst_stride, int dst_height, int *x, int *y, int *comp, int req_comp)
+{
+    int result;
+    stbi__context s;
+    stbi__start_file(&s, f);
+    stbi__use_options(&s, opt);
+    result = stbi__load_into(&s, dst, dst_stride, dst_height, x, y, comp, req_comp);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, -(int)(s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+#endif
+
+static int stbi__load_bands(stbi__context *s, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__result_info ri;
+    stbi__band b;
+    int result;
+    if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "stbi_load_bands needs desired_channels 1-4");
+    if (band == NULL || band_rows <= 0) return stbi__err("bad band", "Invalid stbi_load_bands callback or band height");
+    b.callback = band;
+    b.user = band_user;
+    b.buf = NULL;
+    b.band_rows = band_rows;
+    b.comp = req_comp;
+    s->band = &b;
+    result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8) != NULL;
+    stbi__free(b.buf);
+    return result;
+}
+
+STBIDEF int stbi_load_bands_from_memory(stbi_uc const *buffer, int len, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__context s;
+    stbi__start_mem(&s, buffer, len);
+    stbi__use_options(&s, opt);
+    return stbi__load_bands(&s, band_rows, band, band_user, x, y, comp, req_comp);
+}
+
+STBIDEF int stbi_load_bands_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+    stbi__use_options(&s, opt);
+    return stbi__load_bands(&s, band_rows, band, band_user, x, y, comp, req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_bands(char const *filename, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *comp, int req_comp)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_load_bands_from_file(f, opt, band_rows, band, band_user, x, y, comp, req_comp);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_load_bands_from_file(FILE *f, stbi_load_options const *opt, int band_rows, stbi_band_callback band, void *band_user, int *x, int *y, int *comp, int req_comp)
+{
+    int result;
+    stbi__context s;
+    stbi__start_file(&s, f);
+    stbi__use_options(&s, opt);
+    result = stbi__load_bands(&s, band_rows, band, band_user, x, y, comp, req_comp);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, -(int)(s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+#endif
+
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+
+// read-only view of a whole file, handed to stbi__start_mem
+typedef struct
+{
+    stbi_uc const *data;
+    int len;
+} stbi__mapped_file;
+
+// empty files can't be mapped; they decode from this instead, so they fail
+// the same way they do through stdio
+static stbi_uc const stbi__empty_file[1] = { 0 };
+
+static int stbi__map_file(stbi__mapped_file *m, char const *filename)
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    HANDLE mapping;
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return stbi__err("can't fopen", "Unable to open file");
+    if (!GetFileSizeEx(file, &size) || size.QuadPart > INT_MAX) {
+        CloseHandle(file);
+        return stbi__err("too large", "File too large to map");
+    }
+    m->len = (int)size.QuadPart;
+    m->data = stbi__empty_file;
+    if (m->len > 0) {
+        // the view keeps the file alive, both handles can go right away
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        m->data = mapping ? (stbi_uc const *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (mapping) CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return stbi__err("can't fopen", "Unable to open file");
+    if (fstat(fd, &st) != 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return stbi__err("too large", "File too large to map");
+    }
+    m->len = (int)st.st_size;
+    m->data = stbi__empty_file;
+    if (m->len > 0) {
+        void *p = mmap(NULL, (size_t)m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        m->data = p != MAP_FAILED ? (stbi_uc const *)p : NULL;
+#ifdef MADV_SEQUENTIAL
+        // every decoder reads front to back, let the kernel read ahead
+        if (m->data) madvise(p, (size_t)m->len, MADV_SEQUENTIAL);
+#endif
+    }
+    close(fd);
+#endif
+    if (!m->data) return stbi__err("can't mmap", "Unable to map file");
+    return 1;
+}
+
+static void stbi__unmap_file(stbi__mapped_file *m)
+{
+    if (m->data == stbi__empty_file) return;
+#ifdef _WIN32
+    UnmapViewOfFile(m->data);
+#else
+    munmap((void *)m->data, (size_t)m->len);
+#endif
+}
+
+STBIDEF stbi_uc *stbi_load_mmap(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_mmap_ex(filename, NULL, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_mmap_ex(char const *filename, stbi_load_options const *opt, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__mapped_file m;
+    unsigned char *result;
+    if (!stbi__map_file(&m, filename)) return NULL;
+    result = stbi_load_from_memory_ex(m.data, m.len, opt, x, y, comp, req_comp);
+    stbi__unmap_file(&m);
+    return result;
+}
+
+STBIDEF stbi_us *stbi_load_mmap_16(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__mapped_file m;
+    stbi__context s;
+    stbi__uint16 *result;
+    if (!stbi__map_file(&m, filename)) return NULL;
+    stbi__start_mem(&s, m.data, m.len);
+    result = stbi__load_and_postprocess_16bit(&s, x, y, comp, req_comp);
+    stbi__unmap_file(&m);
+    return result;
+}
+
+#endif // !STBI_NO_STDIO && !STBI_NO_MMAP
+
 #ifndef STBI_NO_LINEAR
 static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
@@ -1290,7 +2185,7 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
         stbi__result_info ri;
         float *hdr_data = stbi__hdr_load(s, x, y, comp, req_comp, &ri);
         if (hdr_data)
-            stbi__float_postprocess(hdr_data, x, y, comp, req_comp);
+            stbi__float_postprocess(s, hdr_data, x, y, comp, req_comp);
         return hdr_data;
     }
 #endif
@@ -1333,6 +2228,20 @@ STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_
 }
 #endif // !STBI_NO_STDIO
 
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+STBIDEF float *stbi_loadf_mmap(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__mapped_file m;
+    stbi__context s;
+    float *result;
+    if (!stbi__map_file(&m, filename)) return NULL;
+    stbi__start_mem(&s, m.data, m.len);
+    result = stbi__loadf_main(&s, x, y, comp, req_comp);
+    stbi__unmap_file(&m);
+    return result;
+}
+#endif
+
 #endif // !STBI_NO_LINEAR
 
 // these is-hdr-or-not is defined independent of whether STBI_NO_LINEAR is
@@ -1541,14 +2450,333 @@ static stbi__uint32 stbi__get32le(stbi__context *s)
 //  assume data buffer is malloced, so malloc a new one and free that one
 //  only failure mode is malloc failing
 
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+
+static int stbi__cropping(stbi__context *s)
+{
+    return s->opt.crop_w > 0 && s->opt.crop_h > 0;
+}
+
+// Whether the pass writing a decoder's final image should do the
+// flip_vertically too, by writing its rows bottom-up. If so the flip is
+// marked done, so stbi__load_and_postprocess_* skips it. stbi_load_into and
+// bands place rows themselves, and crops are cut in file row order.
+static int stbi__fold_flip(stbi__context *s, stbi__result_info *ri)
+{
+    if (!s->opt.flip_vertically || ri->flipped || s->into || s->band || stbi__cropping(s))
+        return 0;
+    ri->flipped = 1;
+    return 1;
+}
+
 static stbi_uc stbi__compute_y(int r, int g, int b)
 {
     return (stbi_uc)(((r * 77) + (g * 150) + (29 * b)) >> 8);
 }
 
-static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+#ifdef STBI_SSE2
+// SIMD bodies of stbi__convert_row and stbi__convert_row16. Each converts
+// as many leading pixels as it can without touching memory past the end of
+// either row and returns how many, for the scalar loop to finish the row.
+
+// stbi__compute_y of four RGBA pixels, one per 32-bit lane
+static stbi_inline __m128i stbi__rgba_to_y_sse2(__m128i v)
 {
-    int i, j;
+    __m128i rb = _mm_and_si128(v, _mm_set1_epi16(0xff));
+    __m128i ga = _mm_srli_epi16(v, 8);
+    __m128i y = _mm_add_epi32(_mm_madd_epi16(rb, _mm_set1_epi32((29 << 16) | 77)), _mm_madd_epi16(ga, _mm_set1_epi32(150)));
+    return _mm_srli_epi32(y, 8);
+}
+
+// the conversions that don't move 3-byte pixels
+static int stbi__convert_row_sse2(stbi_uc *dest, int req_comp, stbi_uc const *src, int img_n, int x)
+{
+    __m128i ff = _mm_set1_epi8(-1), lo = _mm_set1_epi16(0xff);
+    int i = 0;
+    switch (STBI__COMBO(img_n, req_comp)) {
+    case STBI__COMBO(1, 2):
+        for (; i + 16 <= x; i += 16) {
+            __m128i g = _mm_loadu_si128((__m128i const *)(src + i));
+            _mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_unpacklo_epi8(g, ff));
+            _mm_storeu_si128((__m128i *)(dest + 2 * i + 16), _mm_unpackhi_epi8(g, ff));
+        }
+        break;
+    case STBI__COMBO(1, 4):
+        for (; i + 16 <= x; i += 16) {
+            __m128i g = _mm_loadu_si128((__m128i const *)(src + i));
+            __m128i gg0 = _mm_unpacklo_epi8(g, g), gg1 = _mm_unpackhi_epi8(g, g);
+            __m128i ga0 = _mm_unpacklo_epi8(g, ff), ga1 = _mm_unpackhi_epi8(g, ff);
+            _mm_storeu_si128((__m128i *)(dest + 4 * i), _mm_unpacklo_epi16(gg0, ga0));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 16), _mm_unpackhi_epi16(gg0, ga0));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 32), _mm_unpacklo_epi16(gg1, ga1));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 48), _mm_unpackhi_epi16(gg1, ga1));
+        }
+        break;
+    case STBI__COMBO(2, 1):
+        for (; i + 16 <= x; i += 16) {
+            __m128i a = _mm_and_si128(_mm_loadu_si128((__m128i const *)(src + 2 * i)), lo);
+            __m128i b = _mm_and_si128(_mm_loadu_si128((__m128i const *)(src + 2 * i + 16)), lo);
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(a, b));
+        }
+        break;
+    case STBI__COMBO(2, 4):
+        for (; i + 8 <= x; i += 8) {
+            __m128i ga = _mm_loadu_si128((__m128i const *)(src + 2 * i));
+            __m128i g = _mm_and_si128(ga, lo);
+            __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i), _mm_unpacklo_epi16(gg, ga));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 16), _mm_unpackhi_epi16(gg, ga));
+        }
+        break;
+    case STBI__COMBO(4, 1):
+    case STBI__COMBO(4, 2):
+        for (; i + 8 <= x; i += 8) {
+            __m128i v0 = _mm_loadu_si128((__m128i const *)(src + 4 * i));
+            __m128i v1 = _mm_loadu_si128((__m128i const *)(src + 4 * i + 16));
+            __m128i y = _mm_packs_epi32(stbi__rgba_to_y_sse2(v0), stbi__rgba_to_y_sse2(v1));
+            if (req_comp == 1) {
+                _mm_storel_epi64((__m128i *)(dest + i), _mm_packus_epi16(y, y));
+            }
+            else {
+                __m128i a = _mm_packs_epi32(_mm_srli_epi32(v0, 24), _mm_srli_epi32(v1, 24));
+                _mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_or_si128(y, _mm_slli_epi16(a, 8)));
+            }
+        }
+        break;
+    }
+    return i;
+}
+
+// stbi__compute_y_16 of eight pixels given one channel per register; the
+// sums need 32 bits
+static stbi_inline __m128i stbi__rgb_to_y16_sse2(__m128i r, __m128i g, __m128i b)
+{
+    __m128i k77 = _mm_set1_epi16(77), k150 = _mm_set1_epi16(150), k29 = _mm_set1_epi16(29);
+    __m128i rl = _mm_mullo_epi16(r, k77), rh = _mm_mulhi_epu16(r, k77);
+    __m128i gl = _mm_mullo_epi16(g, k150), gh = _mm_mulhi_epu16(g, k150);
+    __m128i bl = _mm_mullo_epi16(b, k29), bh = _mm_mulhi_epu16(b, k29);
+    __m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(rl, rh), _mm_unpacklo_epi16(gl, gh)), _mm_unpacklo_epi16(bl, bh));
+    __m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(rl, rh), _mm_unpackhi_epi16(gl, gh)), _mm_unpackhi_epi16(bl, bh));
+    // packs_epi32 saturates to signed values, so pack around 0x8000
+    __m128i bias = _mm_set1_epi32(0x8000);
+    lo = _mm_sub_epi32(_mm_srli_epi32(lo, 8), bias);
+    hi = _mm_sub_epi32(_mm_srli_epi32(hi, 8), bias);
+    return _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16(-32768));
+}
+
+// stbi__compute_y_16 of eight RGBA pixels, two per register; the alphas go
+// to *alpha
+static stbi_inline __m128i stbi__rgba16_to_y_sse2(__m128i v0, __m128i v1, __m128i v2, __m128i v3, __m128i *alpha)
+{
+    // transpose to r0..r3 g0..g3 and b0..b3 a0..a3, and the same for 4..7
+    __m128i t0 = _mm_unpacklo_epi16(v0, v1), t1 = _mm_unpackhi_epi16(v0, v1);
+    __m128i t2 = _mm_unpacklo_epi16(v2, v3), t3 = _mm_unpackhi_epi16(v2, v3);
+    __m128i rg0 = _mm_unpacklo_epi16(t0, t1), ba0 = _mm_unpackhi_epi16(t0, t1);
+    __m128i rg1 = _mm_unpacklo_epi16(t2, t3), ba1 = _mm_unpackhi_epi16(t2, t3);
+    *alpha = _mm_unpackhi_epi64(ba0, ba1);
+    return stbi__rgb_to_y16_sse2(_mm_unpacklo_epi64(rg0, rg1), _mm_unpackhi_epi64(rg0, rg1), _mm_unpacklo_epi64(ba0, ba1));
+}
+
+// stbi__convert_row_sse2 for 16-bit channels
+static int stbi__convert_row16_sse2(stbi__uint16 *dest, int req_comp, stbi__uint16 const *src, int img_n, int x)
+{
+    __m128i ff = _mm_set1_epi8(-1);
+    int i = 0;
+    switch (STBI__COMBO(img_n, req_comp)) {
+    case STBI__COMBO(1, 2):
+        for (; i + 8 <= x; i += 8) {
+            __m128i g = _mm_loadu_si128((__m128i const *)(src + i));
+            _mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_unpacklo_epi16(g, ff));
+            _mm_storeu_si128((__m128i *)(dest + 2 * i + 8), _mm_unpackhi_epi16(g, ff));
+        }
+        break;
+    case STBI__COMBO(1, 4):
+        for (; i + 8 <= x; i += 8) {
+            __m128i g = _mm_loadu_si128((__m128i const *)(src + i));
+            __m128i gg0 = _mm_unpacklo_epi16(g, g), gg1 = _mm_unpackhi_epi16(g, g);
+            __m128i ga0 = _mm_unpacklo_epi16(g, ff), ga1 = _mm_unpackhi_epi16(g, ff);
+            _mm_storeu_si128((__m128i *)(dest + 4 * i), _mm_unpacklo_epi32(gg0, ga0));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 8), _mm_unpackhi_epi32(gg0, ga0));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 16), _mm_unpacklo_epi32(gg1, ga1));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 24), _mm_unpackhi_epi32(gg1, ga1));
+        }
+        break;
+    case STBI__COMBO(2, 1):
+        for (; i + 8 <= x; i += 8) {
+            __m128i a = _mm_loadu_si128((__m128i const *)(src + 2 * i));
+            __m128i b = _mm_loadu_si128((__m128i const *)(src + 2 * i + 8));
+            // sign-extend the gray values so packs_epi32 keeps them whole
+            a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+            b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_packs_epi32(a, b));
+        }
+        break;
+    case STBI__COMBO(2, 4):
+        for (; i + 4 <= x; i += 4) {
+            __m128i ga = _mm_loadu_si128((__m128i const *)(src + 2 * i));
+            __m128i g = _mm_slli_epi32(ga, 16);
+            __m128i gg = _mm_or_si128(g, _mm_srli_epi32(g, 16));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i), _mm_unpacklo_epi32(gg, ga));
+            _mm_storeu_si128((__m128i *)(dest + 4 * i + 8), _mm_unpackhi_epi32(gg, ga));
+        }
+        break;
+    case STBI__COMBO(4, 1):
+    case STBI__COMBO(4, 2):
+        for (; i + 8 <= x; i += 8) {
+            __m128i v0 = _mm_loadu_si128((__m128i const *)(src + 4 * i));
+            __m128i v1 = _mm_loadu_si128((__m128i const *)(src + 4 * i + 8));
+            __m128i v2 = _mm_loadu_si128((__m128i const *)(src + 4 * i + 16));
+            __m128i v3 = _mm_loadu_si128((__m128i const *)(src + 4 * i + 24));
+            __m128i a, y = stbi__rgba16_to_y_sse2(v0, v1, v2, v3, &a);
+            if (req_comp == 1) {
+                _mm_storeu_si128((__m128i *)(dest + i), y);
+            }
+            else {
+                _mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_unpacklo_epi16(y, a));
+                _mm_storeu_si128((__m128i *)(dest + 2 * i + 8), _mm_unpackhi_epi16(y, a));
+            }
+        }
+        break;
+    }
+    return i;
+}
+
+#ifdef STBI_AVX2
+// The conversions to and from 3-channel pixels, 8 or 16 bits per channel
+// (bytes 1 or 2): pshufb spreads a 16-byte block of p pixels per 128-bit
+// lane, and the bytes the mask clears are set to 255 to make the alpha.
+// RGB to gray goes through RGBA in registers, for the SSE2 luma code.
+static STBI__AVX2_TARGET int stbi__convert_row_avx2(stbi_uc *dest, int req_comp, stbi_uc const *src, int img_n, int x, int bytes)
+{
+    static signed char const masks[8][16] = {
+        { 0,0,0, 1,1,1, 2,2,2, 3,3,3, 4,4,4, -1 },
+        { 0,0,0, 2,2,2, 4,4,4, 6,6,6, 8,8,8, -1 },
+        { 0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1 },
+        { 0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1 },
+        { 0,1,0,1,0,1, 2,3,2,3,2,3, -1,-1,-1,-1 },
+        { 0,1,0,1,0,1, 4,5,4,5,4,5, -1,-1,-1,-1 },
+        { 0,1,2,3,4,5,-1,-1, 6,7,8,9,10,11,-1,-1 },
+        { 0,1,2,3,4,5, 8,9,10,11,12,13, -1,-1,-1,-1 },
+    };
+    int k, p, in = img_n * bytes, out = req_comp * bytes, i = 0;
+    __m128i m;
+    __m256i mask, fill;
+
+    switch (STBI__COMBO(img_n, req_comp)) {
+    case STBI__COMBO(1, 3): k = 0; break;
+    case STBI__COMBO(2, 3): k = 1; break;
+    case STBI__COMBO(3, 1):
+    case STBI__COMBO(3, 2):
+    case STBI__COMBO(3, 4): k = 2; break;
+    case STBI__COMBO(4, 3): k = 3; break;
+    default: return 0;
+    }
+    if (bytes == 2) k += 4;
+    m = _mm_loadu_si128((__m128i const *)masks[k]);
+
+    if (req_comp <= 2) {
+        __m128i ff = _mm_cmplt_epi8(m, _mm_setzero_si128());
+        if (bytes == 1) {
+            // eight pixels, loaded four at a time
+            for (; (x - i) * 3 >= 28; i += 8) {
+                __m128i v0 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(src + 3 * i)), m), ff);
+                __m128i v1 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(src + 3 * i + 12)), m), ff);
+                __m128i y = _mm_packs_epi32(stbi__rgba_to_y_sse2(v0), stbi__rgba_to_y_sse2(v1));
+                if (req_comp == 1)
+                    _mm_storel_epi64((__m128i *)(dest + i), _mm_packus_epi16(y, y));
+                else
+                    _mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_or_si128(y, _mm_set1_epi16((short)0xff00)));
+            }
+        }
+        else {
+            // eight pixels, loaded two at a time
+            for (; (x - i) * 6 >= 52; i += 8) {
+                __m128i v0 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(src + 6 * i)), m), ff);
+                __m128i v1 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(src + 6 * i + 12)), m), ff);
+                __m128i v2 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(src + 6 * i + 24)), m), ff);
+                __m128i v3 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(src + 6 * i + 36)), m), ff);
+                __m128i a, y = stbi__rgba16_to_y_sse2(v0, v1, v2, v3, &a);
+                if (req_comp == 1) {
+                    _mm_storeu_si128((__m128i *)(dest + 2 * i), y);
+                }
+                else {
+                    _mm_storeu_si128((__m128i *)(dest + 4 * i), _mm_unpacklo_epi16(y, a));
+                    _mm_storeu_si128((__m128i *)(dest + 4 * i + 16), _mm_unpackhi_epi16(y, a));
+                }
+            }
+        }
+        return i;
+    }
+
+    p = 16 / (in > out ? in : out);
+    mask = _mm256_inserti128_si256(_mm256_castsi128_si256(m), m, 1);
+    fill = _mm256_cmpgt_epi8(_mm256_setzero_si256(), mask);
+
+    // two blocks at a time; the second block's 16-byte load and store have
+    // to stay inside the rows, and the first one's spare bytes are
+    // overwritten by the second
+    for (; (x - i - p) * in >= 16 && (x - i - p) * out >= 16; i += 2 * p) {
+        __m128i a = _mm_loadu_si128((__m128i const *)(src + i * in));
+        __m128i b = _mm_loadu_si128((__m128i const *)(src + (i + p) * in));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, mask), fill);
+        _mm_storeu_si128((__m128i *)(dest + i * out), _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i *)(dest + (i + p) * out), _mm256_extracti128_si256(v, 1));
+    }
+    return i;
+}
+#endif
+#endif
+
+// converts one row of x pixels from img_n to req_comp components, with the
+// kernels stbi__simd_level picked
+static void stbi__convert_row(unsigned char *dest, int req_comp, unsigned char const *src, int img_n, unsigned int x, int simd)
+{
+    int i;
+
+#ifdef STBI_SSE2
+    if (simd) {
+        int done = 0;
+#ifdef STBI_AVX2
+        if (simd == 2)
+            done = stbi__convert_row_avx2(dest, req_comp, src, img_n, x, 1);
+#endif
+        if (!done)
+            done = stbi__convert_row_sse2(dest, req_comp, src, img_n, x);
+        src += done * img_n;
+        dest += done * req_comp;
+        x -= done;
+    }
+#else
+    STBI_NOTUSED(simd);
+#endif
+
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+    // convert source image with img_n components to one with req_comp components;
+    // avoid switch per pixel, so use switch per scanline and massive macros
+    switch (STBI__COMBO(img_n, req_comp)) {
+        STBI__CASE(1, 2) { dest[0] = src[0], dest[1] = 255; } break;
+        STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+        STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = 255; } break;
+        STBI__CASE(2, 1) { dest[0] = src[0]; } break;
+        STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+        STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = src[1]; } break;
+        STBI__CASE(3, 4) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2], dest[3] = 255; } break;
+        STBI__CASE(3, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
+        STBI__CASE(3, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]), dest[1] = 255; } break;
+        STBI__CASE(4, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
+        STBI__CASE(4, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]), dest[1] = src[3]; } break;
+        STBI__CASE(4, 3) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2]; } break;
+    default: STBI_ASSERT(0);
+    }
+#undef STBI__CASE
+}
+
+// The rows go out bottom-up when stbi__fold_flip says the flip can be done
+// here
+static unsigned char *stbi__convert_format(stbi__context *s, stbi__result_info *ri, unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+{
+    int j, flip, simd;
     unsigned char *good;
 
     if (req_comp == img_n) return data;
@@ -1556,38 +2784,195 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 
     good = (unsigned char *)stbi__malloc_mad3(req_comp, x, y, 0);
     if (good == NULL) {
-        STBI_FREE(data);
+        stbi__free(data);
         return stbi__errpuc("outofmem", "Out of memory");
     }
 
-    for (j = 0; j < (int)y; ++j) {
-        unsigned char *src = data + j * x * img_n;
-        unsigned char *dest = good + j * x * req_comp;
+    flip = stbi__fold_flip(s, ri);
+    simd = stbi__simd_level(s);
+    for (j = 0; j < (int)y; ++j)
+        stbi__convert_row(good + (flip ? (int)y - 1 - j : j) * x * req_comp, req_comp, data + j * x * img_n, img_n, x, simd);
 
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-        // convert source image with img_n components to one with req_comp components;
-        // avoid switch per pixel, so use switch per scanline and massive macros
-        switch (STBI__COMBO(img_n, req_comp)) {
-            STBI__CASE(1, 2) { dest[0] = src[0], dest[1] = 255; } break;
-            STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-            STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = 255; } break;
-            STBI__CASE(2, 1) { dest[0] = src[0]; } break;
-            STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-            STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = src[1]; } break;
-            STBI__CASE(3, 4) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2], dest[3] = 255; } break;
-            STBI__CASE(3, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
-            STBI__CASE(3, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]), dest[1] = 255; } break;
-            STBI__CASE(4, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
-            STBI__CASE(4, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]), dest[1] = src[3]; } break;
-            STBI__CASE(4, 3) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2]; } break;
-        default: STBI_ASSERT(0);
+    stbi__free(data);
+    return good;
+}
+
+// The stbi_load_options crop clipped to a w x h image, with cy counted in
+// file row order (the rectangle is given after flip_vertically). The whole
+// image if there is no crop; fails if the rectangle misses the image.
+static int stbi__crop_rect(stbi__context *s, int w, int h, int *cx, int *cy, int *cw, int *ch)
+{
+    int x0 = s->opt.crop_x, y0 = s->opt.crop_y, x1, y1;
+    if (!stbi__cropping(s)) {
+        *cx = *cy = 0;
+        *cw = w;
+        *ch = h;
+        return 1;
+    }
+    x1 = x0 > w - s->opt.crop_w ? w : x0 + s->opt.crop_w;
+    y1 = y0 > h - s->opt.crop_h ? h : y0 + s->opt.crop_h;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 <= x0 || y1 <= y0) return stbi__err("bad crop", "Crop rectangle is outside the image");
+    *cx = x0;
+    *cy = s->opt.flip_vertically ? h - y1 : y0;
+    *cw = x1 - x0;
+    *ch = y1 - y0;
+    return 1;
+}
+
+// Cuts the crop out of an image a decoder returned whole, in place; every
+// row moves to a lower address, so rows are never overwritten before use
+static void *stbi__crop(stbi__context *s, void *data, int *x, int *y, int n, int bytes)
+{
+    int cx, cy, cw, ch, j;
+    size_t row_bytes = (size_t)*x * n * bytes, out_bytes;
+    if (!stbi__crop_rect(s, *x, *y, &cx, &cy, &cw, &ch)) {
+        stbi__free(data);
+        return NULL;
+    }
+    out_bytes = (size_t)cw * n * bytes;
+    for (j = 0; j < ch; ++j)
+        memmove((stbi_uc *)data + out_bytes * j, (stbi_uc *)data + row_bytes * (cy + j) + (size_t)cx * n * bytes, out_bytes);
+    // an image that is returned gives the rest back
+    if (!s->into && !s->band) {
+        void *smaller = stbi__heap_realloc(data, row_bytes * *y, out_bytes * ch);
+        if (smaller) data = smaller;
+    }
+    *x = cw;
+    *y = ch;
+    return data;
+}
+
+// Writes one row of w pixels with n channels of the given bits as 8-bit
+// req_comp channels. 16-bit rows are converted before they are narrowed,
+// so gray comes from stbi__compute_y_16 like in stbi_load; that needs tmp,
+// room for w * req_comp 16-bit values, when n != req_comp.
+static void stbi__emit_row(stbi_uc *dest, int req_comp, stbi_uc const *src, int n, int bits, int w, stbi__uint16 *tmp, int simd)
+{
+    if (bits == 16) {
+        if (n != req_comp) {
+            stbi__convert_row16(tmp, req_comp, (stbi__uint16 const *)src, n, w, simd);
+            stbi__narrow_16_to_8(dest, tmp, w * req_comp, simd);
         }
-#undef STBI__CASE
+        else
+            stbi__narrow_16_to_8(dest, (stbi__uint16 const *)src, w * n, simd);
     }
+    else if (n == req_comp)
+        memcpy(dest, src, (size_t)w * n);
+    else
+        stbi__convert_row(dest, req_comp, src, n, w, simd);
+}
 
-    STBI_FREE(data);
-    return good;
+// the tmp row stbi__emit_row needs for these rows, or NULL when it needs none
+static stbi__uint16 *stbi__emit_row_tmp(stbi__context *s, int w, int n, int bits, int req_comp)
+{
+    if (bits != 16 || n == req_comp) return NULL;
+    return (stbi__uint16 *)stbi__scratch_malloc_mad2(s->arena, w, req_comp * 2, 0);
+}
+
+// Copies an image a decoder returned into the stbi_load_into buffer, doing
+// the channel conversion, 16-to-8 bit and flip in the same pass, and frees
+// it. The image has ri->num_channels components when the decoder left the
+// conversion to us, else req_comp.
+static void *stbi__store_into(stbi__context *s, void *data, int w, int h, int req_comp, stbi__result_info *ri)
+{
+    int j;
+    int n = ri->num_channels ? ri->num_channels : req_comp;
+    int bits = ri->bits_per_channel;
+    int simd = stbi__simd_level(s);
+    size_t row_bytes = (size_t)w * n * (bits / 8);
+    stbi__uint16 *tmp;
+
+    if (!stbi__into_fits(s, w, h, req_comp)) {
+        stbi__free(data);
+        return stbi__errpuc("dst too small", "Image larger than the stbi_load_into buffer");
+    }
+    tmp = stbi__emit_row_tmp(s, w, n, bits, req_comp);
+    if (!tmp && bits == 16 && n != req_comp) {
+        stbi__free(data);
+        return stbi__errpuc("outofmem", "Out of memory");
+    }
+
+    for (j = 0; j < h; ++j)
+        stbi__emit_row(stbi__into_row(s, j, h), req_comp, (stbi_uc *)data + row_bytes * j, n, bits, w, tmp, simd);
+
+    stbi__free(tmp);
+    stbi__free(data);
+    return s->into;
+}
+
+// Sets up the band buffer once the decoder knows the output size
+static int stbi__band_begin(stbi__context *s, int w, int h)
+{
+    stbi__band *b = s->band;
+    b->w = w;
+    b->h = h;
+    if (b->band_rows > h) b->band_rows = h;
+    b->filled = b->delivered = 0;
+    b->simd = stbi__simd_level(s);
+    b->buf = (stbi_uc *)stbi__malloc_mad3(b->band_rows, w, b->comp, 0);
+    if (!b->buf) return stbi__err("outofmem", "Out of memory");
+    return 1;
+}
+
+// Where row y (in file order) goes in the band buffer. Rows have to come
+// in order, from the top or from the bottom; the first one picks which.
+static stbi_uc *stbi__band_row(stbi__context *s, int y)
+{
+    stbi__band *b = s->band;
+    if (s->opt.flip_vertically) y = b->h - 1 - y;
+    if (b->filled == 0) {
+        if (b->delivered == 0) b->up = y != 0;
+        if (b->up) {
+            b->count = y + 1 < b->band_rows ? y + 1 : b->band_rows;
+            b->first = y - b->count + 1;
+        }
+        else {
+            b->count = b->h - y < b->band_rows ? b->h - y : b->band_rows;
+            b->first = y;
+        }
+    }
+    return b->buf + (size_t)(y - b->first) * b->w * b->comp;
+}
+
+// call after writing the row from stbi__band_row; hands out full bands
+static int stbi__band_row_done(stbi__context *s)
+{
+    stbi__band *b = s->band;
+    if (++b->filled < b->count) return 1;
+    b->filled = 0;
+    b->delivered += b->count;
+    if (!b->callback(b->user, b->buf, b->first, b->count, b->w * b->comp))
+        return stbi__err("band stopped", "Decoding stopped by the stbi_load_bands callback");
+    return 1;
+}
+
+// Passes count rows from row y (in file order) on to the bands, converting
+// from img_n channels and narrowing 16-bit data on the way
+static int stbi__band_rows(stbi__context *s, void *data, int img_n, int bits, int y, int count)
+{
+    stbi__band *b = s->band;
+    size_t row_bytes = (size_t)b->w * img_n * (bits / 8);
+    stbi__uint16 *tmp = stbi__emit_row_tmp(s, b->w, img_n, bits, b->comp);
+    int j, ok = 1;
+    if (!tmp && bits == 16 && img_n != b->comp) return stbi__err("outofmem", "Out of memory");
+    for (j = 0; j < count && ok; ++j) {
+        stbi__emit_row(stbi__band_row(s, y + j), b->comp, (stbi_uc *)data + row_bytes * j, img_n, bits, b->w, tmp, b->simd);
+        ok = stbi__band_row_done(s);
+    }
+    stbi__free(tmp);
+    return ok;
+}
+
+// stbi__store_into for bands: hands out an image a decoder returned whole,
+// and frees it
+static void *stbi__band_store(stbi__context *s, void *data, int w, int h, int req_comp, stbi__result_info *ri)
+{
+    int n = ri->num_channels ? ri->num_channels : req_comp;
+    int ok = stbi__band_begin(s, w, h) && stbi__band_rows(s, data, n, ri->bits_per_channel, 0, h);
+    stbi__free(data);
+    return ok ? s->band->buf : NULL;
 }
 
 static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
@@ -1595,9 +2980,52 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
     return (stbi__uint16)(((r * 77) + (g * 150) + (29 * b)) >> 8);
 }
 
-static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+// stbi__convert_row for 16-bit channels
+static void stbi__convert_row16(stbi__uint16 *dest, int req_comp, stbi__uint16 const *src, int img_n, unsigned int x, int simd)
 {
-    int i, j;
+    int i;
+
+#ifdef STBI_SSE2
+    if (simd) {
+        int done = 0;
+#ifdef STBI_AVX2
+        if (simd == 2)
+            done = stbi__convert_row_avx2((stbi_uc *)dest, req_comp, (stbi_uc const *)src, img_n, x, 2);
+#endif
+        if (!done)
+            done = stbi__convert_row16_sse2(dest, req_comp, src, img_n, x);
+        src += done * img_n;
+        dest += done * req_comp;
+        x -= done;
+    }
+#else
+    STBI_NOTUSED(simd);
+#endif
+
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+    // convert source image with img_n components to one with req_comp components;
+    // avoid switch per pixel, so use switch per scanline and massive macros
+    switch (STBI__COMBO(img_n, req_comp)) {
+        STBI__CASE(1, 2) { dest[0] = src[0], dest[1] = 0xffff; } break;
+        STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+        STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = 0xffff; } break;
+        STBI__CASE(2, 1) { dest[0] = src[0]; } break;
+        STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+        STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = src[1]; } break;
+        STBI__CASE(3, 4) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2], dest[3] = 0xffff; } break;
+        STBI__CASE(3, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
+        STBI__CASE(3, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]), dest[1] = 0xffff; } break;
+        STBI__CASE(4, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
+        STBI__CASE(4, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]), dest[1] = src[3]; } break;
+        STBI__CASE(4, 3) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2]; } break;
+    default: STBI_ASSERT(0);
+    }
+#undef STBI__CASE
+}
+
+static stbi__uint16 *stbi__convert_format16(stbi__context *s, stbi__result_info *ri, stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+{
+    int j, flip, simd;
     stbi__uint16 *good;
 
     if (req_comp == img_n) return data;
@@ -1605,37 +3033,16 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
     good = (stbi__uint16 *)stbi__malloc(req_comp * x * y * 2);
     if (good == NULL) {
-        STBI_FREE(data);
+        stbi__free(data);
         return (stbi__uint16 *)stbi__errpuc("outofmem", "Out of memory");
     }
 
-    for (j = 0; j < (int)y; ++j) {
-        stbi__uint16 *src = data + j * x * img_n;
-        stbi__uint16 *dest = good + j * x * req_comp;
-
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-        // convert source image with img_n components to one with req_comp components;
-        // avoid switch per pixel, so use switch per scanline and massive macros
-        switch (STBI__COMBO(img_n, req_comp)) {
-            STBI__CASE(1, 2) { dest[0] = src[0], dest[1] = 0xffff; } break;
-            STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-            STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = 0xffff; } break;
-            STBI__CASE(2, 1) { dest[0] = src[0]; } break;
-            STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-            STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0], dest[3] = src[1]; } break;
-            STBI__CASE(3, 4) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2], dest[3] = 0xffff; } break;
-            STBI__CASE(3, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
-            STBI__CASE(3, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]), dest[1] = 0xffff; } break;
-            STBI__CASE(4, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
-            STBI__CASE(4, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]), dest[1] = src[3]; } break;
-            STBI__CASE(4, 3) { dest[0] = src[0], dest[1] = src[1], dest[2] = src[2]; } break;
-        default: STBI_ASSERT(0);
-        }
-#undef STBI__CASE
-    }
+    flip = stbi__fold_flip(s, ri);
+    simd = stbi__simd_level(s);
+    for (j = 0; j < (int)y; ++j)
+        stbi__convert_row16(good + (flip ? (int)y - 1 - j : j) * x * req_comp, req_comp, data + j * x * img_n, img_n, x, simd);
 
-    STBI_FREE(data);
+    stbi__free(data);
     return good;
 }
 
@@ -1646,7 +3053,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
     float *output;
     if (!data) return NULL;
     output = (float *)stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
-    if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+    if (output == NULL) { stbi__free(data); return stbi__errpf("outofmem", "Out of memory"); }
     // compute number of non-alpha components
     if (comp & 1) n = comp; else n = comp - 1;
     for (i = 0; i < x*y; ++i) {
@@ -1655,7 +3062,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
         }
         if (k < comp) output[i*comp + k] = data[i*comp + k] / 255.0f;
     }
-    STBI_FREE(data);
+    stbi__free(data);
     return output;
 }
 #endif
@@ -1668,7 +3075,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
     stbi_uc *output;
     if (!data) return NULL;
     output = (stbi_uc *)stbi__malloc_mad3(x, y, comp, 0);
-    if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+    if (output == NULL) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
     // compute number of non-alpha components
     if (comp & 1) n = comp; else n = comp - 1;
     for (i = 0; i < x*y; ++i) {
@@ -1685,7 +3092,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
             output[i*comp + k] = (stbi_uc)stbi__float2int(z);
         }
     }
-    STBI_FREE(data);
+    stbi__free(data);
     return output;
 }
 #endif
@@ -1727,6 +3134,21 @@ typedef struct
     int    delta[17];   // old 'firstsymbol' - old 'firstcode'
 } stbi__huffman;
 
+typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
+    int w, int hs);
+
+typedef struct
+{
+    resample_row_func resample;
+    stbi_uc *line0, *line1;
+    int hs, vs;   // expansion factor in each axis
+    int x0;      // first pre-expansion pixel resampled
+    int w_lores; // horizontal pixels pre-expansion, from x0
+    int ystep;   // how far through vertical expansion we are
+    int ypos;    // which pre-expansion row we're on
+    int lines;   // pre-expansion rows
+} stbi__resample;
+
 typedef struct
 {
     stbi__context *s;
@@ -1750,6 +3172,7 @@ typedef struct
         int dc_pred;
 
         int x, y, w2, h2;
+        int plane_h;      // rows data holds: h2, or a few MCU rows when streaming
         stbi_uc *data;
         void *raw_data, *raw_coeff;
         stbi_uc *linebuf;
@@ -1772,6 +3195,19 @@ typedef struct
 
     int scan_n, order[4];
     int restart_interval, todo;
+    int scale_shift;   // log2 of scale_denom; blocks decode to (8 >> scale_shift) pixels square
+
+    // resampling and color conversion, set up by stbi__jpeg_output_begin
+    // so rows can go out while the scan is still decoding (stbi_load_bands)
+    stbi__resample res_comp[4];
+    int req_comp, out_n, decode_n, out_ready;
+    stbi__uint32 out_w, out_h;  // the output: the crop, or the whole scaled image
+    stbi__uint32 out_row;       // next row of the scaled image to resample
+    int crop_x, crop_y;         // where the output is in the scaled image
+    int mcu_x0, mcu_x1, mcu_y0, mcu_y1; // MCUs that get an IDCT; the rest are only entropy decoded
+    stbi_uc *output, *rowbuf;
+    int stream;        // component planes are rings of three MCU rows
+    int mcu_row_base;  // MCU row at the top of the planes
 
     // kernels
     void(*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -1976,8 +3412,66 @@ static stbi_uc stbi__jpeg_dezigzag[64 + 15] =
     63, 63, 63, 63, 63, 63, 63
 };
 
-// decode one 64-entry block--
-static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi_uc *dequant)
+// decode one 64-entry block--
+static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi_uc *dequant)
+{
+    int diff, dc, k;
+    int t;
+
+    if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
+    t = stbi__jpeg_huff_decode(j, hdc);
+    if (t < 0) return stbi__err("bad huffman code", "Corrupt JPEG");
+
+    // 0 all the ac values now so we can do it 32-bits at a time
+    memset(data, 0, 64 * sizeof(data[0]));
+
+    diff = t ? stbi__extend_receive(j, t) : 0;
+    dc = j->img_comp[b].dc_pred + diff;
+    j->img_comp[b].dc_pred = dc;
+    data[0] = (short)(dc * dequant[0]);
+
+    // decode AC components, see JPEG spec
+    k = 1;
+    do {
+        unsigned int zig;
+        int c, r, s;
+        if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
+        c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
+        r = fac[c];
+        if (r) { // fast-AC path
+            k += (r >> 4) & 15; // run
+            s = r & 15; // combined length
+            j->code_buffer <<= s;
+            j->code_bits -= s;
+            // decode into unzigzag'd location
+            zig = stbi__jpeg_dezigzag[k++];
+            data[zig] = (short)((r >> 8) * dequant[zig]);
+        }
+        else {
+            int rs = stbi__jpeg_huff_decode(j, hac);
+            if (rs < 0) return stbi__err("bad huffman code", "Corrupt JPEG");
+            s = rs & 15;
+            r = rs >> 4;
+            if (s == 0) {
+                if (rs != 0xf0) break; // end block
+                k += 16;
+            }
+            else {
+                k += r;
+                // decode into unzigzag'd location
+                zig = stbi__jpeg_dezigzag[k++];
+                data[zig] = (short)(stbi__extend_receive(j, s) * dequant[zig]);
+            }
+        }
+    } while (k < 64);
+    return 1;
+}
+
+// stbi__jpeg_decode_block for 1/8 scale, where stbi__idct_block_1x1 only
+// reads DC: the AC codes are still walked to stay in step with the stream,
+// but their values are skipped, not dequantized or stored, and data[1..63]
+// are left as they were
+static int stbi__jpeg_decode_block_dc_only(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi_uc *dequant)
 {
     int diff, dc, k;
     int t;
@@ -1986,30 +3480,20 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
     t = stbi__jpeg_huff_decode(j, hdc);
     if (t < 0) return stbi__err("bad huffman code", "Corrupt JPEG");
 
-    // 0 all the ac values now so we can do it 32-bits at a time
-    memset(data, 0, 64 * sizeof(data[0]));
-
     diff = t ? stbi__extend_receive(j, t) : 0;
     dc = j->img_comp[b].dc_pred + diff;
     j->img_comp[b].dc_pred = dc;
     data[0] = (short)(dc * dequant[0]);
 
-    // decode AC components, see JPEG spec
     k = 1;
     do {
-        unsigned int zig;
         int c, r, s;
         if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
         c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
         r = fac[c];
-        if (r) { // fast-AC path
-            k += (r >> 4) & 15; // run
-            s = r & 15; // combined length
-            j->code_buffer <<= s;
-            j->code_bits -= s;
-            // decode into unzigzag'd location
-            zig = stbi__jpeg_dezigzag[k++];
-            data[zig] = (short)((r >> 8) * dequant[zig]);
+        if (r) { // fast-AC path: code and value bits in one go
+            k += ((r >> 4) & 15) + 1;
+            s = r & 15;
         }
         else {
             int rs = stbi__jpeg_huff_decode(j, hac);
@@ -2019,18 +3503,28 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
             if (s == 0) {
                 if (rs != 0xf0) break; // end block
                 k += 16;
+                continue;
             }
-            else {
-                k += r;
-                // decode into unzigzag'd location
-                zig = stbi__jpeg_dezigzag[k++];
-                data[zig] = (short)(stbi__extend_receive(j, s) * dequant[zig]);
-            }
+            k += r + 1;
+            if (j->code_bits < s) stbi__grow_buffer_unsafe(j);
         }
+        j->code_buffer <<= s;
+        j->code_bits -= s;
     } while (k < 64);
     return 1;
 }
 
+// one block of component n of a baseline scan, DC only at 1/8 scale
+stbi_inline static int stbi__jpeg_decode_block_scaled(stbi__jpeg *z, short data[64], int n)
+{
+    int ha = z->img_comp[n].ha;
+    stbi__huffman *hdc = z->huff_dc + z->img_comp[n].hd;
+    stbi_uc *dequant = z->dequant[z->img_comp[n].tq];
+    if (z->scale_shift == 3)
+        return stbi__jpeg_decode_block_dc_only(z, data, hdc, z->huff_ac + ha, z->fast_ac[ha], n, dequant);
+    return stbi__jpeg_decode_block(z, data, hdc, z->huff_ac + ha, z->fast_ac[ha], n, dequant);
+}
+
 static int stbi__jpeg_decode_block_prog_dc(stbi__jpeg *j, short data[64], stbi__huffman *hdc, int b)
 {
     int diff, dc;
@@ -2297,6 +3791,99 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
     }
 }
 
+// Reduced IDCTs for stbi_load_options::scale_denom, after jidctred.c in
+// the IJG library. Each output pixel is the mean of the 2x2 (4x4, 8x8)
+// pixels the full IDCT would produce there; for that, the even rows and
+// columns other than DC (just 4 for the 4x4 case) drop out, so those are
+// never read. Same 12-bit constants and scaling as stbi__idct_block.
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+    int i, val[32], *v = val;
+    stbi_uc *o;
+    short *d = data;
+
+    // columns, into 4 rows
+    for (i = 0; i < 8; ++i, ++d, ++v) {
+        int t0, t2, t10, t12;
+        if (i == 4) continue;
+        if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0) {
+            v[0] = v[8] = v[16] = v[24] = d[0] * 4;
+            continue;
+        }
+        // even part
+        t0 = d[0] * 8192;
+        t2 = d[16] * stbi__f2f(1.847759065f) - d[48] * stbi__f2f(0.765366865f);
+        t10 = t0 + t2;
+        t12 = t0 - t2;
+        // odd part
+        t0 = d[56] * -stbi__f2f(0.211164243f) + d[40] * stbi__f2f(1.451774981f)
+           + d[24] * -stbi__f2f(2.172734803f) + d[8] * stbi__f2f(1.061594337f);
+        t2 = d[56] * -stbi__f2f(0.509795579f) + d[40] * -stbi__f2f(0.601344887f)
+           + d[24] * stbi__f2f(0.899976223f) + d[8] * stbi__f2f(2.562915447f);
+        // constants scaled by 1<<12 and the even part by another 2; keep 2 extra bits like stbi__idct_block
+        v[0] = (t10 + t2 + 1024) >> 11;
+        v[24] = (t10 - t2 + 1024) >> 11;
+        v[8] = (t12 + t0 + 1024) >> 11;
+        v[16] = (t12 - t0 + 1024) >> 11;
+    }
+
+    for (i = 0, v = val, o = out; i < 4; ++i, v += 8, o += out_stride) {
+        int t0, t2, t10, t12;
+        t0 = v[0] * 8192;
+        t2 = v[2] * stbi__f2f(1.847759065f) - v[6] * stbi__f2f(0.765366865f);
+        t10 = t0 + t2;
+        t12 = t0 - t2;
+        t0 = v[7] * -stbi__f2f(0.211164243f) + v[5] * stbi__f2f(1.451774981f)
+           + v[3] * -stbi__f2f(2.172734803f) + v[1] * stbi__f2f(1.061594337f);
+        t2 = v[7] * -stbi__f2f(0.509795579f) + v[5] * -stbi__f2f(0.601344887f)
+           + v[3] * stbi__f2f(0.899976223f) + v[1] * stbi__f2f(2.562915447f);
+        // 1<<13 from the constants, 1<<2 from the first pass, 1<<3 from the
+        // two passes together; round, and add 128 before the shift
+        t10 += (1 << 17) + (128 << 18);
+        t12 += (1 << 17) + (128 << 18);
+        o[0] = stbi__clamp((t10 + t2) >> 18);
+        o[3] = stbi__clamp((t10 - t2) >> 18);
+        o[1] = stbi__clamp((t12 + t0) >> 18);
+        o[2] = stbi__clamp((t12 - t0) >> 18);
+    }
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+    int i, val[16], *v = val;
+    short *d = data;
+
+    // columns 0, 1, 3, 5 and 7, into 2 rows
+    for (i = 0; i < 8; ++i, ++d, ++v) {
+        int t0, t10;
+        if (i == 2 || i == 4 || i == 6) continue;
+        if (d[8] == 0 && d[24] == 0 && d[40] == 0 && d[56] == 0) {
+            v[0] = v[8] = d[0] * 4;
+            continue;
+        }
+        t10 = d[0] * 16384;
+        t0 = d[56] * -stbi__f2f(0.720959822f) + d[40] * stbi__f2f(0.850430095f)
+           + d[24] * -stbi__f2f(1.272758580f) + d[8] * stbi__f2f(3.624509785f);
+        v[0] = (t10 + t0 + 2048) >> 12;
+        v[8] = (t10 - t0 + 2048) >> 12;
+    }
+
+    for (i = 0, v = val; i < 2; ++i, v += 8, out += out_stride) {
+        int t0, t10;
+        t10 = v[0] * 16384 + (1 << 18) + (128 << 19);
+        t0 = v[7] * -stbi__f2f(0.720959822f) + v[5] * stbi__f2f(0.850430095f)
+           + v[3] * -stbi__f2f(1.272758580f) + v[1] * stbi__f2f(3.624509785f);
+        out[0] = stbi__clamp((t10 + t0) >> 19);
+        out[1] = stbi__clamp((t10 - t0) >> 19);
+    }
+}
+
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+    STBI_NOTUSED(out_stride);
+    out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2476,6 +4063,310 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 #undef dct_pass
 }
 
+// SSE2 versions of stbi__idct_block_4x4 and _2x2. The first pass runs on
+// all 8 columns at once (the ones the C versions skip are computed and
+// ignored), the second on the transposed rows. Like stbi__idct_simd, the
+// first pass is saturated to 16 bits, which valid data never reaches, so
+// the results match the C versions.
+#define dct_const(x,y)  _mm_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y))
+// 32-bit x << s from the low (or high) 4 shorts of v
+#define dct_widen_lo(v,s)  _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (v)), 16 - (s))
+#define dct_widen_hi(v,s)  _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (v)), 16 - (s))
+
+static void stbi__idct_4x4_sse2(stbi_uc *out, int out_stride, short data[64])
+{
+    __m128i c_even = dct_const(stbi__f2f(1.847759065f), -stbi__f2f(0.765366865f));
+    __m128i c_t0_75 = dct_const(-stbi__f2f(0.211164243f), stbi__f2f(1.451774981f));
+    __m128i c_t0_31 = dct_const(-stbi__f2f(2.172734803f), stbi__f2f(1.061594337f));
+    __m128i c_t2_75 = dct_const(-stbi__f2f(0.509795579f), -stbi__f2f(0.601344887f));
+    __m128i c_t2_31 = dct_const(stbi__f2f(0.899976223f), stbi__f2f(2.562915447f));
+    __m128i bias_1 = _mm_set1_epi32(1024);
+    __m128i bias_2 = _mm_set1_epi32((1 << 17) + (128 << 18));
+    __m128i d0, d1, d2, d3, d5, d6, d7, r[4], x01, x23, x45, x67, e, o75, o31, t10, t12, t0, t2, p02, p13;
+    int i, px;
+
+    d0 = _mm_load_si128((const __m128i *) (data + 0 * 8));
+    d1 = _mm_load_si128((const __m128i *) (data + 1 * 8));
+    d2 = _mm_load_si128((const __m128i *) (data + 2 * 8));
+    d3 = _mm_load_si128((const __m128i *) (data + 3 * 8));
+    d5 = _mm_load_si128((const __m128i *) (data + 5 * 8));
+    d6 = _mm_load_si128((const __m128i *) (data + 6 * 8));
+    d7 = _mm_load_si128((const __m128i *) (data + 7 * 8));
+
+    // columns, into 4 rows of 8; one half of the columns at a time
+    {
+        __m128i v[2][4];
+        for (i = 0; i < 2; ++i) {
+            if (i == 0) {
+                e = _mm_unpacklo_epi16(d2, d6);
+                o75 = _mm_unpacklo_epi16(d7, d5);
+                o31 = _mm_unpacklo_epi16(d3, d1);
+                t0 = dct_widen_lo(d0, 13);
+            }
+            else {
+                e = _mm_unpackhi_epi16(d2, d6);
+                o75 = _mm_unpackhi_epi16(d7, d5);
+                o31 = _mm_unpackhi_epi16(d3, d1);
+                t0 = dct_widen_hi(d0, 13);
+            }
+            t2 = _mm_madd_epi16(e, c_even);
+            t10 = _mm_add_epi32(_mm_add_epi32(t0, t2), bias_1);
+            t12 = _mm_add_epi32(_mm_sub_epi32(t0, t2), bias_1);
+            t0 = _mm_add_epi32(_mm_madd_epi16(o75, c_t0_75), _mm_madd_epi16(o31, c_t0_31));
+            t2 = _mm_add_epi32(_mm_madd_epi16(o75, c_t2_75), _mm_madd_epi16(o31, c_t2_31));
+            v[i][0] = _mm_srai_epi32(_mm_add_epi32(t10, t2), 11);
+            v[i][3] = _mm_srai_epi32(_mm_sub_epi32(t10, t2), 11);
+            v[i][1] = _mm_srai_epi32(_mm_add_epi32(t12, t0), 11);
+            v[i][2] = _mm_srai_epi32(_mm_sub_epi32(t12, t0), 11);
+        }
+        for (i = 0; i < 4; ++i)
+            r[i] = _mm_packs_epi32(v[0][i], v[1][i]);
+    }
+
+    // transpose: xab holds columns a and b, 4 rows each
+    e = _mm_unpacklo_epi16(r[0], r[1]);
+    t0 = _mm_unpacklo_epi16(r[2], r[3]);
+    x01 = _mm_unpacklo_epi32(e, t0);
+    x23 = _mm_unpackhi_epi32(e, t0);
+    e = _mm_unpackhi_epi16(r[0], r[1]);
+    t0 = _mm_unpackhi_epi16(r[2], r[3]);
+    x45 = _mm_unpacklo_epi32(e, t0);
+    x67 = _mm_unpackhi_epi32(e, t0);
+
+    // rows, one per lane
+    t0 = dct_widen_lo(x01, 13);
+    t2 = _mm_madd_epi16(_mm_unpacklo_epi16(x23, x67), c_even);
+    t10 = _mm_add_epi32(_mm_add_epi32(t0, t2), bias_2);
+    t12 = _mm_add_epi32(_mm_sub_epi32(t0, t2), bias_2);
+    o75 = _mm_unpackhi_epi16(x67, x45);
+    o31 = _mm_unpackhi_epi16(x23, x01);
+    t0 = _mm_add_epi32(_mm_madd_epi16(o75, c_t0_75), _mm_madd_epi16(o31, c_t0_31));
+    t2 = _mm_add_epi32(_mm_madd_epi16(o75, c_t2_75), _mm_madd_epi16(o31, c_t2_31));
+
+    // pixels 0 and 2, 1 and 3 of every row; clamp, then turn into one row per lane
+    p02 = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(t10, t2), 18), _mm_srai_epi32(_mm_sub_epi32(t12, t0), 18));
+    p13 = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(t12, t0), 18), _mm_srai_epi32(_mm_sub_epi32(t10, t2), 18));
+    e = _mm_packus_epi16(p02, p13);
+    e = _mm_unpacklo_epi8(e, _mm_srli_si128(e, 8));
+    e = _mm_unpacklo_epi16(e, _mm_srli_si128(e, 8));
+    for (i = 0; i < 4; ++i, out += out_stride) {
+        px = _mm_cvtsi128_si32(e);
+        memcpy(out, &px, 4);
+        e = _mm_srli_si128(e, 4);
+    }
+}
+
+static void stbi__idct_2x2_sse2(stbi_uc *out, int out_stride, short data[64])
+{
+    __m128i c_75 = dct_const(-stbi__f2f(0.720959822f), stbi__f2f(0.850430095f));
+    __m128i c_31 = dct_const(-stbi__f2f(1.272758580f), stbi__f2f(3.624509785f));
+    __m128i bias_1 = _mm_set1_epi32(2048);
+    __m128i d0, d1, d3, d5, d7, o75, o31, t10, t0, lo[2], hi[2], a, b;
+    int px;
+
+    d0 = _mm_load_si128((const __m128i *) (data + 0 * 8));
+    d1 = _mm_load_si128((const __m128i *) (data + 1 * 8));
+    d3 = _mm_load_si128((const __m128i *) (data + 3 * 8));
+    d5 = _mm_load_si128((const __m128i *) (data + 5 * 8));
+    d7 = _mm_load_si128((const __m128i *) (data + 7 * 8));
+
+    // columns, into 2 rows of 8
+    o75 = _mm_unpacklo_epi16(d7, d5);
+    o31 = _mm_unpacklo_epi16(d3, d1);
+    t10 = _mm_add_epi32(dct_widen_lo(d0, 14), bias_1);
+    t0 = _mm_add_epi32(_mm_madd_epi16(o75, c_75), _mm_madd_epi16(o31, c_31));
+    lo[0] = _mm_srai_epi32(_mm_add_epi32(t10, t0), 12);
+    lo[1] = _mm_srai_epi32(_mm_sub_epi32(t10, t0), 12);
+    o75 = _mm_unpackhi_epi16(d7, d5);
+    o31 = _mm_unpackhi_epi16(d3, d1);
+    t10 = _mm_add_epi32(dct_widen_hi(d0, 14), bias_1);
+    t0 = _mm_add_epi32(_mm_madd_epi16(o75, c_75), _mm_madd_epi16(o31, c_31));
+    hi[0] = _mm_srai_epi32(_mm_add_epi32(t10, t0), 12);
+    hi[1] = _mm_srai_epi32(_mm_sub_epi32(t10, t0), 12);
+    a = _mm_packs_epi32(lo[0], hi[0]);
+    b = _mm_packs_epi32(lo[1], hi[1]);
+
+    // rows: columns 0-3 and 4-7 of both rows side by side, so that the
+    // multiply-adds leave each row's two halves of the sum in adjacent lanes
+    {
+        __m128i c03 = _mm_unpacklo_epi64(a, b), c47 = _mm_unpackhi_epi64(a, b);
+        t10 = _mm_madd_epi16(c03, _mm_setr_epi16(16384, 0, 0, 0, 16384, 0, 0, 0));
+        t10 = _mm_add_epi32(t10, _mm_set1_epi32((1 << 18) + (128 << 19)));
+        t0 = _mm_add_epi32(_mm_madd_epi16(c03, _mm_setr_epi16(0, stbi__f2f(3.624509785f), 0, -stbi__f2f(1.272758580f), 0, stbi__f2f(3.624509785f), 0, -stbi__f2f(1.272758580f))),
+                           _mm_madd_epi16(c47, _mm_setr_epi16(0, stbi__f2f(0.850430095f), 0, -stbi__f2f(0.720959822f), 0, stbi__f2f(0.850430095f), 0, -stbi__f2f(0.720959822f))));
+        t0 = _mm_add_epi32(t0, _mm_shuffle_epi32(t0, _MM_SHUFFLE(2, 3, 0, 1)));
+        // lanes 0 and 2 hold rows 0 and 1
+        a = _mm_srai_epi32(_mm_add_epi32(t10, t0), 19);
+        b = _mm_srai_epi32(_mm_sub_epi32(t10, t0), 19);
+        a = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+        a = _mm_packs_epi32(a, a);
+        px = _mm_cvtsi128_si32(_mm_packus_epi16(a, a));
+    }
+    out[0] = (stbi_uc) px;
+    out[1] = (stbi_uc) (px >> 8);
+    out[out_stride] = (stbi_uc) (px >> 16);
+    out[out_stride + 1] = (stbi_uc) (px >> 24);
+}
+
+#undef dct_const
+#undef dct_widen_lo
+#undef dct_widen_hi
+
+#ifdef STBI_AVX2
+// stbi__idct_simd with the 32-bit intermediates in one 8-lane register per
+// row instead of two halves, which halves the multiply-add and butterfly
+// work. The transposes stay 128-bit. Bit-identical to stbi__idct_block.
+static STBI__AVX2_TARGET void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[64])
+{
+    __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+    __m128i tmp;
+
+    // dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_set1_epi32((int)(((unsigned)(y) << 16) | ((unsigned)(x) & 0xffff)))
+
+    // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+    // out(1) = c1[even]*x + c1[odd]*y
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+    // out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+    // butterfly a/b, add bias, then shift by "s" and pack
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum, dif), 0xd8); \
+         out0 = _mm256_castsi256_si128(packed); \
+         out1 = _mm256_extracti128_si256(packed, 1); \
+      }
+
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+    __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+    __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+    __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+    __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+    __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+    __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+    __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+    __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+    // rounding biases in column/row passes, see stbi__idct_block for explanation.
+    __m256i bias_0 = _mm256_set1_epi32(512);
+    __m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+    // load
+    row0 = _mm_load_si128((const __m128i *) (data + 0 * 8));
+    row1 = _mm_load_si128((const __m128i *) (data + 1 * 8));
+    row2 = _mm_load_si128((const __m128i *) (data + 2 * 8));
+    row3 = _mm_load_si128((const __m128i *) (data + 3 * 8));
+    row4 = _mm_load_si128((const __m128i *) (data + 4 * 8));
+    row5 = _mm_load_si128((const __m128i *) (data + 5 * 8));
+    row6 = _mm_load_si128((const __m128i *) (data + 6 * 8));
+    row7 = _mm_load_si128((const __m128i *) (data + 7 * 8));
+
+    // column pass
+    dct_pass(bias_0, 10);
+
+    {
+        // 16bit 8x8 transpose
+        dct_interleave16(row0, row4);
+        dct_interleave16(row1, row5);
+        dct_interleave16(row2, row6);
+        dct_interleave16(row3, row7);
+
+        dct_interleave16(row0, row2);
+        dct_interleave16(row1, row3);
+        dct_interleave16(row4, row6);
+        dct_interleave16(row5, row7);
+
+        dct_interleave16(row0, row1);
+        dct_interleave16(row2, row3);
+        dct_interleave16(row4, row5);
+        dct_interleave16(row6, row7);
+    }
+
+    // row pass
+    dct_pass(bias_1, 17);
+
+    {
+        // pack, then 8bit 8x8 transpose
+        __m128i p0 = _mm_packus_epi16(row0, row1);
+        __m128i p1 = _mm_packus_epi16(row2, row3);
+        __m128i p2 = _mm_packus_epi16(row4, row5);
+        __m128i p3 = _mm_packus_epi16(row6, row7);
+
+        dct_interleave8(p0, p2);
+        dct_interleave8(p1, p3);
+
+        dct_interleave8(p0, p1);
+        dct_interleave8(p2, p3);
+
+        dct_interleave8(p0, p2);
+        dct_interleave8(p1, p3);
+
+        _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+        _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+        _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+        _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+        _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+    }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+#endif // STBI_AVX2
+
 #endif // STBI_SSE2
 
 #ifdef STBI_NEON
@@ -2701,87 +4592,350 @@ static stbi_uc stbi__get_marker(stbi__jpeg *j)
     return x;
 }
 
-// in each scan, we'll have scan_n components, and the order
-// of the components is specified by order[]
-#define STBI__RESTART(x)     ((x) >= 0xd0 && (x) <= 0xd7)
+// in each scan, we'll have scan_n components, and the order
+// of the components is specified by order[]
+#define STBI__RESTART(x)     ((x) >= 0xd0 && (x) <= 0xd7)
+
+// after a restart interval, stbi__jpeg_reset the entropy decoder and
+// the dc prediction
+static void stbi__jpeg_reset(stbi__jpeg *j)
+{
+    j->code_bits = 0;
+    j->code_buffer = 0;
+    j->nomore = 0;
+    j->img_comp[0].dc_pred = j->img_comp[1].dc_pred = j->img_comp[2].dc_pred = 0;
+    j->marker = STBI__MARKER_none;
+    j->todo = j->restart_interval ? j->restart_interval : 0x7fffffff;
+    j->eob_run = 0;
+    // no more than 1<<31 MCUs if no restart_interal? that's plenty safe,
+    // since we don't even allow 1<<30 pixels
+}
+
+// decodes baseline MCUs [first, last) of the current scan, carrying on
+// from the entropy decoder's state. MCU row mcu_row_base goes to the top
+// of the component planes
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int first, int last)
+{
+    int m;
+    STBI_SIMD_ALIGN(short, data[64]);
+    if (z->scan_n == 1) {
+        int n = z->order[0];
+        // non-interleaved data, we just need to process one block at a time,
+        // in trivial scanline order
+        // number of blocks to do just depends on how many actual "pixels" this
+        // component has, independent of interleaved MCU blocking and such
+        int w = (z->img_comp[n].x + 7) >> 3;
+        int i = first % w, j = first / w;
+        int bx0 = z->mcu_x0 * z->img_comp[n].h, bx1 = z->mcu_x1 * z->img_comp[n].h;
+        int by0 = z->mcu_y0 * z->img_comp[n].v, by1 = z->mcu_y1 * z->img_comp[n].v;
+        for (m = first; m < last; ++m) {
+            if (!stbi__jpeg_decode_block_scaled(z, data, n)) return 0;
+            if (i >= bx0 && i < bx1 && j >= by0 && j < by1)
+                z->idct_block_kernel(z->img_comp[n].data + ((z->img_comp[n].w2*(j - z->mcu_row_base) * 8 + i * 8) >> z->scale_shift), z->img_comp[n].w2, data);
+            // every data block is an MCU, so countdown the restart interval
+            if (--z->todo <= 0) {
+                if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+                // if it's NOT a restart, then just bail, so we get corrupt data
+                // rather than no data
+                if (!STBI__RESTART(z->marker)) return 1;
+                stbi__jpeg_reset(z);
+            }
+            if (++i == w) { i = 0; ++j; }
+        }
+        return 1;
+    }
+    else { // interleaved
+        int k, x, y;
+        int i = first % z->img_mcu_x, j = first / z->img_mcu_x;
+        for (m = first; m < last; ++m) {
+            int idct = i >= z->mcu_x0 && i < z->mcu_x1 && j >= z->mcu_y0 && j < z->mcu_y1;
+            // scan an interleaved mcu... process scan_n components in order
+            for (k = 0; k < z->scan_n; ++k) {
+                int n = z->order[k];
+                // scan out an mcu's worth of this component; that's just determined
+                // by the basic H and V specified for the component
+                for (y = 0; y < z->img_comp[n].v; ++y) {
+                    for (x = 0; x < z->img_comp[n].h; ++x) {
+                        int x2 = ((i*z->img_comp[n].h + x) * 8) >> z->scale_shift;
+                        int y2 = (((j - z->mcu_row_base)*z->img_comp[n].v + y) * 8) >> z->scale_shift;
+                        if (!stbi__jpeg_decode_block_scaled(z, data, n)) return 0;
+                        if (idct)
+                            z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
+                    }
+                }
+            }
+            // after all interleaved components, that's an interleaved MCU,
+            // so now count down the restart interval
+            if (--z->todo <= 0) {
+                if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+                if (!STBI__RESTART(z->marker)) return 1;
+                stbi__jpeg_reset(z);
+            }
+            if (++i == z->img_mcu_x) { i = 0; ++j; }
+        }
+        return 1;
+    }
+}
+
+static int stbi__jpeg_mcu_count(stbi__jpeg *z)
+{
+    if (z->scan_n == 1) {
+        int n = z->order[0];
+        return ((z->img_comp[n].x + 7) >> 3) * ((z->img_comp[n].y + 7) >> 3);
+    }
+    return z->img_mcu_x * z->img_mcu_y;
+}
+
+// the MCUs [*first, *last) of the scan that hold the crop's MCU rows; the
+// ones after them only need skipping, the ones before only need decoding
+// for the DC predictors and bit state
+static void stbi__jpeg_scan_window(stbi__jpeg *z, int *first, int *last)
+{
+    int count = stbi__jpeg_mcu_count(z);
+    if (z->scan_n == 1) {
+        int n = z->order[0];
+        int w = (z->img_comp[n].x + 7) >> 3;
+        *first = z->mcu_y0 * z->img_comp[n].v * w;
+        *last = z->mcu_y1 * z->img_comp[n].v * w;
+    }
+    else {
+        *first = z->mcu_y0 * z->img_mcu_x;
+        *last = z->mcu_y1 * z->img_mcu_x;
+    }
+    if (*first > count) *first = count;
+    if (*last > count) *last = count;
+}
+
+// Jumps over the restart intervals that end before MCU first, straight to
+// the RSTn marker that starts the one holding it, and returns the MCU the
+// decoder is at. Memory input only; anything unexpected leaves the stream
+// at the start of the scan.
+static int stbi__jpeg_skip_intervals(stbi__jpeg *z, int first)
+{
+    stbi__context *s = z->s;
+    stbi_uc *q;
+    int skip, rst = 0, i;
+    if (s->read_from_callbacks || z->restart_interval <= 0)
+        return 0;
+    // the 4th component's DC predictor is not reset at restarts
+    for (i = 0; i < z->scan_n; ++i)
+        if (z->order[i] > 2)
+            return 0;
+    skip = first / z->restart_interval;
+    if (skip == 0)
+        return 0;
+    for (q = s->img_buffer; q + 1 < s->img_buffer_end; ++q) {
+        if (q[0] != 0xff || q[1] == 0x00) continue;
+        if (!STBI__RESTART(q[1]) || q[1] != 0xd0 + (rst & 7)) return 0;
+        if (++rst == skip) {
+            s->img_buffer = q + 2;
+            stbi__jpeg_reset(z);
+            return skip * z->restart_interval;
+        }
+        ++q;
+    }
+    return 0;
+}
+
+// Moves the stream past the rest of the scan's entropy-coded data, restart
+// markers included, once the MCUs the crop needs are in; the marker after
+// it is left pending for stbi__get_marker
+static void stbi__jpeg_skip_entropy_coded_data(stbi__jpeg *z)
+{
+    stbi__context *s = z->s;
+    int x;
+    if (z->marker != STBI__MARKER_none && !STBI__RESTART(z->marker))
+        return;
+    z->marker = STBI__MARKER_none;
+    while (!stbi__at_eof(s)) {
+        if (!s->read_from_callbacks) {
+            stbi_uc *q = (stbi_uc *)memchr(s->img_buffer, 0xff, s->img_buffer_end - s->img_buffer);
+            s->img_buffer = q ? q : s->img_buffer_end;
+            if (!q) break;
+        }
+        if (stbi__get8(s) != 0xff) continue;
+        do x = stbi__get8(s); while (x == 0xff);
+        if (x != 0x00 && !STBI__RESTART(x)) {
+            z->marker = (stbi_uc)x;
+            return;
+        }
+    }
+}
+
+#ifdef STBI__ATOMICS
+// Parallel restart interval decoding. The scan is indexed up front: every
+// RSTn marker starts an interval that decodes with fresh huffman bit state
+// and DC predictors, so runs of intervals go to separate tasks, each on
+// its own copy of the decoder. The last run uses z itself, which leaves
+// z and its stream exactly where the serial loop would. Only the intervals
+// that overlap the MCUs a crop needs are indexed and decoded.
+#ifndef STBI_JPEG_MAX_TASKS
+#define STBI_JPEG_MAX_TASKS 32
+#endif
+
+typedef struct
+{
+    stbi__jpeg *z;
+    stbi__jpeg *copies;       // tasks - 1 decoders, the last task uses z
+    stbi__context *contexts;
+    stbi_uc **interval_start; // where each restart interval's entropy data begins
+    int first_interval;       // the scan's interval that interval_start[0] begins
+    int intervals, tasks, mcus; // decoding stops at MCU mcus
+    volatile long failed;     // set by any task that did not end where the serial decoder would
+} stbi__jpeg_parallel;
+
+static void stbi__jpeg_parallel_task(void *task_data, int t)
+{
+    stbi__jpeg_parallel *p = (stbi__jpeg_parallel *)task_data;
+    // task t decodes restart intervals [first, last)
+    int first = (int)((long long)t * p->intervals / p->tasks);
+    int last = (int)((long long)(t + 1) * p->intervals / p->tasks);
+    int r = p->z->restart_interval;
+    stbi__jpeg *j = t == p->tasks - 1 ? p->z : &p->copies[t];
+    j->s->img_buffer = p->interval_start[first];
+    stbi__jpeg_reset(j);
+    if (!stbi__jpeg_decode_mcus(j, (p->first_interval + first) * r, last < p->intervals ? (p->first_interval + last) * r : p->mcus)) {
+        stbi__atomic_store(&p->failed, 1);
+        return;
+    }
+    // the serial decoder would be just past the next RST marker now, unless
+    // it bailed at a missing restart
+    if (last < p->intervals && j->s->img_buffer != p->interval_start[last])
+        stbi__atomic_store(&p->failed, 1);
+}
+
+// returns 1 if MCUs [first, last) of the scan were decoded, 0 if the caller
+// should decode them serially
+static int stbi__jpeg_decode_mcus_parallel(stbi__jpeg *z, int first, int last)
+{
+    stbi__context *s = z->s;
+    stbi__jpeg_parallel p;
+    stbi_uc *scan = s->img_buffer, *q;
+    int rst = 0, i, ok;
+
+    if (!s->opt.parallel_for || s->read_from_callbacks || z->restart_interval <= 0)
+        return 0;
+    // the 4th component's DC predictor is not reset at restarts, so its intervals aren't independent
+    for (i = 0; i < z->scan_n; ++i)
+        if (z->order[i] > 2)
+            return 0;
+    p.mcus = last;
+    p.first_interval = first / z->restart_interval;
+    p.intervals = (last + z->restart_interval - 1) / z->restart_interval - p.first_interval;
+    if (p.intervals < 2)
+        return 0;
+
+    // index the restart markers; anything unexpected goes to the serial path
+    p.interval_start = (stbi_uc **)stbi__scratch_malloc(s->arena, sizeof(stbi_uc *) * p.intervals);
+    if (!p.interval_start)
+        return 0;
+    if (p.first_interval == 0)
+        p.interval_start[0] = scan;
+    for (q = scan; rst < p.first_interval + p.intervals - 1 && q + 1 < s->img_buffer_end; ++q) {
+        if (q[0] != 0xff || q[1] == 0x00) continue;
+        if (!STBI__RESTART(q[1]) || q[1] != 0xd0 + (rst & 7)) break;
+        if (++rst >= p.first_interval)
+            p.interval_start[rst - p.first_interval] = q + 2;
+        ++q;
+    }
+    if (rst != p.first_interval + p.intervals - 1) {
+        stbi__free(p.interval_start);
+        return 0;
+    }
+
+    p.tasks = p.intervals < STBI_JPEG_MAX_TASKS ? p.intervals : STBI_JPEG_MAX_TASKS;
+    p.z = z;
+    p.failed = 0;
+    p.copies = (stbi__jpeg *)stbi__scratch_malloc(s->arena, sizeof(stbi__jpeg) * (p.tasks - 1));
+    p.contexts = (stbi__context *)stbi__scratch_malloc(s->arena, sizeof(stbi__context) * (p.tasks - 1));
+    if (!p.copies || !p.contexts) {
+        stbi__free(p.copies);
+        stbi__free(p.contexts);
+        stbi__free(p.interval_start);
+        return 0;
+    }
+    for (i = 0; i < p.tasks - 1; ++i) {
+        p.copies[i] = *z;
+        p.contexts[i] = *s;
+        p.copies[i].s = &p.contexts[i];
+    }
+
+    s->opt.parallel_for(s->opt.parallel_user, p.tasks, stbi__jpeg_parallel_task, &p);
+
+    ok = !stbi__atomic_load(&p.failed);
+    if (!ok) {
+        // corrupt or unusual stream: redo it serially, errors included, from
+        // where the last task's decoder state doesn't leak in
+        s->img_buffer = scan;
+        stbi__jpeg_reset(z);
+    }
+    stbi__free(p.copies);
+    stbi__free(p.contexts);
+    stbi__free(p.interval_start);
+    return ok;
+}
+#else
+static int stbi__jpeg_decode_mcus_parallel(stbi__jpeg *z, int first, int last)
+{
+    STBI_NOTUSED(z);
+    STBI_NOTUSED(first);
+    STBI_NOTUSED(last);
+    return 0;
+}
+#endif
+
+static int stbi__jpeg_alloc_planes(stbi__jpeg *z, int stream);
+static int stbi__jpeg_output_begin(stbi__jpeg *z);
+static int stbi__jpeg_output_rows(stbi__jpeg *z, stbi__uint32 end);
 
-// after a restart interval, stbi__jpeg_reset the entropy decoder and
-// the dc prediction
-static void stbi__jpeg_reset(stbi__jpeg *j)
+// Band decoding of a scan that has every component: MCU rows go round
+// three plane slots, and once row m is in, the output rows of m - 1 can
+// go out (upsampling them reads the last row of m - 2 and the first of m).
+// A single-component scan works the same by rows of blocks.
+static int stbi__jpeg_decode_streamed(stbi__jpeg *z)
 {
-    j->code_bits = 0;
-    j->code_buffer = 0;
-    j->nomore = 0;
-    j->img_comp[0].dc_pred = j->img_comp[1].dc_pred = j->img_comp[2].dc_pred = 0;
-    j->marker = STBI__MARKER_none;
-    j->todo = j->restart_interval ? j->restart_interval : 0x7fffffff;
-    j->eob_run = 0;
-    // no more than 1<<31 MCUs if no restart_interal? that's plenty safe,
-    // since we don't even allow 1<<30 pixels
+    int k, m, cols, rows, unit;
+    if (z->scan_n == 1) {
+        int n = z->order[0];
+        cols = (z->img_comp[n].x + 7) >> 3;
+        rows = (z->img_comp[n].y + 7) >> 3;
+        unit = 8;
+    }
+    else {
+        cols = z->img_mcu_x;
+        rows = z->img_mcu_y;
+        unit = z->img_mcu_h;
+    }
+    for (k = 0; k < z->s->img_n; ++k)
+        z->img_comp[k].plane_h = (3 * (z->scan_n == 1 ? 8 : z->img_comp[k].v * 8)) >> z->scale_shift;
+    if (!stbi__jpeg_output_begin(z)) return 0;
+    for (m = 0; m < rows; ++m) {
+        z->mcu_row_base = m - m % 3;
+        if (!stbi__jpeg_decode_mcus(z, m * cols, (m + 1) * cols)) return 0;
+        if (m > 0 && !stbi__jpeg_output_rows(z, (m * unit) >> z->scale_shift)) return 0;
+    }
+    return 1;
 }
 
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
     stbi__jpeg_reset(z);
+    if (z->stream) {
+        if (z->out_ready) return stbi__err("extra scan", "JPEG format not supported: scans after the image (with stbi_load_bands)");
+        if (z->scan_n == z->s->img_n)
+            return stbi__jpeg_decode_streamed(z);
+        // the first scan doesn't have every component; keep the whole planes
+        if (!stbi__jpeg_alloc_planes(z, 0)) return 0;
+    }
     if (!z->progressive) {
-        if (z->scan_n == 1) {
-            int i, j;
-            STBI_SIMD_ALIGN(short, data[64]);
-            int n = z->order[0];
-            // non-interleaved data, we just need to process one block at a time,
-            // in trivial scanline order
-            // number of blocks to do just depends on how many actual "pixels" this
-            // component has, independent of interleaved MCU blocking and such
-            int w = (z->img_comp[n].x + 7) >> 3;
-            int h = (z->img_comp[n].y + 7) >> 3;
-            for (j = 0; j < h; ++j) {
-                for (i = 0; i < w; ++i) {
-                    int ha = z->img_comp[n].ha;
-                    if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
-                    // every data block is an MCU, so countdown the restart interval
-                    if (--z->todo <= 0) {
-                        if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                        // if it's NOT a restart, then just bail, so we get corrupt data
-                        // rather than no data
-                        if (!STBI__RESTART(z->marker)) return 1;
-                        stbi__jpeg_reset(z);
-                    }
-                }
-            }
-            return 1;
-        }
-        else { // interleaved
-            int i, j, k, x, y;
-            STBI_SIMD_ALIGN(short, data[64]);
-            for (j = 0; j < z->img_mcu_y; ++j) {
-                for (i = 0; i < z->img_mcu_x; ++i) {
-                    // scan an interleaved mcu... process scan_n components in order
-                    for (k = 0; k < z->scan_n; ++k) {
-                        int n = z->order[k];
-                        // scan out an mcu's worth of this component; that's just determined
-                        // by the basic H and V specified for the component
-                        for (y = 0; y < z->img_comp[n].v; ++y) {
-                            for (x = 0; x < z->img_comp[n].h; ++x) {
-                                int x2 = (i*z->img_comp[n].h + x) * 8;
-                                int y2 = (j*z->img_comp[n].v + y) * 8;
-                                int ha = z->img_comp[n].ha;
-                                if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                                z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
-                            }
-                        }
-                    }
-                    // after all interleaved components, that's an interleaved MCU,
-                    // so now count down the restart interval
-                    if (--z->todo <= 0) {
-                        if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                        if (!STBI__RESTART(z->marker)) return 1;
-                        stbi__jpeg_reset(z);
-                    }
-                }
-            }
-            return 1;
-        }
+        int first, last;
+        stbi__jpeg_scan_window(z, &first, &last);
+        if (!stbi__jpeg_decode_mcus_parallel(z, first, last))
+            if (!stbi__jpeg_decode_mcus(z, stbi__jpeg_skip_intervals(z, first), last))
+                return 0;
+        if (last < stbi__jpeg_mcu_count(z))
+            stbi__jpeg_skip_entropy_coded_data(z);
+        return 1;
     }
     else {
         if (z->scan_n == 1) {
@@ -2863,11 +5017,15 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
         for (n = 0; n < z->s->img_n; ++n) {
             int w = (z->img_comp[n].x + 7) >> 3;
             int h = (z->img_comp[n].y + 7) >> 3;
-            for (j = 0; j < h; ++j) {
-                for (i = 0; i < w; ++i) {
+            // only the blocks of the MCUs under the crop
+            int i0 = z->mcu_x0 * z->img_comp[n].h, j0 = z->mcu_y0 * z->img_comp[n].v;
+            if (w > z->mcu_x1 * z->img_comp[n].h) w = z->mcu_x1 * z->img_comp[n].h;
+            if (h > z->mcu_y1 * z->img_comp[n].v) h = z->mcu_y1 * z->img_comp[n].v;
+            for (j = j0; j < h; ++j) {
+                for (i = i0; i < w; ++i) {
                     short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                     stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
+                    z->idct_block_kernel(z->img_comp[n].data + ((z->img_comp[n].w2*j * 8 + i * 8) >> z->scale_shift), z->img_comp[n].w2, data);
                 }
             }
         }
@@ -2984,23 +5142,66 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
     int i;
     for (i = 0; i < ncomp; ++i) {
         if (z->img_comp[i].raw_data) {
-            STBI_FREE(z->img_comp[i].raw_data);
+            stbi__free(z->img_comp[i].raw_data);
             z->img_comp[i].raw_data = NULL;
             z->img_comp[i].data = NULL;
         }
         if (z->img_comp[i].raw_coeff) {
-            STBI_FREE(z->img_comp[i].raw_coeff);
+            stbi__free(z->img_comp[i].raw_coeff);
             z->img_comp[i].raw_coeff = 0;
             z->img_comp[i].coeff = 0;
         }
         if (z->img_comp[i].linebuf) {
-            STBI_FREE(z->img_comp[i].linebuf);
+            stbi__free(z->img_comp[i].linebuf);
             z->img_comp[i].linebuf = NULL;
         }
     }
     return why;
 }
 
+// (Re)allocates the component planes: whole, or rings of three MCU rows
+static int stbi__jpeg_alloc_planes(stbi__jpeg *z, int stream)
+{
+    int i;
+    z->stream = stream;
+    for (i = 0; i < z->s->img_n; ++i) {
+        int rows = z->img_comp[i].h2;
+        if (stream && rows > (3 * z->img_comp[i].v * 8) >> z->scale_shift)
+            rows = (3 * z->img_comp[i].v * 8) >> z->scale_shift;
+        stbi__free(z->img_comp[i].raw_data);
+        z->img_comp[i].plane_h = z->img_comp[i].h2;
+        z->img_comp[i].raw_data = stbi__scratch_malloc_mad2(z->s->arena, z->img_comp[i].w2, rows, 15);
+        if (z->img_comp[i].raw_data == NULL)
+            return stbi__free_jpeg_components(z, z->s->img_n, stbi__err("outofmem", "Out of memory"));
+        // align blocks for idct using mmx/sse
+        z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+    }
+    return 1;
+}
+
+// Sets the output size from the crop, and the MCUs it needs: the ones
+// under it, plus one more on each side when chroma is upsampled (the
+// filters read a sample past each edge)
+static int stbi__jpeg_crop_window(stbi__jpeg *z)
+{
+    int full_w = (z->s->img_x + (1 << z->scale_shift) - 1) >> z->scale_shift;
+    int full_h = (z->s->img_y + (1 << z->scale_shift) - 1) >> z->scale_shift;
+    int mcu_w = z->img_mcu_w >> z->scale_shift, mcu_h = z->img_mcu_h >> z->scale_shift;
+    int margin_x = z->img_h_max > 1, margin_y = z->img_v_max > 1, w, h;
+    if (!stbi__crop_rect(z->s, full_w, full_h, &z->crop_x, &z->crop_y, &w, &h)) return 0;
+    z->out_w = w;
+    z->out_h = h;
+    z->mcu_x0 = z->crop_x / mcu_w - margin_x;
+    z->mcu_y0 = z->crop_y / mcu_h - margin_y;
+    z->mcu_x1 = (z->crop_x + w - 1) / mcu_w + 1 + margin_x;
+    z->mcu_y1 = (z->crop_y + h - 1) / mcu_h + 1 + margin_y;
+    if (z->mcu_x0 < 0) z->mcu_x0 = 0;
+    if (z->mcu_y0 < 0) z->mcu_y0 = 0;
+    if (z->mcu_x1 > z->img_mcu_x) z->mcu_x1 = z->img_mcu_x;
+    if (z->mcu_y1 > z->img_mcu_y) z->mcu_y1 = z->img_mcu_y;
+    return 1;
+}
+
 static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 {
     stbi__context *s = z->s;
@@ -3064,24 +5265,28 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
         // discard the extra data until colorspace conversion
         //
         // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
-        // so these muls can't overflow with 32-bit ints (which we require)
-        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+        // so these muls can't overflow with 32-bit ints (which we require).
+        // With scale_denom, each block only takes (8 >> scale_shift) pixels.
+        z->img_comp[i].w2 = (z->img_mcu_x * z->img_comp[i].h * 8) >> z->scale_shift;
+        z->img_comp[i].h2 = (z->img_mcu_y * z->img_comp[i].v * 8) >> z->scale_shift;
         z->img_comp[i].coeff = 0;
         z->img_comp[i].raw_coeff = 0;
         z->img_comp[i].linebuf = NULL;
-        z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-        if (z->img_comp[i].raw_data == NULL)
-            return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
-        // align blocks for idct using mmx/sse
-        z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+        z->img_comp[i].raw_data = NULL;
+    }
+
+    if (!stbi__jpeg_crop_window(z)) return 0;
+
+    // baseline band decoding only needs three MCU rows of each plane
+    if (!stbi__jpeg_alloc_planes(z, z->s->band && !z->progressive)) return 0;
+
+    for (i = 0; i < s->img_n; ++i) {
         if (z->progressive) {
-            // w2, h2 are multiples of 8 (see above)
-            z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-            z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+            z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+            z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+            z->img_comp[i].raw_coeff = stbi__scratch_malloc_mad3(z->s->arena, z->img_comp[i].coeff_w * 64, z->img_comp[i].coeff_h, sizeof(short), 15);
             if (z->img_comp[i].raw_coeff == NULL)
-                return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
+                return stbi__free_jpeg_components(z, s->img_n, stbi__err("outofmem", "Out of memory"));
             z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
         }
     }
@@ -3162,9 +5367,6 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
 
 // static jfif-centered resampling (across block boundaries)
 
-typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
-    int w, int hs);
-
 #define stbi__div4(x) ((stbi_uc) ((x) >> 2))
 
 static stbi_uc *resample_row_1(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
@@ -3357,6 +5559,62 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// stbi__resample_row_hv_2_simd on 16 pixels at a time
+static STBI__AVX2_TARGET stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+    int i = 0, t0, t1;
+
+    if (w == 1) {
+        out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+        return out;
+    }
+
+    t1 = 3 * in_near[0] + in_far[0];
+    for (; i < ((w - 1) & ~15); i += 16) {
+        // vertical pass, 3*near + far = 4*near + (far - near)
+        __m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+        __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+        __m256i curr = _mm256_add_epi16(_mm256_slli_epi16(nearw, 2), _mm256_sub_epi16(farw, nearw));
+
+        // current row shifted by one pixel each way, across the two lanes,
+        // with the pixels before and after this block put in at the ends
+        __m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+        __m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+        __m256i prev = _mm256_inserti128_si256(prv0, _mm_insert_epi16(_mm256_castsi256_si128(prv0), t1, 0), 0);
+        __m256i next = _mm256_inserti128_si256(nxt0, _mm_insert_epi16(_mm256_extracti128_si256(nxt0, 1), 3 * in_near[i + 16] + in_far[i + 16], 7), 1);
+
+        // horizontal pass: even = 3*cur + prev, odd = 3*cur + next
+        __m256i curb = _mm256_add_epi16(_mm256_slli_epi16(curr, 2), _mm256_set1_epi16(8));
+        __m256i even = _mm256_add_epi16(_mm256_sub_epi16(prev, curr), curb);
+        __m256i odd = _mm256_add_epi16(_mm256_sub_epi16(next, curr), curb);
+
+        // interleaving within lanes and packing puts the bytes back in order
+        __m256i de0 = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+        __m256i de1 = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+        _mm256_storeu_si256((__m256i *) (out + i * 2), _mm256_packus_epi16(de0, de1));
+
+        t1 = 3 * in_near[i + 15] + in_far[i + 15];
+    }
+
+    t0 = t1;
+    t1 = 3 * in_near[i] + in_far[i];
+    out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+    for (++i; i < w; ++i) {
+        t0 = t1;
+        t1 = 3 * in_near[i] + in_far[i];
+        out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+        out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+    }
+    out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+    STBI_NOTUSED(hs);
+
+    return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
     // resample with nearest-neighbor
@@ -3561,9 +5819,69 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#if defined(STBI_AVX2) && !defined(STBI_JPEG_OLD)
+// stbi__YCbCr_to_RGB_simd on 16 pixels at a time; hands the rest of the
+// row (and step 3) to it
+static STBI__AVX2_TARGET void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+    int i = 0;
+
+    if (step == 4) {
+        __m256i signflip = _mm256_set1_epi8(-0x80);
+        __m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f*4096.0f + 0.5f));
+        __m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f*4096.0f + 0.5f));
+        __m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f*4096.0f + 0.5f));
+        __m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f*4096.0f + 0.5f));
+        __m256i y_bias = _mm256_set1_epi16(128);
+        __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+        for (; i + 15 < count; i += 16) {
+            // load; same 16-bit values as the unpacks in the SSE2 version:
+            // y*256 + 128, and (cr - 128)*256, (cb - 128)*256
+            __m256i yw = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y + i))), 8), y_bias);
+            __m256i crw = _mm256_slli_epi16(_mm256_xor_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcr + i))), signflip), 8);
+            __m256i cbw = _mm256_slli_epi16(_mm256_xor_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcb + i))), signflip), 8);
+
+            // color transform
+            __m256i yws = _mm256_srli_epi16(yw, 4);
+            __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+            __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+            __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+            __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+            __m256i rws = _mm256_add_epi16(cr0, yws);
+            __m256i gwt = _mm256_add_epi16(cb0, yws);
+            __m256i bws = _mm256_add_epi16(yws, cb1);
+            __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+            // descale
+            __m256i rw = _mm256_srai_epi16(rws, 4);
+            __m256i bw = _mm256_srai_epi16(bws, 4);
+            __m256i gw = _mm256_srai_epi16(gws, 4);
+
+            // back to byte and interleave, within each lane: pixels 0-3
+            // and 8-11 end up in o0, 4-7 and 12-15 in o1
+            __m256i brb = _mm256_packus_epi16(rw, bw);
+            __m256i gxb = _mm256_packus_epi16(gw, xw);
+            __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+            __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+            __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+            __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+            // store
+            _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+            _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+            out += 64;
+        }
+    }
+
+    stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+    j->scale_shift = 0;
     j->idct_block_kernel = stbi__idct_block;
     j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
     j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3578,6 +5896,16 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
     }
 #endif
 
+#ifdef STBI_AVX2
+    if (!j->s->opt.no_avx2 && stbi__avx2_available()) {
+        j->idct_block_kernel = stbi__idct_avx2;
+#ifndef STBI_JPEG_OLD
+        j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+#endif
+        j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+    }
+#endif
+
 #ifdef STBI_NEON
     j->idct_block_kernel = stbi__idct_simd;
 #ifndef STBI_JPEG_OLD
@@ -3593,134 +5921,203 @@ static void stbi__cleanup_jpeg(stbi__jpeg *j)
     stbi__free_jpeg_components(j, j->s->img_n, 0);
 }
 
-typedef struct
-{
-    resample_row_func resample;
-    stbi_uc *line0, *line1;
-    int hs, vs;   // expansion factor in each axis
-    int w_lores; // horizontal pixels pre-expansion
-    int ystep;   // how far through vertical expansion we are
-    int ypos;    // which pre-expansion row we're on
-} stbi__resample;
-
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// Sets up resampling and color conversion into the output: a new image,
+// the stbi_load_into buffer or the bands
+static int stbi__jpeg_output_begin(stbi__jpeg *z)
 {
-    int n, decode_n;
-    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-                     // validate req_comp
-    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-    // load a jpeg image from whichever source, but leave in YCbCr format
-    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+    stbi__context *s = z->s;
+    int k, n, x1;
+    // width of the scaled image; the output is the crop of it
+    int full_w = (s->img_x + (1 << z->scale_shift) - 1) >> z->scale_shift;
 
     // determine actual number of components to generate
-    n = req_comp ? req_comp : z->s->img_n;
+    n = z->out_n = z->req_comp ? z->req_comp : s->img_n;
 
-    if (z->s->img_n == 3 && n < 3)
-        decode_n = 1;
+    if (s->img_n == 3 && n < 3)
+        z->decode_n = 1;
     else
-        decode_n = z->s->img_n;
+        z->decode_n = s->img_n;
+
+    for (k = 0; k < z->decode_n; ++k) {
+        stbi__resample *r = &z->res_comp[k];
+
+        // allocate line buffer big enough for upsampling off the edges
+        // with upsample factor of 4
+        z->img_comp[k].linebuf = (stbi_uc *)stbi__scratch_malloc(s->arena, full_w + 3);
+        if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+        r->hs = z->img_h_max / z->img_comp[k].h;
+        r->vs = z->img_v_max / z->img_comp[k].v;
+        r->ystep = r->vs >> 1;
+        // the samples under the crop, and one past each side for the filters
+        r->x0 = z->crop_x / r->hs - 1;
+        x1 = (z->crop_x + (int)z->out_w - 1) / r->hs + 2;
+        if (r->x0 < 0) r->x0 = 0;
+        if (x1 > (full_w + r->hs - 1) / r->hs) x1 = (full_w + r->hs - 1) / r->hs;
+        r->w_lores = x1 - r->x0;
+        r->ypos = 0;
+        r->lines = (z->img_comp[k].y + (1 << z->scale_shift) - 1) >> z->scale_shift;
+        r->line0 = r->line1 = z->img_comp[k].data;
+
+        if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+        else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+        else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+        else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+        else                               r->resample = stbi__resample_row_generic;
+    }
+
+    if (s->into || s->band) {
+        if (s->into && !stbi__into_fits(s, z->out_w, z->out_h, n)) return stbi__err("dst too small", "Image larger than the stbi_load_into buffer");
+        if (s->band && !stbi__band_begin(s, z->out_w, z->out_h)) return 0;
+        // the 3-channel writers store a 4th byte past each pixel, which
+        // would land in the neighbouring row; stage those rows instead
+        if (n == 3) {
+            z->rowbuf = (stbi_uc *)stbi__scratch_malloc(s->arena, n * z->out_w + 1);
+            if (!z->rowbuf) return stbi__err("outofmem", "Out of memory");
+        }
+        z->output = s->into ? s->into : s->band->buf;
+    }
+    else {
+        z->output = (stbi_uc *)stbi__malloc_mad3(n, z->out_w, z->out_h, 1);
+        if (!z->output) return stbi__err("outofmem", "Out of memory");
+    }
+    z->out_row = 0;
+    z->out_ready = 1;
+    return 1;
+}
 
-    // resample and color-convert
-    {
-        int k;
-        unsigned int i, j;
-        stbi_uc *output;
-        stbi_uc *coutput[4];
-
-        stbi__resample res_comp[4];
-
-        for (k = 0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-
-            // allocate line buffer big enough for upsampling off the edges
-            // with upsample factor of 4
-            z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
-            if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-            r->hs = z->img_h_max / z->img_comp[k].h;
-            r->vs = z->img_v_max / z->img_comp[k].v;
-            r->ystep = r->vs >> 1;
-            r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
-            r->ypos = 0;
-            r->line0 = r->line1 = z->img_comp[k].data;
-
-            if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-            else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-            else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-            else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-            else                               r->resample = stbi__resample_row_generic;
-        }
-
-        // can't error after this so, this is safe
-        output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-        if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-        // now go ahead and resample
-        for (j = 0; j < z->s->img_y; ++j) {
-            stbi_uc *out = output + n * z->s->img_x * j;
-            for (k = 0; k < decode_n; ++k) {
-                stbi__resample *r = &res_comp[k];
-                int y_bot = r->ystep >= (r->vs >> 1);
+// resamples and color-converts the rows of the scaled image up to end,
+// putting out those in the crop
+static int stbi__jpeg_output_rows(stbi__jpeg *z, stbi__uint32 end)
+{
+    stbi__context *s = z->s;
+    int k, n = z->out_n;
+    unsigned int i, j, out_w = z->out_w;
+    stbi_uc *coutput[4];
+
+    if (end > z->crop_y + z->out_h) end = z->crop_y + z->out_h;
+    for (j = z->out_row; j < end; ++j) {
+        // rows above the crop only move the resamplers on
+        int skip = j < (unsigned int)z->crop_y;
+        unsigned int row = j - z->crop_y;
+        stbi_uc *dest = skip ? NULL : s->band ? stbi__band_row(s, row) : s->into ? stbi__into_row(s, row, z->out_h) : z->output + n * out_w * row;
+        stbi_uc *out = z->rowbuf ? z->rowbuf : dest;
+        for (k = 0; k < z->decode_n; ++k) {
+            stbi__resample *r = &z->res_comp[k];
+            int y_bot = r->ystep >= (r->vs >> 1);
+            if (!skip)
                 coutput[k] = r->resample(z->img_comp[k].linebuf,
-                    y_bot ? r->line1 : r->line0,
-                    y_bot ? r->line0 : r->line1,
-                    r->w_lores, r->hs);
-                if (++r->ystep >= r->vs) {
-                    r->ystep = 0;
-                    r->line0 = r->line1;
-                    if (++r->ypos < z->img_comp[k].y)
-                        r->line1 += z->img_comp[k].w2;
+                    (y_bot ? r->line1 : r->line0) + r->x0,
+                    (y_bot ? r->line0 : r->line1) + r->x0,
+                    r->w_lores, r->hs) + (z->crop_x - r->x0 * r->hs);
+            if (++r->ystep >= r->vs) {
+                r->ystep = 0;
+                r->line0 = r->line1;
+                if (++r->ypos < r->lines) {
+                    r->line1 += z->img_comp[k].w2;
+                    // wraps round only when the planes are rings
+                    if (r->line1 == z->img_comp[k].data + z->img_comp[k].plane_h * z->img_comp[k].w2)
+                        r->line1 = z->img_comp[k].data;
                 }
             }
-            if (n >= 3) {
-                stbi_uc *y = coutput[0];
-                if (z->s->img_n == 3) {
-                    if (z->rgb == 3) {
-                        for (i = 0; i < z->s->img_x; ++i) {
-                            out[0] = y[i];
-                            out[1] = coutput[1][i];
-                            out[2] = coutput[2][i];
-                            out[3] = 255;
-                            out += n;
-                        }
-                    }
-                    else {
-                        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                    }
-                }
-                else
-                    for (i = 0; i < z->s->img_x; ++i) {
-                        out[0] = out[1] = out[2] = y[i];
-                        out[3] = 255; // not used if n==3
+        }
+        if (skip)
+            continue;
+        if (n >= 3) {
+            stbi_uc *y = coutput[0];
+            if (s->img_n == 3) {
+                if (z->rgb == 3) {
+                    for (i = 0; i < out_w; ++i) {
+                        out[0] = y[i];
+                        out[1] = coutput[1][i];
+                        out[2] = coutput[2][i];
+                        out[3] = 255;
                         out += n;
                     }
+                }
+                else {
+                    z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], out_w, n);
+                }
             }
-            else {
-                stbi_uc *y = coutput[0];
-                if (n == 1)
-                    for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-                else
-                    for (i = 0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
-            }
+            else
+                for (i = 0; i < out_w; ++i) {
+                    out[0] = out[1] = out[2] = y[i];
+                    out[3] = 255; // not used if n==3
+                    out += n;
+                }
+        }
+        else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+                for (i = 0; i < out_w; ++i) out[i] = y[i];
+            else
+                for (i = 0; i < out_w; ++i) *out++ = y[i], *out++ = 255;
         }
+        if (z->rowbuf)
+            memcpy(dest, z->rowbuf, n * out_w);
+        if (s->band && !stbi__band_row_done(s)) return 0;
+    }
+    z->out_row = end;
+    return 1;
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+                     // validate req_comp
+    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+    // validate scale_denom and pick the matching IDCT; 0 is taken as 1
+    switch (z->s->opt.scale_denom) {
+    case 0: case 1: break;
+    case 2: z->scale_shift = 1; z->idct_block_kernel = stbi__idct_block_4x4; break;
+    case 4: z->scale_shift = 2; z->idct_block_kernel = stbi__idct_block_2x2; break;
+    case 8: z->scale_shift = 3; z->idct_block_kernel = stbi__idct_block_1x1; break;
+    default: return stbi__errpuc("bad scale_denom", "scale_denom must be 1, 2, 4 or 8");
+    }
+#ifdef STBI_SSE2
+    if (stbi__sse2_available()) {
+        if (z->scale_shift == 1) z->idct_block_kernel = stbi__idct_4x4_sse2;
+        if (z->scale_shift == 2) z->idct_block_kernel = stbi__idct_2x2_sse2;
+    }
+#endif
+
+    z->req_comp = req_comp;
+    z->out_ready = 0;
+    z->output = z->rowbuf = NULL;
+    z->stream = 0;
+    z->mcu_row_base = 0;
+
+    // load a jpeg image from whichever source, but leave in YCbCr format;
+    // when streaming bands this already puts out all but the last MCU row
+    if (!stbi__decode_jpeg_image(z)
+        || (!z->out_ready && !stbi__jpeg_output_begin(z))
+        || !stbi__jpeg_output_rows(z, z->crop_y + z->out_h)) {
+        stbi__free(z->rowbuf);
+        if (!z->s->into && !z->s->band)
+            stbi__free(z->output);
         stbi__cleanup_jpeg(z);
-        *out_x = z->s->img_x;
-        *out_y = z->s->img_y;
-        if (comp) *comp = z->s->img_n; // report original components, not output
-        return output;
+        return NULL;
     }
+
+    stbi__free(z->rowbuf);
+    stbi__cleanup_jpeg(z);
+    *out_x = z->out_w;
+    *out_y = z->out_h;
+    if (comp) *comp = z->s->img_n; // report original components, not output
+    return z->output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
     unsigned char* result;
-    stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+    stbi__jpeg* j = (stbi__jpeg*)stbi__scratch_malloc(s->arena, sizeof(stbi__jpeg));
     j->s = s;
     stbi__setup_jpeg(j);
+    ri->cropped = 1;
     result = load_jpeg_image(j, x, y, comp, req_comp);
-    STBI_FREE(j);
+    stbi__free(j);
     return result;
 }
 
@@ -3753,7 +6150,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
     stbi__jpeg* j = (stbi__jpeg*)(stbi__malloc(sizeof(stbi__jpeg)));
     j->s = s;
     result = stbi__jpeg_info_raw(j, x, y, comp);
-    STBI_FREE(j);
+    stbi__free(j);
     return result;
 }
 #endif
@@ -3767,15 +6164,58 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 
 #ifndef STBI_NO_ZLIB
 
+// handing inflated data to another thread needs the atomics; without them
+// that path is compiled out
+#if !defined(STBI_NO_PNG_PIPELINE) && (defined(STBI_NO_PNG) || !defined(STBI__ATOMICS))
+#define STBI_NO_PNG_PIPELINE
+#endif
+
+#ifndef STBI_NO_PNG_PIPELINE
+#ifdef STBI_SSE2
+#define stbi__spin_pause() _mm_pause()
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__arm__))
+#define stbi__spin_pause() __asm__ __volatile__("yield")
+#else
+#define stbi__spin_pause()
+#endif
+
+// gives the rest of the time slice to another thread, for waits that outlast
+// a short spin; on a busy or single core machine that thread may be the one
+// being waited on
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#define stbi__yield() SwitchToThread()
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sched.h>
+#define stbi__yield() sched_yield()
+#else
+#define stbi__yield() stbi__spin_pause()
+#endif
+
+// pauses before a waiter starts yielding
+#define STBI__SPIN_LIMIT 64
+#endif
+
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, most in dynamic ones
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 
+// a fast entry is the code length in the low 8 bits (0 if the code is longer
+// than the table) and the symbol above it; in the length table, two literals
+// whose codes fit in the table together are packed as one entry
+#define STBI__ZFAST_PAIR  (1 << 25) // second literal in bits 17-24
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
 {
-    stbi__uint16 fast[1 << STBI__ZFAST_BITS];
+    stbi__uint32 fast[1 << STBI__ZFAST_BITS];
     stbi__uint16 firstcode[16];
     int maxcode[17];
     stbi__uint16 firstsymbol[16];
@@ -3800,7 +6240,7 @@ stbi_inline static int stbi__bit_reverse(int v, int bits)
     return stbi__bitreverse16(v) >> (16 - bits);
 }
 
-static int stbi__zbuild_huffman(stbi__zhuffman *z, stbi_uc *sizelist, int num)
+static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int num)
 {
     int i, k = 0;
     int code, next_code[16], sizes[17];
@@ -3831,7 +6271,7 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, stbi_uc *sizelist, int num)
         int s = sizelist[i];
         if (s) {
             int c = next_code[s] - z->firstcode[s] + z->firstsymbol[s];
-            stbi__uint16 fastv = (stbi__uint16)((s << 9) | i);
+            stbi__uint32 fastv = (stbi__uint32)((i << 8) | s);
             z->size[c] = (stbi_uc)s;
             z->value[c] = (stbi__uint16)i;
             if (s <= STBI__ZFAST_BITS) {
@@ -3847,24 +6287,64 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, stbi_uc *sizelist, int num)
     return 1;
 }
 
+// Pair up literals in the length table. The bits after a code of length s
+// index the table at j >> s, which is smaller than j, so going down from
+// the top reads only entries that are still single.
+static void stbi__zbuild_pairs(stbi__zhuffman *z)
+{
+    int j;
+    for (j = (1 << STBI__ZFAST_BITS) - 1; j >= 0; --j) {
+        stbi__uint32 e = z->fast[j], e2;
+        int s = e & 255;
+        if (s == 0 || (e >> 8) >= 256) continue;
+        e2 = z->fast[j >> s];
+        if ((e2 & 255) == 0 || (e2 >> 8) >= 256 || s + (int)(e2 & 255) > STBI__ZFAST_BITS) continue;
+        z->fast[j] = STBI__ZFAST_PAIR | ((e2 >> 8) << 17) | (e & 0xff00) | (s + (e2 & 255));
+    }
+}
+
 // zlib-from-memory implementation for PNG reading
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
 //    we require PNG read all the IDATs and combine them into a single
 //    memory buffer
 
+#ifndef STBI_NO_PNG_PIPELINE
+// Inflate progress another thread can follow. The output buffer has its
+// final size up front, so it never moves; zout_end is kept a band ahead of
+// zout, and each time inflate reaches it the bytes so far are published.
+typedef struct
+{
+    volatile long available;  // bytes of output that will not change any more
+    volatile long state;      // 0 inflating, 1 finished, -1 failed
+    char *limit;              // end of the output buffer
+    int band;                 // bytes between publishes
+} stbi__zprogress;
+#endif
+
 typedef struct
 {
     stbi_uc *zbuffer, *zbuffer_end;
     int num_bits;
-    stbi__uint32 code_buffer;
+    int zpad;               // zero bytes fed to code_buffer past zbuffer_end
+    stbi__uint64 code_buffer;
 
     char *zout;
     char *zout_start;
     char *zout_end;
     int   z_expandable;
+    stbi__arena *arena;     // where an expandable buffer lives, NULL for the heap
 
     stbi__zhuffman z_length, z_distance;
+#ifndef STBI_NO_PNG_PIPELINE
+    stbi__zprogress *progress;
+#endif
+
+    // when set, a full buffer is handed to drain (which returns how many
+    // bytes it took, -1 on error) and slides down instead of growing
+    int (*drain)(void *drain_user, char *data, int len);
+    void *drain_user;
+    int drained;            // bytes from zout_start already taken
 } stbi__zbuf;
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
@@ -3873,20 +6353,44 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
     return *z->zbuffer++;
 }
 
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (stbi__uint64)p[0]         | ((stbi__uint64)p[1] << 8)  |
+          ((stbi__uint64)p[2] << 16)  | ((stbi__uint64)p[3] << 24) |
+          ((stbi__uint64)p[4] << 32)  | ((stbi__uint64)p[5] << 40) |
+          ((stbi__uint64)p[6] << 48)  | ((stbi__uint64)p[7] << 56);
+#else
+    stbi__uint64 v;
+    memcpy(&v, p, 8);
+    return v;
+#endif
+}
+
+// tops code_buffer up to at least 56 bits. Bits above num_bits may hold the
+// start of the next byte; it is OR'ed in again unchanged when loaded for real.
 static void stbi__fill_bits(stbi__zbuf *z)
 {
-    do {
-        STBI_ASSERT(z->code_buffer < (1U << z->num_bits));
-        z->code_buffer |= (unsigned int)stbi__zget8(z) << z->num_bits;
+    if (z->zbuffer_end - z->zbuffer >= 8) {
+        // load 8 bytes and keep the whole ones that fit; the rest are
+        // loaded again next time
+        z->code_buffer |= stbi__zload64(z->zbuffer) << z->num_bits;
+        z->zbuffer += (63 - z->num_bits) >> 3;
+        z->num_bits |= 56;
+        return;
+    }
+    while (z->num_bits <= 56) {
+        if (z->zbuffer >= z->zbuffer_end) ++z->zpad;
+        z->code_buffer |= (stbi__uint64)stbi__zget8(z) << z->num_bits;
         z->num_bits += 8;
-    } while (z->num_bits <= 24);
+    }
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
     unsigned int k;
     if (z->num_bits < n) stbi__fill_bits(z);
-    k = z->code_buffer & ((1 << n) - 1);
+    k = (unsigned int)(z->code_buffer & ((1 << n) - 1));
     z->code_buffer >>= n;
     z->num_bits -= n;
     return k;
@@ -3897,7 +6401,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
     int b, s, k;
     // not resolved by fast table, so compute it the slow way
     // use jpeg approach, which requires MSbits at top
-    k = stbi__bit_reverse(a->code_buffer, 16);
+    k = stbi__bit_reverse((int)(a->code_buffer & 0xffff), 16);
     for (s = STBI__ZFAST_BITS + 1; ; ++s)
         if (k < z->maxcode[s])
             break;
@@ -3912,14 +6416,15 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
 
 stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
 {
-    int b, s;
+    stbi__uint32 b;
+    int s;
     if (a->num_bits < 16) stbi__fill_bits(a);
     b = z->fast[a->code_buffer & STBI__ZFAST_MASK];
     if (b) {
-        s = b >> 9;
+        s = b & 255;
         a->code_buffer >>= s;
         a->num_bits -= s;
-        return b & 511;
+        return (b >> 8) & 511;
     }
     return stbi__zhuffman_decode_slowpath(a, z);
 }
@@ -3929,13 +6434,35 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
     char *q;
     int cur, limit, old_limit;
     z->zout = zout;
+    if (z->drain) {
+        // keep the 32k matches can reach back into, and what drain didn't take
+        int have = (int)(zout - z->zout_start), keep;
+        int used = z->drain(z->drain_user, z->zout_start + z->drained, have - z->drained);
+        if (used < 0) return 0;
+        z->drained += used;
+        keep = have < 32768 ? have : 32768;
+        if (have - z->drained > keep) keep = have - z->drained;
+        memmove(z->zout_start, zout - keep, keep);
+        z->drained -= have - keep;
+        z->zout = z->zout_start + keep;
+        if (z->zout_end - z->zout < n) return stbi__err("output buffer limit", "Corrupt PNG");
+        return 1;
+    }
+#ifndef STBI_NO_PNG_PIPELINE
+    if (z->progress) {
+        stbi__zprogress *p = z->progress;
+        if (p->limit - zout < n) return stbi__err("output buffer limit", "Corrupt PNG");
+        stbi__atomic_store(&p->available, (long)(zout - z->zout_start));
+        z->zout_end = p->limit - zout - n > p->band ? zout + n + p->band : p->limit;
+        return 1;
+    }
+#endif
     if (!z->z_expandable) return stbi__err("output buffer limit", "Corrupt PNG");
     cur = (int)(z->zout - z->zout_start);
     limit = old_limit = (int)(z->zout_end - z->zout_start);
     while (cur + n > limit)
         limit *= 2;
-    q = (char *)STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
-    STBI_NOTUSED(old_limit);
+    q = (char *)stbi__scratch_realloc(z->arena, z->zout_start, old_limit, limit);
     if (q == NULL) return stbi__err("outofmem", "Out of memory");
     z->zout_start = q;
     z->zout = q + cur;
@@ -3959,40 +6486,123 @@ static int stbi__zdist_extra[32] =
 
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
-    char *zout = a->zout;
+    // the bit buffer and output pointers are kept in locals: stores through
+    // zout could alias the fields of a, which would keep them out of registers
+    char *zout = a->zout, *zout_end = a->zout_end;
+    stbi__uint64 bits = a->code_buffer;
+    int num_bits = a->num_bits;
     for (;;) {
-        int z = stbi__zhuffman_decode(a, &a->z_length);
+        stbi__uint32 e;
+        int z;
+        // 48 bits cover the longest length code, distance code and their
+        // extra bits, so a whole match decodes from one refill
+        if (num_bits < 48) {
+            if (a->zbuffer_end - a->zbuffer >= 8) {
+                bits |= stbi__zload64(a->zbuffer) << num_bits;
+                a->zbuffer += (63 - num_bits) >> 3;
+                num_bits |= 56;
+            }
+            else {
+                a->code_buffer = bits;
+                a->num_bits = num_bits;
+                stbi__fill_bits(a);
+                bits = a->code_buffer;
+                num_bits = a->num_bits;
+                // more zero padding than code_buffer holds means codes are
+                // being read from past the end of the data
+                if (a->zpad > 8) return stbi__err("unexpected end", "Corrupt PNG");
+            }
+        }
+        e = a->z_length.fast[bits & STBI__ZFAST_MASK];
+        if (e & STBI__ZFAST_PAIR) {
+            if (zout_end - zout < 2) {
+                if (!stbi__zexpand(a, zout, 2)) return 0;
+                zout = a->zout;
+                zout_end = a->zout_end;
+            }
+            zout[0] = (char)(e >> 8);
+            zout[1] = (char)(e >> 17);
+            zout += 2;
+            bits >>= e & 255;
+            num_bits -= e & 255;
+            continue;
+        }
+        if (e) {
+            bits >>= e & 255;
+            num_bits -= e & 255;
+            z = (int)(e >> 8);
+        }
+        else {
+            a->code_buffer = bits;
+            a->num_bits = num_bits;
+            z = stbi__zhuffman_decode_slowpath(a, &a->z_length);
+            bits = a->code_buffer;
+            num_bits = a->num_bits;
+        }
         if (z < 256) {
             if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG"); // error in huffman codes
-            if (zout >= a->zout_end) {
+            if (zout >= zout_end) {
                 if (!stbi__zexpand(a, zout, 1)) return 0;
                 zout = a->zout;
+                zout_end = a->zout_end;
             }
             *zout++ = (char)z;
         }
         else {
             stbi_uc *p;
-            int len, dist;
+            int len, dist, extra;
             if (z == 256) {
                 a->zout = zout;
+                a->code_buffer = bits;
+                a->num_bits = num_bits;
                 return 1;
             }
             z -= 257;
             len = stbi__zlength_base[z];
-            if (stbi__zlength_extra[z]) len += stbi__zreceive(a, stbi__zlength_extra[z]);
-            z = stbi__zhuffman_decode(a, &a->z_distance);
-            if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG");
+            extra = stbi__zlength_extra[z];
+            len += (int)(bits & ((1 << extra) - 1));
+            bits >>= extra;
+            num_bits -= extra;
+            e = a->z_distance.fast[bits & STBI__ZFAST_MASK];
+            if (e) {
+                bits >>= e & 255;
+                num_bits -= e & 255;
+                z = (int)(e >> 8);
+            }
+            else {
+                a->code_buffer = bits;
+                a->num_bits = num_bits;
+                z = stbi__zhuffman_decode_slowpath(a, &a->z_distance);
+                bits = a->code_buffer;
+                num_bits = a->num_bits;
+                if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG");
+            }
             dist = stbi__zdist_base[z];
-            if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
+            extra = stbi__zdist_extra[z];
+            dist += (int)(bits & ((1 << extra) - 1));
+            bits >>= extra;
+            num_bits -= extra;
             if (zout - a->zout_start < dist) return stbi__err("bad dist", "Corrupt PNG");
-            if (zout + len > a->zout_end) {
+            if (zout + len > zout_end) {
                 if (!stbi__zexpand(a, zout, len)) return 0;
                 zout = a->zout;
+                zout_end = a->zout_end;
             }
             p = (stbi_uc *)(zout - dist);
             if (dist == 1) { // run of one byte; common in images.
-                stbi_uc v = *p;
-                if (len) { do *zout++ = v; while (--len); }
+                memset(zout, *p, len);
+                zout += len;
+            }
+            else if (dist >= 4 && zout_end - zout >= len + 8) {
+                // copy in chunks no longer than dist, so each one reads only
+                // bytes already written; the last may run up to 7 bytes past
+                // the match, into room the end check left
+                char *end = zout + len;
+                if (dist >= 8)
+                    do { memcpy(zout, p, 8); zout += 8; p += 8; } while (zout < end);
+                else
+                    do { memcpy(zout, p, 4); zout += 4; p += 4; } while (zout < end);
+                zout = end;
             }
             else {
                 if (len) { do *zout++ = *p++; while (--len); }
@@ -4057,17 +6667,15 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
     int len, nlen, k;
     if (a->num_bits & 7)
         stbi__zreceive(a, a->num_bits & 7); // discard
-                                            // drain the bit-packed data into header
-    k = 0;
-    while (a->num_bits > 0) {
-        header[k++] = (stbi_uc)(a->code_buffer & 255); // suppress MSVC run-time check
-        a->code_buffer >>= 8;
-        a->num_bits -= 8;
-    }
-    STBI_ASSERT(a->num_bits == 0);
-    // now fill header the normal way
-    while (k < 4)
-        header[k++] = stbi__zget8(a);
+    // the whole bytes left in code_buffer came straight from zbuffer (or
+    // are padding past its end), so step back over them and read from there
+    if (a->zpad * 8 > a->num_bits) return stbi__err("read past buffer", "Corrupt PNG");
+    a->zbuffer -= (a->num_bits >> 3) - a->zpad;
+    a->zpad = 0;
+    a->num_bits = 0;
+    a->code_buffer = 0;
+    for (k = 0; k < 4; ++k)
+        header[k] = stbi__zget8(a);
     len = header[1] * 256 + header[0];
     nlen = header[3] * 256 + header[2];
     if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt", "Corrupt PNG");
@@ -4093,18 +6701,24 @@ static int stbi__parse_zlib_header(stbi__zbuf *a)
     return 1;
 }
 
-// @TODO: should statically initialize these for optimal thread safety
-static stbi_uc stbi__zdefault_length[288], stbi__zdefault_distance[32];
-static void stbi__init_zdefaults(void)
+// fixed huffman code lengths (0-143: 8, 144-255: 9, 256-279: 7, 280-287: 8);
+// static so concurrent decodes don't race on a lazy init
+static const stbi_uc stbi__zdefault_length[288] =
 {
-    int i;   // use <= to match clearly with spec
-    for (i = 0; i <= 143; ++i)     stbi__zdefault_length[i] = 8;
-    for (; i <= 255; ++i)     stbi__zdefault_length[i] = 9;
-    for (; i <= 279; ++i)     stbi__zdefault_length[i] = 7;
-    for (; i <= 287; ++i)     stbi__zdefault_length[i] = 8;
-
-    for (i = 0; i <= 31; ++i)     stbi__zdefault_distance[i] = 5;
-}
+    8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+    8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+    8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+    8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+    8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+    9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+    9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+    9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+    7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,8,8,8,8,8,8,8,8
+};
+static const stbi_uc stbi__zdefault_distance[32] =
+{
+    5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5
+};
 
 static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 {
@@ -4112,6 +6726,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
     if (parse_header)
         if (!stbi__parse_zlib_header(a)) return 0;
     a->num_bits = 0;
+    a->zpad = 0;
     a->code_buffer = 0;
     do {
         final = stbi__zreceive(a, 1);
@@ -4125,13 +6740,13 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
         else {
             if (type == 1) {
                 // use fixed code lengths
-                if (!stbi__zdefault_distance[31]) stbi__init_zdefaults();
                 if (!stbi__zbuild_huffman(&a->z_length, stbi__zdefault_length, 288)) return 0;
                 if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance, 32)) return 0;
             }
             else {
                 if (!stbi__compute_huffman_codes(a)) return 0;
             }
+            stbi__zbuild_pairs(&a->z_length);
             if (!stbi__parse_huffman_block(a)) return 0;
         }
     } while (!final);
@@ -4144,6 +6759,10 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
     a->zout = obuf;
     a->zout_end = obuf + olen;
     a->z_expandable = exp;
+#ifndef STBI_NO_PNG_PIPELINE
+    a->progress = NULL;
+#endif
+    a->drain = NULL;
 
     return stbi__parse_zlib(a, parse_header);
 }
@@ -4155,12 +6774,13 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
     if (p == NULL) return NULL;
     a.zbuffer = (stbi_uc *)buffer;
     a.zbuffer_end = (stbi_uc *)buffer + len;
+    a.arena = NULL;
     if (stbi__do_zlib(&a, p, initial_size, 1, 1)) {
         if (outlen) *outlen = (int)(a.zout - a.zout_start);
         return a.zout_start;
     }
     else {
-        STBI_FREE(a.zout_start);
+        stbi__free(a.zout_start);
         return NULL;
     }
 }
@@ -4170,23 +6790,30 @@ STBIDEF char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
     return stbi_zlib_decode_malloc_guesssize(buffer, len, 16384, outlen);
 }
 
-STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
+// the PNG decoder's inflate, into the load's scratch arena
+static char *stbi__zlib_decode_scratch(stbi__arena *arena, const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
     stbi__zbuf a;
-    char *p = (char *)stbi__malloc(initial_size);
+    char *p = (char *)stbi__scratch_malloc(arena, initial_size);
     if (p == NULL) return NULL;
     a.zbuffer = (stbi_uc *)buffer;
     a.zbuffer_end = (stbi_uc *)buffer + len;
+    a.arena = arena;
     if (stbi__do_zlib(&a, p, initial_size, 1, parse_header)) {
         if (outlen) *outlen = (int)(a.zout - a.zout_start);
         return a.zout_start;
     }
     else {
-        STBI_FREE(a.zout_start);
+        stbi__free(a.zout_start);
         return NULL;
     }
 }
 
+STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
+{
+    return stbi__zlib_decode_scratch(NULL, buffer, len, initial_size, outlen, parse_header);
+}
+
 STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int ilen)
 {
     stbi__zbuf a;
@@ -4205,12 +6832,13 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
     if (p == NULL) return NULL;
     a.zbuffer = (stbi_uc *)buffer;
     a.zbuffer_end = (stbi_uc *)buffer + len;
+    a.arena = NULL;
     if (stbi__do_zlib(&a, p, 16384, 1, 0)) {
         if (outlen) *outlen = (int)(a.zout - a.zout_start);
         return a.zout_start;
     }
     else {
-        STBI_FREE(a.zout_start);
+        stbi__free(a.zout_start);
         return NULL;
     }
 }
@@ -4266,6 +6894,12 @@ typedef struct
     stbi__context *s;
     stbi_uc *idata, *expanded, *out;
     int depth;
+    int out_scratch;    // out gets converted before it is returned
+    stbi_uc *prior_row; // band decoding: the row above raw, NULL at the top
+    stbi_uc *band_prior; // band decoding: where the last row unfiltered is kept
+#ifndef STBI_NO_PNG_PIPELINE
+    stbi__zprogress *progress; // set while unfiltering behind a running inflate
+#endif
 } stbi__png;
 
 
@@ -4300,6 +6934,175 @@ static int stbi__paeth(int a, int b, int c)
     return c;
 }
 
+#ifdef STBI_SSE2
+// SIMD unfiltering works a pixel at a time, since Sub, Avg and Paeth depend
+// on the pixel to the left. Pixels are 3, 4, 6 or 8 bytes: 8-bit RGB(A) and
+// 16-bit RGB(A), as the filters work on bytes either way. in is the pixel
+// size in raw, out the pixel stride in cur and prior; when out is wider (an
+// alpha channel being added) the extra bytes are set to 255.
+stbi_inline static __m128i stbi__png_load_px(const stbi_uc *p, int n)
+{
+    int lo;
+    if (n == 8) return _mm_loadl_epi64((const __m128i *)p);
+    if (n == 3) return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+    memcpy(&lo, p, 4);
+    if (n == 4) return _mm_cvtsi32_si128(lo);
+    return _mm_unpacklo_epi32(_mm_cvtsi32_si128(lo), _mm_cvtsi32_si128(p[4] | (p[5] << 8)));
+}
+
+stbi_inline static void stbi__png_store_px(stbi_uc *p, __m128i v, int n)
+{
+    int lo;
+    if (n == 8) {
+        _mm_storel_epi64((__m128i *)p, v);
+        return;
+    }
+    lo = _mm_cvtsi128_si32(v);
+    if (n == 3) {
+        p[0] = (stbi_uc)lo;
+        p[1] = (stbi_uc)(lo >> 8);
+        p[2] = (stbi_uc)(lo >> 16);
+        return;
+    }
+    memcpy(p, &lo, 4);
+    if (n == 6) {
+        lo = _mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+        p[4] = (stbi_uc)lo;
+        p[5] = (stbi_uc)(lo >> 8);
+    }
+}
+
+// 3 and 6 byte pixels are moved as 4 and 8 bytes where the bytes after them
+// exist: the extra ones land in the next pixel, which is written after
+stbi_inline static int stbi__png_wide_px(int n)
+{
+    return n == 3 ? 4 : n == 6 ? 8 : n;
+}
+
+// unfilters pixels starting with a as the one to the left, returning the
+// last; wide moves pixels with stbi__png_wide_px
+stbi_inline static __m128i stbi__unfilter_span_sse2(int filter, __m128i a, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int pixels, int in, int out, int wide)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i fill = in == out ? zero : in == 3 ? _mm_cvtsi32_si128((int)0xff000000) : _mm_set_epi32(0, 0, (int)0xffff0000, 0);
+    int load_in = wide ? stbi__png_wide_px(in) : in, move_out = wide ? stbi__png_wide_px(out) : out;
+    int i;
+
+    switch (filter) {
+    case STBI__F_none:
+        for (i = 0; i < pixels; ++i, raw += in, cur += out) {
+            a = _mm_or_si128(stbi__png_load_px(raw, load_in), fill);
+            stbi__png_store_px(cur, a, move_out);
+        }
+        break;
+    case STBI__F_sub:
+        for (i = 0; i < pixels; ++i, raw += in, cur += out) {
+            a = _mm_or_si128(_mm_add_epi8(stbi__png_load_px(raw, load_in), a), fill);
+            stbi__png_store_px(cur, a, move_out);
+        }
+        break;
+    case STBI__F_up:
+        for (i = 0; i < pixels; ++i, raw += in, cur += out, prior += out) {
+            a = _mm_or_si128(_mm_add_epi8(stbi__png_load_px(raw, load_in), stbi__png_load_px(prior, move_out)), fill);
+            stbi__png_store_px(cur, a, move_out);
+        }
+        break;
+    case STBI__F_avg: {
+        // _mm_avg_epu8 rounds up; take back the 1 where the sum is odd
+        __m128i one = _mm_set1_epi8(1);
+        for (i = 0; i < pixels; ++i, raw += in, cur += out, prior += out) {
+            __m128i b = stbi__png_load_px(prior, move_out);
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_or_si128(_mm_add_epi8(stbi__png_load_px(raw, load_in), avg), fill);
+            stbi__png_store_px(cur, a, move_out);
+        }
+        break;
+    }
+    case STBI__F_paeth: {
+        // stbi__paeth in 16-bit lanes: with p = a + b - c, |p - a| = |b - c|,
+        // |p - b| = |a - c| and |p - c| = |(b - c) + (a - c)|
+        __m128i a16 = _mm_unpacklo_epi8(a, zero);
+        __m128i c16 = _mm_unpacklo_epi8(stbi__png_load_px(prior - out, out), zero);
+        for (i = 0; i < pixels; ++i, raw += in, cur += out, prior += out) {
+            __m128i b16 = _mm_unpacklo_epi8(stbi__png_load_px(prior, move_out), zero);
+            __m128i bc = _mm_sub_epi16(b16, c16), ac = _mm_sub_epi16(a16, c16), abc = _mm_add_epi16(bc, ac);
+            __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+            __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+            __m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+            // a unless b is strictly closer, then c if strictly closer still
+            __m128i m = _mm_cmplt_epi16(pb, pa);
+            __m128i pred = _mm_or_si128(_mm_andnot_si128(m, a16), _mm_and_si128(m, b16));
+            m = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+            pred = _mm_or_si128(_mm_andnot_si128(m, pred), _mm_and_si128(m, c16));
+            a = _mm_or_si128(_mm_add_epi8(stbi__png_load_px(raw, load_in), _mm_packus_epi16(pred, zero)), fill);
+            stbi__png_store_px(cur, a, move_out);
+            a16 = _mm_unpacklo_epi8(a, zero);
+            c16 = b16;
+        }
+        break;
+    }
+    }
+    return a;
+}
+
+stbi_inline static void stbi__unfilter_sse2(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int pixels, int in, int out)
+{
+    __m128i a;
+    if (filter == STBI__F_up && in == out) {
+        int n = pixels * in, k = 0;
+        for (; k + 16 <= n; k += 16)
+            _mm_storeu_si128((__m128i *)(cur + k), _mm_add_epi8(_mm_loadu_si128((const __m128i *)(raw + k)), _mm_loadu_si128((const __m128i *)(prior + k))));
+        for (; k < n; ++k)
+            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+        return;
+    }
+    // the last pixel of the row is moved exactly: raw, and a prior row
+    // from a previous band, end there
+    a = stbi__png_load_px(cur - out, out);
+    if (pixels > 1)
+        a = stbi__unfilter_span_sse2(filter, a, cur, raw, prior, pixels - 1, in, out, 1);
+    pixels -= 1;
+    stbi__unfilter_span_sse2(filter, a, cur + pixels * out, raw + pixels * in, prior + pixels * out, 1, in, out, 0);
+}
+
+#ifdef STBI_AVX2
+// Up has no dependency along the row, so it runs 32 bytes at a time
+static STBI__AVX2_TARGET void stbi__unfilter_up_avx2(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int n)
+{
+    int k = 0;
+    for (; k + 32 <= n; k += 32)
+        _mm256_storeu_si256((__m256i *)(cur + k), _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(raw + k)), _mm256_loadu_si256((const __m256i *)(prior + k))));
+    for (; k < n; ++k)
+        cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+}
+#endif
+
+// unfilters all but the first pixel of a row; 0 if the filter or pixel
+// sizes are left to the scalar loops
+static int stbi__unfilter_row_simd(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int pixels, int in, int out, int avx2)
+{
+    if (filter > STBI__F_paeth || (filter == STBI__F_none && in == out)) return 0;
+    if (pixels <= 0) return 1;
+#ifdef STBI_AVX2
+    if (avx2 && filter == STBI__F_up && in == out) {
+        stbi__unfilter_up_avx2(cur, raw, prior, pixels * in);
+        return 1;
+    }
+#else
+    STBI_NOTUSED(avx2);
+#endif
+    // constant pixel sizes, so each case gets its own loads and stores
+    if (in == 3 && out == 3) stbi__unfilter_sse2(filter, cur, raw, prior, pixels, 3, 3);
+    else if (in == 3 && out == 4) stbi__unfilter_sse2(filter, cur, raw, prior, pixels, 3, 4);
+    else if (in == 4 && out == 4) stbi__unfilter_sse2(filter, cur, raw, prior, pixels, 4, 4);
+    else if (in == 6 && out == 6) stbi__unfilter_sse2(filter, cur, raw, prior, pixels, 6, 6);
+    else if (in == 6 && out == 8) stbi__unfilter_sse2(filter, cur, raw, prior, pixels, 6, 8);
+    else if (in == 8 && out == 8) stbi__unfilter_sse2(filter, cur, raw, prior, pixels, 8, 8);
+    else return 0;
+    return 1;
+}
+#endif
+
 static stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4315,9 +7118,18 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
     int output_bytes = out_n*bytes;
     int filter_bytes = img_n*bytes;
     int width = x;
+#ifndef STBI_NO_PNG_PIPELINE
+    stbi_uc *raw_start = raw;
+#endif
+#ifdef STBI_SSE2
+    int simd = 0; // 1 for the SSE2 unfilter kernels, 2 with AVX2 as well
+#endif
 
     STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
-    a->out = (stbi_uc *)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
+#ifdef STBI_SSE2
+    if (depth >= 8) simd = stbi__simd_level(s);
+#endif
+    a->out = (stbi_uc *)stbi__scratch_malloc_mad3(a->out_scratch ? s->arena : NULL, x, y, output_bytes, 0); // extra bytes to write off the end into
     if (!a->out) return stbi__err("outofmem", "Out of memory");
 
     img_width_bytes = (((img_n * x * depth) + 7) >> 3);
@@ -4331,8 +7143,27 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
 
     for (j = 0; j < y; ++j) {
         stbi_uc *cur = a->out + stride*j;
-        stbi_uc *prior = cur - stride;
-        int filter = *raw++;
+        stbi_uc *prior = j == 0 && a->prior_row ? a->prior_row : cur - stride;
+        int filter;
+
+#ifndef STBI_NO_PNG_PIPELINE
+        if (a->progress) {
+            // wait until inflate has published this whole row; the next band
+            // is usually close, so spin a little before yielding
+            long need = (long)(raw - raw_start) + img_width_bytes + 1;
+            int spins = 0;
+            while (stbi__atomic_load(&a->progress->available) < need) {
+                if (stbi__atomic_load(&a->progress->state) < 0) return stbi__err("inflate failed", "Corrupt PNG");
+                if (spins < STBI__SPIN_LIMIT) {
+                    stbi__spin_pause();
+                    ++spins;
+                }
+                else
+                    stbi__yield();
+            }
+        }
+#endif
+        filter = *raw++;
 
         if (filter > 4)
             return stbi__err("invalid filter", "Corrupt PNG");
@@ -4340,12 +7171,13 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
         if (depth < 8) {
             STBI_ASSERT(img_width_bytes <= x);
             cur += x*out_n - img_width_bytes; // store output to the rightmost img_len bytes, so we can decode in place
+            prior += x*out_n - img_width_bytes; // and the row above is there too
             filter_bytes = 1;
             width = img_width_bytes;
         }
 
         // if first row, use special filter that doesn't sample previous row
-        if (j == 0) filter = first_row_filter[filter];
+        if (j == 0 && !a->prior_row) filter = first_row_filter[filter];
 
         // handle first byte explicitly
         for (k = 0; k < filter_bytes; ++k) {
@@ -4382,6 +7214,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
             prior += 1;
         }
 
+#ifdef STBI_SSE2
+        if (simd && stbi__unfilter_row_simd(filter, cur, raw, prior, width - 1, filter_bytes, output_bytes, simd == 2))
+            raw += (width - 1)*filter_bytes;
+        else
+#endif
         // this is a little gross, so that we don't switch per-pixel or per-component
         if (depth < 8 || img_n == out_n) {
             int nk = (width - 1)*filter_bytes;
@@ -4429,6 +7266,10 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
         }
     }
 
+    // the next band's first row is filtered against this one, as it is now
+    if (a->band_prior)
+        memcpy(a->band_prior, a->out + stride*(y - 1), stride);
+
     // we make a separate pass to expand bits to pixels; for performance,
     // this could run two scanlines behind the above code, so it won't
     // intefere with filtering but will still be in the cache.
@@ -4526,12 +7367,13 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
     int bytes = (depth == 16 ? 2 : 1);
     int out_bytes = out_n * bytes;
     stbi_uc *final;
-    int p;
+    int p, out_scratch = a->out_scratch;
     if (!interlaced)
         return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
 
-    // de-interlacing
-    final = (stbi_uc *)stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
+    // de-interlacing; the passes are always temporaries
+    final = (stbi_uc *)stbi__scratch_malloc_mad3(out_scratch ? a->s->arena : NULL, a->s->img_x, a->s->img_y, out_bytes, 0);
+    a->out_scratch = 1;
     for (p = 0; p < 7; ++p) {
         int xorig[] = { 0,4,0,2,0,1,0 };
         int yorig[] = { 0,0,4,0,2,0,1 };
@@ -4544,7 +7386,8 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
         if (x && y) {
             stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
             if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-                STBI_FREE(final);
+                stbi__free(final);
+                a->out_scratch = out_scratch;
                 return 0;
             }
             for (j = 0; j < y; ++j) {
@@ -4555,20 +7398,20 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                         a->out + (j*x + i)*out_bytes, out_bytes);
                 }
             }
-            STBI_FREE(a->out);
+            stbi__free(a->out);
             image_data += img_len;
             image_data_len -= img_len;
         }
     }
     a->out = final;
+    a->out_scratch = out_scratch;
 
     return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n, stbi__uint32 pixel_count)
 {
-    stbi__context *s = z->s;
-    stbi__uint32 i, pixel_count = s->img_x * s->img_y;
+    stbi__uint32 i;
     stbi_uc *p = z->out;
 
     // compute color-based transparency, assuming we've
@@ -4591,10 +7434,9 @@ static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
     return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n)
+static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n, stbi__uint32 pixel_count)
 {
-    stbi__context *s = z->s;
-    stbi__uint32 i, pixel_count = s->img_x * s->img_y;
+    stbi__uint32 i;
     stbi__uint16 *p = (stbi__uint16*)z->out;
 
     // compute color-based transparency, assuming we've
@@ -4617,12 +7459,12 @@ static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int ou
     return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n, stbi__uint32 pixel_count)
 {
-    stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
+    stbi__uint32 i;
     stbi_uc *p, *temp_out, *orig = a->out;
 
-    p = (stbi_uc *)stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+    p = (stbi_uc *)stbi__scratch_malloc_mad2(a->out_scratch ? a->s->arena : NULL, pixel_count, pal_img_n, 0);
     if (p == NULL) return stbi__err("outofmem", "Out of memory");
 
     // between here and free(out) below, exitting would leak
@@ -4647,7 +7489,7 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
             p += 4;
         }
     }
-    STBI_FREE(a->out);
+    stbi__free(a->out);
     a->out = temp_out;
 
     STBI_NOTUSED(len);
@@ -4655,9 +7497,6 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
     return 1;
 }
 
-static int stbi__unpremultiply_on_load = 0;
-static int stbi__de_iphone_flag = 0;
-
 STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
 {
     stbi__unpremultiply_on_load = flag_true_if_should_unpremultiply;
@@ -4668,10 +7507,10 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
     stbi__de_iphone_flag = flag_true_if_should_convert;
 }
 
-static void stbi__de_iphone(stbi__png *z)
+static void stbi__de_iphone(stbi__png *z, stbi__uint32 pixel_count)
 {
     stbi__context *s = z->s;
-    stbi__uint32 i, pixel_count = s->img_x * s->img_y;
+    stbi__uint32 i;
     stbi_uc *p = z->out;
 
     if (s->img_out_n == 3) {  // convert bgr to rgb
@@ -4684,7 +7523,7 @@ static void stbi__de_iphone(stbi__png *z)
     }
     else {
         STBI_ASSERT(s->img_out_n == 4);
-        if (stbi__unpremultiply_on_load) {
+        if (s->opt.unpremultiply) {
             // convert bgr to rgb and unpremultiply
             for (i = 0; i < pixel_count; ++i) {
                 stbi_uc a = p[3];
@@ -4715,6 +7554,173 @@ static void stbi__de_iphone(stbi__png *z)
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((a) << 24) + ((b) << 16) + ((c) << 8) + (d))
 
+// Band decoding (stbi_load_bands): inflate runs in a sliding window, and
+// each time that fills, the whole rows in it are unfiltered, post-processed
+// and handed out, so only a few rows are ever decoded at once
+typedef struct
+{
+    stbi__png *z;
+    stbi_uc *palette, *tc;
+    stbi__uint16 *tc16;
+    int pal_len, pal_out_n, has_trans, de_iphone, color;
+    stbi__uint32 row_bytes, row;  // bytes per row with its filter byte, next row to unfilter
+} stbi__png_band;
+
+static int stbi__png_band_drain(void *user, char *data, int len)
+{
+    stbi__png_band *b = (stbi__png_band *)user;
+    stbi__png *z = b->z;
+    stbi__context *s = z->s;
+    stbi__uint32 rows = (stbi__uint32)len / b->row_bytes;
+    int n = s->img_out_n, ok;
+
+    if (rows > s->img_y - b->row) rows = s->img_y - b->row;
+    if (rows == 0) return 0;
+    ok = stbi__create_png_image_raw(z, (stbi_uc *)data, rows * b->row_bytes, n, s->img_x, rows, z->depth, b->color);
+    z->prior_row = z->band_prior;
+    if (ok && b->has_trans) {
+        if (z->depth == 16)
+            stbi__compute_transparency16(z, b->tc16, n, s->img_x * rows);
+        else
+            stbi__compute_transparency(z, b->tc, n, s->img_x * rows);
+    }
+    if (ok && b->de_iphone)
+        stbi__de_iphone(z, s->img_x * rows);
+    if (ok && b->pal_out_n) {
+        ok = stbi__expand_png_palette(z, b->palette, b->pal_len, b->pal_out_n, s->img_x * rows);
+        n = b->pal_out_n;
+    }
+    ok = ok && stbi__band_rows(s, z->out, n, z->depth == 16 ? 16 : 8, (int)b->row, (int)rows);
+    stbi__free(z->out);
+    z->out = NULL;
+    b->row += rows;
+    return ok ? (int)(rows * b->row_bytes) : -1;
+}
+
+static int stbi__png_decode_bands(stbi__png *z, stbi__png_band *b, stbi__uint32 idata_len, int parse_header)
+{
+    stbi__context *s = z->s;
+    stbi__zbuf a;
+    int window, ok;
+
+    b->row_bytes = ((s->img_n * s->img_x * z->depth + 7) >> 3) + 1;
+    b->row = 0;
+    // room for the 32k of history, a stored block of up to 64k, and a few
+    // rows; no more than the whole image, which then never has to slide
+    if (!stbi__mad2sizes_valid((int)b->row_bytes, 4, 32768 + 65536)) return stbi__err("too large", "Corrupt PNG");
+    window = (int)b->row_bytes * 4 + 32768 + 65536;
+    if ((stbi__uint32)window / b->row_bytes >= s->img_y) window = (int)(b->row_bytes * s->img_y);
+    if (!stbi__band_begin(s, s->img_x, s->img_y)) return 0;
+    z->expanded = (stbi_uc *)stbi__scratch_malloc(s->arena, window);
+    if (!z->expanded) return stbi__err("outofmem", "Out of memory");
+    z->band_prior = (stbi_uc *)stbi__scratch_malloc_mad3(s->arena, s->img_x, s->img_out_n, z->depth == 16 ? 2 : 1, 0);
+    if (!z->band_prior) return stbi__err("outofmem", "Out of memory");
+    z->out_scratch = 0; // each band's rows are freed before the next are made
+
+    memset(&a, 0, sizeof(a));
+    a.zbuffer = z->idata;
+    a.zbuffer_end = z->idata + idata_len;
+    a.zout_start = a.zout = (char *)z->expanded;
+    a.zout_end = a.zout_start + window;
+    a.arena = s->arena;
+    a.drain = stbi__png_band_drain;
+    a.drain_user = b;
+
+    ok = stbi__parse_zlib(&a, parse_header);
+    if (ok) {
+        int left = (int)(a.zout - a.zout_start) - a.drained;
+        int used = stbi__png_band_drain(b, a.zout_start + a.drained, left);
+        if (used < 0)
+            ok = 0;
+        else if (used != left || b->row != s->img_y)
+            ok = stbi__err("not enough pixels", "Corrupt PNG");
+    }
+    z->prior_row = NULL;
+    stbi__free(z->band_prior);
+    z->band_prior = NULL;
+    return ok;
+}
+
+#ifndef STBI_NO_PNG_PIPELINE
+// Pipelined decode: two tasks from stbi_load_options::parallel_for, one
+// inflating into the final-size buffer, one unfiltering rows as they are
+// published. The first task to start takes the inflate side, so a
+// parallel_for that runs tasks one after another still works, serially.
+typedef struct
+{
+    stbi__png *z;
+    stbi__zbuf zbuf;
+    stbi__zprogress progress;
+    stbi__uint32 raw_len;
+    int parse_header, out_n, color;
+    volatile long started;
+    int unfilter_ok;
+} stbi__png_pipeline;
+
+static void stbi__png_pipeline_task(void *task_data, int index)
+{
+    stbi__png_pipeline *p = (stbi__png_pipeline *)task_data;
+    STBI_NOTUSED(index);
+    if (stbi__atomic_increment(&p->started) == 1) {
+        int ok = stbi__parse_zlib(&p->zbuf, p->parse_header)
+            && p->zbuf.zout == p->progress.limit;
+        if (ok)
+            stbi__atomic_store(&p->progress.available, (long)p->raw_len);
+        stbi__atomic_store(&p->progress.state, ok ? 1 : -1);
+    }
+    else {
+        p->unfilter_ok = stbi__create_png_image_raw(p->z, (stbi_uc *)p->zbuf.zout_start, p->raw_len, p->out_n,
+            p->z->s->img_x, p->z->s->img_y, p->z->depth, p->color);
+    }
+}
+
+// returns 1 with z->out and z->expanded filled in, or 0 if the caller
+// should take the serial path (which also reproduces any error)
+static int stbi__png_decode_pipelined(stbi__png *z, stbi__uint32 idata_len, int parse_header, int out_n, int color, int interlace)
+{
+    stbi__context *s = z->s;
+    stbi__png_pipeline p;
+    stbi__uint32 row_bytes;
+
+    if (!s->opt.parallel_for || interlace)
+        return 0;
+    row_bytes = ((s->img_n * s->img_x * z->depth + 7) >> 3) + 1;
+    if (!stbi__mul2sizes_valid((int)row_bytes, (int)s->img_y))
+        return 0;
+    p.raw_len = row_bytes * s->img_y;
+    z->expanded = (stbi_uc *)stbi__scratch_malloc(s->arena, p.raw_len);
+    if (!z->expanded)
+        return 0;
+
+    memset(&p.zbuf, 0, sizeof(p.zbuf));
+    p.zbuf.zbuffer = z->idata;
+    p.zbuf.zbuffer_end = z->idata + idata_len;
+    p.zbuf.zout_start = p.zbuf.zout = (char *)z->expanded;
+    p.zbuf.progress = &p.progress;
+    p.progress.available = 0;
+    p.progress.state = 0;
+    p.progress.limit = (char *)z->expanded + p.raw_len;
+    p.progress.band = row_bytes * 4 > 16384 ? (int)row_bytes * 4 : 16384;
+    p.zbuf.zout_end = p.progress.limit - p.zbuf.zout > p.progress.band ? p.zbuf.zout + p.progress.band : p.progress.limit;
+    p.z = z;
+    p.parse_header = parse_header;
+    p.out_n = out_n;
+    p.color = color;
+    p.started = 0;
+    p.unfilter_ok = 0;
+
+    z->progress = &p.progress;
+    s->opt.parallel_for(s->opt.parallel_user, 2, stbi__png_pipeline_task, &p);
+    z->progress = NULL;
+
+    if (p.unfilter_ok && p.progress.state == 1)
+        return 1;
+    stbi__free(z->out);      z->out = NULL;
+    stbi__free(z->expanded); z->expanded = NULL;
+    return 0;
+}
+#endif
+
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 {
     stbi_uc palette[1024], pal_img_n = 0;
@@ -4819,8 +7825,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                 if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                 while (ioff + c.length > idata_limit)
                     idata_limit *= 2;
-                STBI_NOTUSED(idata_limit_old);
-                p = (stbi_uc *)STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+                p = (stbi_uc *)stbi__scratch_realloc(s->arena, z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                 z->idata = p;
             }
             if (!stbi__getn(s, z->idata + ioff, c.length)) return stbi__err("outofdata", "Corrupt PNG");
@@ -4836,33 +7841,62 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *)stbi_zlib_decode_malloc_guesssize_headerflag((char *)z->idata, ioff, raw_len, (int *)&raw_len, !is_iphone);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) || has_trans)
                 s->img_out_n = s->img_n + 1;
             else
                 s->img_out_n = s->img_n;
-            if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            // indices are expanded below, and stbi__do_png (or stbi__store_into) converts when the channels still differ
+            z->out_scratch = pal_img_n || (req_comp && req_comp != s->img_out_n) || s->into;
+            if (s->band && !interlace && !stbi__cropping(s)) {
+                stbi__png_band b;
+                b.z = z;
+                b.palette = palette;
+                b.pal_len = pal_len;
+                b.pal_out_n = !pal_img_n ? 0 : req_comp >= 3 ? req_comp : pal_img_n;
+                b.has_trans = has_trans;
+                b.tc = tc;
+                b.tc16 = tc16;
+                b.de_iphone = is_iphone && s->opt.convert_iphone_png && s->img_out_n > 2;
+                b.color = color;
+                if (!stbi__png_decode_bands(z, &b, ioff, !is_iphone)) return 0;
+                if (pal_img_n) {
+                    s->img_n = pal_img_n;
+                    s->img_out_n = b.pal_out_n;
+                }
+                return 1;
+            }
+#ifndef STBI_NO_PNG_PIPELINE
+            if (stbi__png_decode_pipelined(z, ioff, !is_iphone, s->img_out_n, color, interlace)) {
+                stbi__free(z->idata); z->idata = NULL;
+            }
+            else
+#endif
+            {
+                z->expanded = (stbi_uc *)stbi__zlib_decode_scratch(s->arena, (char *)z->idata, ioff, raw_len, (int *)&raw_len, !is_iphone);
+                if (z->expanded == NULL) return 0; // zlib should set error
+                stbi__free(z->idata); z->idata = NULL;
+                if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            }
             if (has_trans) {
                 if (z->depth == 16) {
-                    if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
+                    if (!stbi__compute_transparency16(z, tc16, s->img_out_n, s->img_x * s->img_y)) return 0;
                 }
                 else {
-                    if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
+                    if (!stbi__compute_transparency(z, tc, s->img_out_n, s->img_x * s->img_y)) return 0;
                 }
             }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
-                stbi__de_iphone(z);
+            if (is_iphone && s->opt.convert_iphone_png && s->img_out_n > 2)
+                stbi__de_iphone(z, s->img_x * s->img_y);
             if (pal_img_n) {
                 // pal_img_n == 3 or 4
                 s->img_n = pal_img_n; // record the actual colors we had
                 s->img_out_n = pal_img_n;
                 if (req_comp >= 3) s->img_out_n = req_comp;
-                if (!stbi__expand_png_palette(z, palette, pal_len, s->img_out_n))
+                z->out_scratch = (req_comp && req_comp != s->img_out_n) || s->into;
+                if (!stbi__expand_png_palette(z, palette, pal_len, s->img_out_n, s->img_x * s->img_y))
                     return 0;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
+            stbi__free(z->expanded); z->expanded = NULL;
             return 1;
         }
 
@@ -4899,11 +7933,17 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
             ri->bits_per_channel = p->depth;
         result = p->out;
         p->out = NULL;
-        if (req_comp && req_comp != p->s->img_out_n) {
+        if (p->s->band && !result) {
+            result = p->s->band->buf; // the rows went out as bands
+        }
+        else if (req_comp && req_comp != p->s->img_out_n && p->s->into) {
+            ri->num_channels = p->s->img_out_n; // stbi__store_into converts while it copies
+        }
+        else if (req_comp && req_comp != p->s->img_out_n) {
             if (ri->bits_per_channel == 8)
-                result = stbi__convert_format((unsigned char *)result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+                result = stbi__convert_format(p->s, ri, (unsigned char *)result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
             else
-                result = stbi__convert_format16((stbi__uint16 *)result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+                result = stbi__convert_format16(p->s, ri, (stbi__uint16 *)result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
             p->s->img_out_n = req_comp;
             if (result == NULL) return result;
         }
@@ -4911,9 +7951,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
         *y = p->s->img_y;
         if (n) *n = p->s->img_n;
     }
-    STBI_FREE(p->out);      p->out = NULL;
-    STBI_FREE(p->expanded); p->expanded = NULL;
-    STBI_FREE(p->idata);    p->idata = NULL;
+    stbi__free(p->out);      p->out = NULL;
+    stbi__free(p->expanded); p->expanded = NULL;
+    stbi__free(p->idata);    p->idata = NULL;
 
     return result;
 }
@@ -4922,6 +7962,11 @@ static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req
 {
     stbi__png p;
     p.s = s;
+    p.out_scratch = 0;
+    p.prior_row = p.band_prior = NULL;
+#ifndef STBI_NO_PNG_PIPELINE
+    p.progress = NULL;
+#endif
     return stbi__do_png(&p, x, y, comp, req_comp, ri);
 }
 
@@ -4949,6 +7994,9 @@ static int stbi__png_info(stbi__context *s, int *x, int *y, int *comp)
 {
     stbi__png p;
     p.s = s;
+#ifndef STBI_NO_PNG_PIPELINE
+    p.progress = NULL;
+#endif
     return stbi__png_info_raw(&p, x, y, comp);
 }
 #endif
@@ -5121,7 +8169,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
     unsigned int mr = 0, mg = 0, mb = 0, ma = 0, all_a;
     stbi_uc pal[256][4];
     int psize = 0, i, j, width;
-    int flip_vertically, pad, target;
+    int flip_vertically, pad, target, band;
     stbi__bmp_data info;
     STBI_NOTUSED(ri);
 
@@ -5157,11 +8205,16 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
     if (!stbi__mad3sizes_valid(target, s->img_x, s->img_y, 0))
         return stbi__errpuc("too large", "Corrupt BMP");
 
-    out = (stbi_uc *)stbi__malloc_mad3(target, s->img_x, s->img_y, 0);
+    // for stbi_load_bands rows go out one at a time, unless an alpha channel
+    // may turn out to be all 0s and need replacing at the end, or there is a
+    // crop to cut out of the whole image
+    band = s->band && (target != 4 || all_a != 0) && !stbi__cropping(s);
+    if (band && !stbi__band_begin(s, s->img_x, s->img_y)) return NULL;
+    out = (stbi_uc *)stbi__malloc_mad3(target, s->img_x, band ? 1 : s->img_y, 0);
     if (!out) return stbi__errpuc("outofmem", "Out of memory");
     if (info.bpp < 16) {
         int z = 0;
-        if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+        if (psize == 0 || psize > 256) { stbi__free(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
         for (i = 0; i < psize; ++i) {
             pal[i][2] = stbi__get8(s);
             pal[i][1] = stbi__get8(s);
@@ -5172,7 +8225,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
         stbi__skip(s, info.offset - 14 - info.hsz - psize * (info.hsz == 12 ? 3 : 4));
         if (info.bpp == 4) width = (s->img_x + 1) >> 1;
         else if (info.bpp == 8) width = s->img_x;
-        else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+        else { stbi__free(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
         pad = (-width) & 3;
         for (j = 0; j < (int)s->img_y; ++j) {
             for (i = 0; i < (int)s->img_x; i += 2) {
@@ -5193,6 +8246,10 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
                 if (target == 4) out[z++] = 255;
             }
             stbi__skip(s, pad);
+            if (band) {
+                if (!stbi__band_rows(s, out, target, 8, flip_vertically ? (int)s->img_y - 1 - j : j, 1)) { stbi__free(out); return NULL; }
+                z = 0;
+            }
         }
     }
     else {
@@ -5212,7 +8269,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
                 easy = 2;
         }
         if (!easy) {
-            if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+            if (!mr || !mg || !mb) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
             // right shift amt to put high bit in position #7
             rshift = stbi__high_bit(mr) - 7; rcount = stbi__bitcount(mr);
             gshift = stbi__high_bit(mg) - 7; gcount = stbi__bitcount(mg);
@@ -5246,27 +8303,32 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
                 }
             }
             stbi__skip(s, pad);
+            if (band) {
+                if (!stbi__band_rows(s, out, target, 8, flip_vertically ? (int)s->img_y - 1 - j : j, 1)) { stbi__free(out); return NULL; }
+                z = 0;
+            }
         }
     }
 
+    if (band) {
+        stbi__free(out);
+        *x = s->img_x;
+        *y = s->img_y;
+        if (comp) *comp = s->img_n;
+        return s->band->buf;
+    }
+
     // if alpha channel is all 0s, replace with all 255s
     if (target == 4 && all_a == 0)
         for (i = 4 * s->img_x*s->img_y - 1; i >= 0; i -= 4)
             out[i] = 255;
 
-    if (flip_vertically) {
-        stbi_uc t;
-        for (j = 0; j < (int)s->img_y >> 1; ++j) {
-            stbi_uc *p1 = out + j     *s->img_x*target;
-            stbi_uc *p2 = out + (s->img_y - 1 - j)*s->img_x*target;
-            for (i = 0; i < (int)s->img_x*target; ++i) {
-                t = p1[i], p1[i] = p2[i], p2[i] = t;
-            }
-        }
-    }
+    // a bottom-up file already is in flip_vertically order
+    if (flip_vertically && !stbi__fold_flip(s, ri))
+        stbi__vertical_flip(out, s->img_x, s->img_y, target);
 
     if (req_comp && req_comp != target) {
-        out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y);
+        out = stbi__convert_format(s, ri, out, target, req_comp, s->img_x, s->img_y);
         if (out == NULL) return out; // stbi__convert_format frees input on failure
     }
 
@@ -5416,6 +8478,17 @@ static void stbi__tga_read_rgb16(stbi__context *s, stbi_uc* out)
     // so let's treat all 15 and 16bit TGAs as RGB with no alpha.
 }
 
+// BGR(A) to RGB(A)
+static void stbi__tga_swap_rb(stbi_uc *p, int pixels, int comp)
+{
+    int i;
+    for (i = 0; i < pixels; ++i, p += comp) {
+        stbi_uc temp = p[0];
+        p[0] = p[2];
+        p[2] = temp;
+    }
+}
+
 static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
     //   read in the TGA header stuff
@@ -5442,6 +8515,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
     int RLE_count = 0;
     int RLE_repeating = 0;
     int read_next_pixel = 1;
+    int swap_rb, band;
     STBI_NOTUSED(ri);
 
     //   do a tiny bit of precessing
@@ -5467,8 +8541,13 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
     if (!stbi__mad3sizes_valid(tga_width, tga_height, tga_comp, 0))
         return stbi__errpuc("too large", "Corrupt TGA");
 
-    tga_data = (unsigned char*)stbi__malloc_mad3(tga_width, tga_height, tga_comp, 0);
+    // for stbi_load_bands only one row is kept, and each goes out when it's
+    // done, unless there is a crop to cut out of the whole image
+    band = s->band && !stbi__cropping(s);
+    if (band && !stbi__band_begin(s, tga_width, tga_height)) return NULL;
+    tga_data = (unsigned char*)stbi__malloc_mad3(tga_width, band ? 1 : tga_height, tga_comp, 0);
     if (!tga_data) return stbi__errpuc("outofmem", "Out of memory");
+    swap_rb = tga_comp >= 3 && !tga_rgb16; // RGB16 is already in the right order
 
     // skip to the data's starting position (offset usually = 0)
     stbi__skip(s, tga_offset);
@@ -5476,8 +8555,15 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
     if (!tga_indexed && !tga_is_RLE && !tga_rgb16) {
         for (i = 0; i < tga_height; ++i) {
             int row = tga_inverted ? tga_height - i - 1 : i;
-            stbi_uc *tga_row = tga_data + row*tga_width*tga_comp;
+            stbi_uc *tga_row = band ? tga_data : tga_data + row*tga_width*tga_comp;
             stbi__getn(s, tga_row, tga_width * tga_comp);
+            if (band) {
+                if (swap_rb) stbi__tga_swap_rb(tga_row, tga_width, tga_comp);
+                if (!stbi__band_rows(s, tga_row, tga_comp, 8, row, 1)) {
+                    stbi__free(tga_data);
+                    return NULL;
+                }
+            }
         }
     }
     else {
@@ -5487,9 +8573,9 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
             //   any data to skip? (offset usually = 0)
             stbi__skip(s, tga_palette_start);
             //   load the palette
-            tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
+            tga_palette = (unsigned char*)stbi__scratch_malloc_mad2(s->arena, tga_palette_len, tga_comp, 0);
             if (!tga_palette) {
-                STBI_FREE(tga_data);
+                stbi__free(tga_data);
                 return stbi__errpuc("outofmem", "Out of memory");
             }
             if (tga_rgb16) {
@@ -5501,8 +8587,8 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                 }
             }
             else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-                STBI_FREE(tga_data);
-                STBI_FREE(tga_palette);
+                stbi__free(tga_data);
+                stbi__free(tga_palette);
                 return stbi__errpuc("bad palette", "Corrupt TGA");
             }
         }
@@ -5561,14 +8647,30 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
             } // end of reading a pixel
 
               // copy data
-            for (j = 0; j < tga_comp; ++j)
-                tga_data[i*tga_comp + j] = raw_data[j];
+            if (band) {
+                int col = i % tga_width;
+                for (j = 0; j < tga_comp; ++j)
+                    tga_data[col*tga_comp + j] = raw_data[j];
+                if (col == tga_width - 1) {
+                    int row = tga_inverted ? tga_height - 1 - i / tga_width : i / tga_width;
+                    if (swap_rb) stbi__tga_swap_rb(tga_data, tga_width, tga_comp);
+                    if (!stbi__band_rows(s, tga_data, tga_comp, 8, row, 1)) {
+                        stbi__free(tga_data);
+                        stbi__free(tga_palette);
+                        return NULL;
+                    }
+                }
+            }
+            else {
+                for (j = 0; j < tga_comp; ++j)
+                    tga_data[i*tga_comp + j] = raw_data[j];
+            }
 
             //   in case we're in RLE mode, keep counting down
             --RLE_count;
         }
         //   do I need to invert the image?
-        if (tga_inverted)
+        if (tga_inverted && !band)
         {
             for (j = 0; j * 2 < tga_height; ++j)
             {
@@ -5587,26 +8689,23 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
         //   clear my palette, if I had one
         if (tga_palette != NULL)
         {
-            STBI_FREE(tga_palette);
+            stbi__free(tga_palette);
         }
     }
 
-    // swap RGB - if the source data was RGB16, it already is in the right order
-    if (tga_comp >= 3 && !tga_rgb16)
-    {
-        unsigned char* tga_pixel = tga_data;
-        for (i = 0; i < tga_width * tga_height; ++i)
-        {
-            unsigned char temp = tga_pixel[0];
-            tga_pixel[0] = tga_pixel[2];
-            tga_pixel[2] = temp;
-            tga_pixel += tga_comp;
-        }
+    // the bands have already gone out
+    if (band) {
+        stbi__free(tga_data);
+        return s->band->buf;
     }
 
+    // swap RGB - if the source data was RGB16, it already is in the right order
+    if (swap_rb)
+        stbi__tga_swap_rb(tga_data, tga_width * tga_height, tga_comp);
+
     // convert to target component count
     if (req_comp && req_comp != tga_comp)
-        tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height);
+        tga_data = stbi__convert_format(s, ri, tga_data, tga_comp, req_comp, tga_width, tga_height);
 
     //   the things I do to get rid of an error message, and yet keep
     //   Microsoft's C compilers happy... [8^(
@@ -5779,7 +8878,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
             else {
                 // Read the RLE data.
                 if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-                    STBI_FREE(out);
+                    stbi__free(out);
                     return stbi__errpuc("corrupt", "bad RLE data");
                 }
             }
@@ -5861,9 +8960,9 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
     // convert to desired output format
     if (req_comp && req_comp != 4) {
         if (ri->bits_per_channel == 16)
-            out = (stbi_uc *)stbi__convert_format16((stbi__uint16 *)out, 4, req_comp, w, h);
+            out = (stbi_uc *)stbi__convert_format16(s, ri, (stbi__uint16 *)out, 4, req_comp, w, h);
         else
-            out = stbi__convert_format(out, 4, req_comp, w, h);
+            out = stbi__convert_format(s, ri, out, 4, req_comp, w, h);
         if (out == NULL) return out; // stbi__convert_format frees input on failure
     }
 
@@ -6071,13 +9170,13 @@ static void *stbi__pic_load(stbi__context *s, int *px, int *py, int *comp, int r
     memset(result, 0xff, x*y * 4);
 
     if (!stbi__pic_load_core(s, x, y, comp, result)) {
-        STBI_FREE(result);
+        stbi__free(result);
         result = 0;
     }
     *px = x;
     *py = y;
     if (req_comp == 0) req_comp = *comp;
-    result = stbi__convert_format(result, 4, req_comp, x, y);
+    result = stbi__convert_format(s, ri, result, 4, req_comp, x, y);
 
     return result;
 }
@@ -6104,11 +9203,15 @@ typedef struct
 typedef struct
 {
     int w, h;
-    stbi_uc *out, *old_out;             // output buffer (always 4 components)
+    stbi_uc *out;                       // the canvas (always 4 components)
+    stbi_uc *old_out;                   // what a "dispose to previous" frame restores, allocated on first use
+    int frames;                         // frames drawn on out since the header
+    int animate;                        // frames after the first will be drawn too
     int flags, bgindex, ratio, transparent, eflags, delay;
-    stbi_uc  pal[256][4];
+    stbi_uc  pal[256][4];               // RGBA
     stbi_uc lpal[256][4];
     stbi__gif_lzw codes[4096];
+    stbi_uc string[4096];               // the code being drawn, last pixel first
     stbi_uc *color_table;
     int parse, step;
     int lflags;
@@ -6139,9 +9242,9 @@ static void stbi__gif_parse_colortable(stbi__context *s, stbi_uc pal[256][4], in
 {
     int i;
     for (i = 0; i < num_entries; ++i) {
-        pal[i][2] = stbi__get8(s);
-        pal[i][1] = stbi__get8(s);
         pal[i][0] = stbi__get8(s);
+        pal[i][1] = stbi__get8(s);
+        pal[i][2] = stbi__get8(s);
         pal[i][3] = transp == i ? 0 : 255;
     }
 }
@@ -6178,46 +9281,55 @@ static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
 {
     stbi__gif* g = (stbi__gif*)stbi__malloc(sizeof(stbi__gif));
     if (!stbi__gif_header(s, g, comp, 1)) {
-        STBI_FREE(g);
+        stbi__free(g);
         stbi__rewind(s);
         return 0;
     }
     if (x) *x = g->w;
     if (y) *y = g->h;
-    STBI_FREE(g);
+    stbi__free(g);
     return 1;
 }
 
 static void stbi__out_gif_code(stbi__gif *g, stbi__uint16 code)
 {
-    stbi_uc *p, *c;
-
-    // recurse to decode the prefixes, since the linked-list is backwards,
-    // and working backwards through an interleaved image would be nasty
-    if (g->codes[code].prefix >= 0)
-        stbi__out_gif_code(g, g->codes[code].prefix);
-
-    if (g->cur_y >= g->max_y) return;
-
-    p = &g->out[g->cur_x + g->cur_y];
-    c = &g->color_table[g->codes[code].suffix * 4];
+    int n = 0;
 
-    if (c[3] >= 128) {
-        p[0] = c[2];
-        p[1] = c[1];
-        p[2] = c[0];
-        p[3] = c[3];
-    }
-    g->cur_x += 4;
+    // the linked-list is backwards, and working backwards through an
+    // interleaved image would be nasty, so gather the string first. Every
+    // prefix is an older code, so it holds at most 4096 pixels.
+    for (;;) {
+        g->string[n++] = g->codes[code].suffix;
+        if (g->codes[code].prefix < 0) break;
+        code = (stbi__uint16)g->codes[code].prefix;
+    }
+
+    while (n > 0) {
+        stbi_uc *p;
+        int run;
+
+        if (g->cur_y >= g->max_y) return;
+
+        // as much of the string as fits on this row
+        p = &g->out[g->cur_x + g->cur_y];
+        run = (g->max_x - g->cur_x) >> 2;
+        if (run > n) run = n;
+        g->cur_x += run * 4;
+        for (; run > 0; --run, p += 4) {
+            stbi_uc *c = &g->color_table[g->string[--n] * 4];
+            if (c[3] >= 128)
+                memcpy(p, c, 4);
+        }
 
-    if (g->cur_x >= g->max_x) {
-        g->cur_x = g->start_x;
-        g->cur_y += g->step;
+        if (g->cur_x >= g->max_x) {
+            g->cur_x = g->start_x;
+            g->cur_y += g->step;
 
-        while (g->cur_y >= g->max_y && g->parse > 0) {
-            g->step = (1 << g->parse) * g->line_size;
-            g->cur_y = g->start_y + (g->step >> 1);
-            --g->parse;
+            while (g->cur_y >= g->max_y && g->parse > 0) {
+                g->step = (1 << g->parse) * g->line_size;
+                g->cur_y = g->start_y + (g->step >> 1);
+                --g->parse;
+            }
         }
     }
 }
@@ -6314,50 +9426,61 @@ static void stbi__fill_gif_background(stbi__gif *g, int x0, int y0, int x1, int
     for (y = y0; y < y1; y += 4 * g->w) {
         for (x = x0; x < x1; x += 4) {
             stbi_uc *p = &g->out[y + x];
-            p[0] = c[2];
+            p[0] = c[0];
             p[1] = c[1];
-            p[2] = c[0];
+            p[2] = c[2];
             p[3] = 0;
         }
     }
 }
 
-// this function is designed to support animated gifs, although stb_image doesn't support it
-static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, int req_comp)
+// reads the header and allocates the canvas
+static int stbi__gif_start(stbi__context *s, stbi__gif *g, int *comp)
 {
-    int i;
-    stbi_uc *prev_out = 0;
-
-    if (g->out == 0 && !stbi__gif_header(s, g, comp, 0))
+    if (!stbi__gif_header(s, g, comp, 0))
         return 0; // stbi__g_failure_reason set by stbi__gif_header
 
     if (!stbi__mad3sizes_valid(g->w, g->h, 4, 0))
-        return stbi__errpuc("too large", "GIF too large");
+        return stbi__err("too large", "GIF too large");
 
-    prev_out = g->out;
     g->out = (stbi_uc *)stbi__malloc_mad3(4, g->w, g->h, 0);
-    if (g->out == 0) return stbi__errpuc("outofmem", "Out of memory");
+    if (g->out == 0) return stbi__err("outofmem", "Out of memory");
+    return 1;
+}
+
+// Draws the next frame of the gif on g->out, over the previous one once
+// that is disposed of as its graphic control extension asked, so the
+// canvas is only allocated once. Returns g->out, (stbi_uc *)s after the
+// last frame, or NULL on error.
+static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, int req_comp)
+{
+    int i;
+
+    if (g->out == 0 && !stbi__gif_start(s, g, comp))
+        return 0;
 
-    switch ((g->eflags & 0x1C) >> 2) {
-    case 0: // unspecified (also always used on 1st frame)
+    if (g->frames == 0)
         stbi__fill_gif_background(g, 0, 0, 4 * g->w, 4 * g->w * g->h);
-        break;
-    case 1: // do not dispose
-        if (prev_out) memcpy(g->out, prev_out, 4 * g->w * g->h);
-        g->old_out = prev_out;
-        break;
-    case 2: // dispose to background
-        if (prev_out) memcpy(g->out, prev_out, 4 * g->w * g->h);
-        stbi__fill_gif_background(g, g->start_x, g->start_y, g->max_x, g->max_y);
-        break;
-    case 3: // dispose to previous
-        if (g->old_out) {
-            for (i = g->start_y; i < g->max_y; i += 4 * g->w)
-                memcpy(&g->out[i + g->start_x], &g->old_out[i + g->start_x], g->max_x - g->start_x);
+    else {
+        switch ((g->eflags & 0x1C) >> 2) {
+        case 2: // dispose to background
+            stbi__fill_gif_background(g, g->start_x, g->start_y, g->max_x, g->max_y);
+            break;
+        case 3: // dispose to previous
+            if (g->old_out) {
+                for (i = g->start_y; i < g->max_y; i += 4 * g->w)
+                    memcpy(&g->out[i + g->start_x], &g->old_out[i + g->start_x], g->max_x - g->start_x);
+            }
+            break;
+        default: // unspecified or do not dispose: the next frame draws over it
+            break;
         }
-        break;
     }
 
+    // a graphic control extension only applies to the image after it
+    g->eflags = 0;
+    g->delay = 0;
+
     for (;;) {
         switch (stbi__get8(s)) {
         case 0x2C: /* Image Descriptor */
@@ -6381,6 +9504,16 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
             g->cur_x = g->start_x;
             g->cur_y = g->start_y;
 
+            // keep what this frame covers when it will be taken off again
+            if ((g->eflags & 0x1C) == 0x0C && g->animate) {
+                if (g->old_out == 0) {
+                    g->old_out = (stbi_uc *)stbi__malloc_mad3(4, g->w, g->h, 0);
+                    if (g->old_out == 0) return stbi__errpuc("outofmem", "Out of memory");
+                }
+                for (i = g->start_y; i < g->max_y; i += g->line_size)
+                    memcpy(&g->old_out[i + g->start_x], &g->out[i + g->start_x], g->max_x - g->start_x);
+            }
+
             g->lflags = stbi__get8(s);
 
             if (g->lflags & 0x40) {
@@ -6412,6 +9545,7 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
             if (prev_trans != -1)
                 g->pal[g->transparent][3] = (stbi_uc)prev_trans;
 
+            ++g->frames;
             return o;
         }
 
@@ -6449,7 +9583,7 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
 static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
     stbi_uc *u = 0;
-    stbi__gif* g = (stbi__gif*)stbi__malloc(sizeof(stbi__gif));
+    stbi__gif* g = (stbi__gif*)stbi__scratch_malloc(s->arena, sizeof(stbi__gif));
     memset(g, 0, sizeof(*g));
     STBI_NOTUSED(ri);
 
@@ -6459,11 +9593,11 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
         *x = g->w;
         *y = g->h;
         if (req_comp && req_comp != 4)
-            u = stbi__convert_format(u, 4, req_comp, g->w, g->h);
+            u = stbi__convert_format(s, ri, u, 4, req_comp, g->w, g->h);
     }
     else if (g->out)
-        STBI_FREE(g->out);
-    STBI_FREE(g);
+        stbi__free(g->out);
+    stbi__free(g);
     return u;
 }
 
@@ -6471,6 +9605,136 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
     return stbi__gif_info_raw(s, x, y, comp);
 }
+
+struct stbi_gif_stream
+{
+    stbi__context s;
+    stbi__gif g;
+#ifndef STBI_NO_STDIO
+    FILE *f;            // NULL unless opened from a file
+    long f_start;       // where the gif starts in f, for rewinding
+    int close_f;        // f was opened by stbi_gif_stream_open
+#endif
+    int done;           // the last frame or an error was returned
+};
+
+static stbi_gif_stream *stbi__gif_stream_alloc(void)
+{
+    stbi_gif_stream *gif = (stbi_gif_stream *)stbi__malloc(sizeof(stbi_gif_stream));
+    if (gif == NULL) return (stbi_gif_stream *)stbi__errpuc("outofmem", "Out of memory");
+    memset(gif, 0, sizeof(*gif));
+    gif->g.animate = 1;
+    return gif;
+}
+
+static stbi_gif_stream *stbi__gif_stream_start(stbi_gif_stream *gif, int *x, int *y)
+{
+    if (!stbi__gif_start(&gif->s, &gif->g, NULL)) {
+        stbi_gif_stream_close(gif);
+        return NULL;
+    }
+    if (x) *x = gif->g.w;
+    if (y) *y = gif->g.h;
+    return gif;
+}
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+    stbi_gif_stream *gif = stbi__gif_stream_alloc();
+    if (gif == NULL) return NULL;
+    stbi__start_mem(&gif->s, buffer, len);
+    return stbi__gif_stream_start(gif, x, y);
+}
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y)
+{
+    stbi_gif_stream *gif = stbi__gif_stream_alloc();
+    if (gif == NULL) return NULL;
+    stbi__start_callbacks(&gif->s, (stbi_io_callbacks *)clbk, user);
+    return stbi__gif_stream_start(gif, x, y);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(char const *filename, int *x, int *y)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    stbi_gif_stream *gif;
+    if (!f) return (stbi_gif_stream *)stbi__errpuc("can't fopen", "Unable to open file");
+    gif = stbi_gif_stream_open_file(f, x, y);
+    if (gif == NULL)
+        fclose(f);
+    else
+        gif->close_f = 1;
+    return gif;
+}
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open_file(FILE *f, int *x, int *y)
+{
+    stbi_gif_stream *gif = stbi__gif_stream_alloc();
+    if (gif == NULL) return NULL;
+    gif->f = f;
+    gif->f_start = ftell(f);
+    stbi__start_file(&gif->s, f);
+    return stbi__gif_stream_start(gif, x, y);
+}
+#endif
+
+STBIDEF stbi_uc const *stbi_gif_stream_next(stbi_gif_stream *gif, int *delay_ms)
+{
+    stbi_uc *u;
+    if (gif->done) return NULL;
+    u = stbi__gif_load_next(&gif->s, &gif->g, NULL, 4);
+    if (u == NULL || u == (stbi_uc *)&gif->s) {
+        gif->done = 1;
+        return NULL;
+    }
+    if (delay_ms) *delay_ms = gif->g.delay * 10;
+    return u;
+}
+
+STBIDEF int stbi_gif_stream_rewind(stbi_gif_stream *gif)
+{
+    int w = gif->g.w, h = gif->g.h;
+    if (gif->s.read_from_callbacks) {
+#ifndef STBI_NO_STDIO
+        if (gif->f && gif->f_start >= 0 && fseek(gif->f, gif->f_start, SEEK_SET) == 0)
+            stbi__start_file(&gif->s, gif->f);
+        else
+#endif
+            return stbi__err("can't rewind", "Can't rewind a GIF stream read through callbacks");
+    }
+    else
+        stbi__rewind(&gif->s);
+
+    // the canvas is kept, so the gif has to be the one it was opened with
+    gif->done = 1;
+    if (!stbi__gif_header(&gif->s, &gif->g, NULL, 0)) return 0;
+    if (gif->g.w != w || gif->g.h != h) {
+        gif->g.w = w;
+        gif->g.h = h;
+        return stbi__err("gif changed", "GIF changed size");
+    }
+    gif->g.frames = 0;
+    gif->g.eflags = 0;
+    gif->done = 0;
+    return 1;
+}
+
+STBIDEF void stbi_gif_stream_close(stbi_gif_stream *gif)
+{
+    if (gif == NULL) return;
+#ifndef STBI_NO_STDIO
+    if (gif->close_f)
+        fclose(gif->f);
+    else if (gif->f) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(gif->f, -(int)(gif->s.img_buffer_end - gif->s.img_buffer), SEEK_CUR);
+    }
+#endif
+    stbi__free(gif->g.out);
+    stbi__free(gif->g.old_out);
+    stbi__free(gif);
+}
 #endif
 
 // *************************************************************************************************
@@ -6634,16 +9898,16 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                 stbi__hdr_convert(hdr_data, rgbe, req_comp);
                 i = 1;
                 j = 0;
-                STBI_FREE(scanline);
+                stbi__free(scanline);
                 goto main_decode_loop; // yes, this makes no sense
             }
             len <<= 8;
             len |= stbi__get8(s);
-            if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
+            if (len != width) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
             if (scanline == NULL) {
-                scanline = (stbi_uc *)stbi__malloc_mad2(width, 4, 0);
+                scanline = (stbi_uc *)stbi__scratch_malloc_mad2(s->arena, width, 4, 0);
                 if (!scanline) {
-                    STBI_FREE(hdr_data);
+                    stbi__free(hdr_data);
                     return stbi__errpf("outofmem", "Out of memory");
                 }
             }
@@ -6657,13 +9921,13 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                         // Run
                         value = stbi__get8(s);
                         count -= 128;
-                        if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                        if (count > nleft) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                         for (z = 0; z < count; ++z)
                             scanline[i++ * 4 + k] = value;
                     }
                     else {
                         // Dump
-                        if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                        if (count > nleft) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                         for (z = 0; z < count; ++z)
                             scanline[i++ * 4 + k] = stbi__get8(s);
                     }
@@ -6673,7 +9937,7 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                 stbi__hdr_convert(hdr_data + (j*width + i)*req_comp, scanline + i * 4, req_comp);
         }
         if (scanline)
-            STBI_FREE(scanline);
+            stbi__free(scanline);
     }
 
     return hdr_data;
@@ -6871,7 +10135,7 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
     stbi__getn(s, out, s->img_n * s->img_x * s->img_y);
 
     if (req_comp && req_comp != s->img_n) {
-        out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y);
+        out = stbi__convert_format(s, ri, out, s->img_n, req_comp, s->img_x, s->img_y);
         if (out == NULL) return out; // stbi__convert_format frees input on failure
     }
     return out;
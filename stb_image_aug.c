@@ -98,6 +98,13 @@ typedef unsigned int   uint;
 // should produce compiler error if size is wrong
 typedef unsigned char validate_uint32[sizeof(uint32)==4];
 
+// SSE2 PNG unfiltering, when the compiler targets it (always on x64);
+// define STBI_NO_SSE2 to leave it out
+#if !defined(STBI_NO_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBI_SSE2
+#include <emmintrin.h>
+#endif
+
 #if defined(STBI_NO_STDIO) && !defined(STBI_NO_WRITE)
 #define STBI_NO_WRITE
 #endif
@@ -139,9 +146,36 @@ static int e(char *str)
 #define epf(x,y)   ((float *) (e(x,y)?NULL:NULL))
 #define epuc(x,y)  ((unsigned char *) (e(x,y)?NULL:NULL))
 
+static stbi_allocator allocator;
+
+void stbi_set_allocator(stbi_allocator const *alloc)
+{
+   if (alloc) allocator = *alloc;
+   else       memset(&allocator, 0, sizeof(allocator));
+}
+
+static void *heap_malloc(size_t size)
+{
+   if (allocator.malloc_fn) return allocator.malloc_fn(allocator.user, size);
+   return malloc(size);
+}
+
+static void *heap_realloc(void *p, size_t old_size, size_t new_size)
+{
+   if (allocator.realloc_fn) return allocator.realloc_fn(allocator.user, p, old_size, new_size);
+   return realloc(p, new_size);
+}
+
+static void heap_free(void *p)
+{
+   if (p == NULL) return;
+   if (allocator.free_fn) allocator.free_fn(allocator.user, p);
+   else                   free(p);
+}
+
 void stbi_image_free(void *retval_from_stbi_load)
 {
-   free(retval_from_stbi_load);
+   heap_free(retval_from_stbi_load);
 }
 
 #define MAX_LOADERS  32
@@ -475,9 +509,9 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
    if (req_comp == img_n) return data;
    assert(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) malloc(req_comp * x * y);
+   good = (unsigned char *) heap_malloc(req_comp * x * y);
    if (good == NULL) {
-      free(data);
+      heap_free(data);
       return epuc("outofmem", "Out of memory");
    }
 
@@ -507,7 +541,7 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
       #undef CASE
    }
 
-   free(data);
+   heap_free(data);
    return good;
 }
 
@@ -515,8 +549,8 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
 static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
-   float *output = (float *) malloc(x * y * comp * sizeof(float));
-   if (output == NULL) { free(data); return epf("outofmem", "Out of memory"); }
+   float *output = (float *) heap_malloc(x * y * comp * sizeof(float));
+   if (output == NULL) { heap_free(data); return epf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -525,7 +559,7 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
       }
       if (k < comp) output[i*comp + k] = data[i*comp+k]/255.0f;
    }
-   free(data);
+   heap_free(data);
    return output;
 }
 
@@ -533,8 +567,8 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
-   stbi_uc *output = (stbi_uc *) malloc(x * y * comp);
-   if (output == NULL) { free(data); return epuc("outofmem", "Out of memory"); }
+   stbi_uc *output = (stbi_uc *) heap_malloc(x * y * comp);
+   if (output == NULL) { heap_free(data); return epuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -551,7 +585,7 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = float2int(z);
       }
    }
-   free(data);
+   heap_free(data);
    return output;
 }
 #endif
@@ -1239,10 +1273,10 @@ static int process_frame_header(jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
       z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
+      z->img_comp[i].raw_data = heap_malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
-            free(z->img_comp[i].raw_data);
+            heap_free(z->img_comp[i].raw_data);
             z->img_comp[i].data = NULL;
          }
          return e("outofmem", "Out of memory");
@@ -1423,11 +1457,11 @@ static void cleanup_jpeg(jpeg *j)
    int i;
    for (i=0; i < j->s.img_n; ++i) {
       if (j->img_comp[i].data) {
-         free(j->img_comp[i].raw_data);
+         heap_free(j->img_comp[i].raw_data);
          j->img_comp[i].data = NULL;
       }
       if (j->img_comp[i].linebuf) {
-         free(j->img_comp[i].linebuf);
+         heap_free(j->img_comp[i].linebuf);
          j->img_comp[i].linebuf = NULL;
       }
    }
@@ -1475,7 +1509,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
 
          // allocate line buffer big enough for upsampling off the edges
          // with upsample factor of 4
-         z->img_comp[k].linebuf = (uint8 *) malloc(z->s.img_x + 3);
+         z->img_comp[k].linebuf = (uint8 *) heap_malloc(z->s.img_x + 3);
          if (!z->img_comp[k].linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
@@ -1493,7 +1527,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
       }
 
       // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s.img_x * z->s.img_y + 1);
+      output = (uint8 *) heap_malloc(n * z->s.img_x * z->s.img_y + 1);
       if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
@@ -1762,7 +1796,7 @@ static int expand(zbuf *z, int n)  // need to make room for n bytes
    limit = (int) (z->zout_end - z->zout_start);
    while (cur + n > limit)
       limit *= 2;
-   q = (char *) realloc(z->zout_start, limit);
+   q = (char *) heap_realloc(z->zout_start, z->zout_end - z->zout_start, limit);
    if (q == NULL) return e("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -1955,7 +1989,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) heap_malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -1963,7 +1997,7 @@ char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      heap_free(a.zout_start);
       return NULL;
    }
 }
@@ -1987,7 +2021,7 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(16384);
+   char *p = (char *) heap_malloc(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer+len;
@@ -1995,7 +2029,7 @@ char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      heap_free(a.zout_start);
       return NULL;
    }
 }
@@ -2075,6 +2109,117 @@ static int paeth(int a, int b, int c)
    return c;
 }
 
+#ifdef STBI_SSE2
+// SIMD unfiltering goes a pixel at a time, since Sub, Avg and Paeth depend
+// on the pixel to the left. in is the pixel size in raw (3 or 4), out the
+// pixel stride in cur and prior; when out is 4 and in 3 the alpha is 255.
+__forceinline static __m128i load_px(uint8 const *p, int n)
+{
+   int v;
+   if (n == 3) return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+   memcpy(&v, p, 4);
+   return _mm_cvtsi32_si128(v);
+}
+
+__forceinline static void store_px(uint8 *p, __m128i x, int n)
+{
+   int v = _mm_cvtsi128_si32(x);
+   if (n == 3) {
+      p[0] = (uint8) v;
+      p[1] = (uint8) (v >> 8);
+      p[2] = (uint8) (v >> 16);
+   } else
+      memcpy(p, &v, 4);
+}
+
+// wide moves 3-byte pixels as 4 bytes, the extra one landing in the next
+// pixel, which is written after; the last pixel of a row is moved exactly
+__forceinline static __m128i unfilter_span_sse2(int filter, __m128i a, uint8 *cur, uint8 const *raw, uint8 const *prior, int pixels, int in, int out, int wide)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i fill = in == out ? zero : _mm_cvtsi32_si128((int) 0xff000000);
+   int load_in = wide ? 4 : in, move_out = wide ? 4 : out;
+   int i;
+   switch (filter) {
+      case F_none:
+         for (i=0; i < pixels; ++i, raw+=in, cur+=out) {
+            a = _mm_or_si128(load_px(raw, load_in), fill);
+            store_px(cur, a, move_out);
+         }
+         break;
+      case F_sub:
+         for (i=0; i < pixels; ++i, raw+=in, cur+=out) {
+            a = _mm_or_si128(_mm_add_epi8(load_px(raw, load_in), a), fill);
+            store_px(cur, a, move_out);
+         }
+         break;
+      case F_up:
+         for (i=0; i < pixels; ++i, raw+=in, cur+=out, prior+=out) {
+            a = _mm_or_si128(_mm_add_epi8(load_px(raw, load_in), load_px(prior, move_out)), fill);
+            store_px(cur, a, move_out);
+         }
+         break;
+      case F_avg: {
+         // _mm_avg_epu8 rounds up; take back the 1 where the sum is odd
+         __m128i one = _mm_set1_epi8(1);
+         for (i=0; i < pixels; ++i, raw+=in, cur+=out, prior+=out) {
+            __m128i b = load_px(prior, move_out);
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_or_si128(_mm_add_epi8(load_px(raw, load_in), avg), fill);
+            store_px(cur, a, move_out);
+         }
+         break;
+      }
+      case F_paeth: {
+         // paeth() in 16-bit lanes: with p = a + b - c, |p-a| = |b-c|,
+         // |p-b| = |a-c| and |p-c| = |(b-c) + (a-c)|
+         __m128i a16 = _mm_unpacklo_epi8(a, zero);
+         __m128i c16 = _mm_unpacklo_epi8(load_px(prior - out, out), zero);
+         for (i=0; i < pixels; ++i, raw+=in, cur+=out, prior+=out) {
+            __m128i b16 = _mm_unpacklo_epi8(load_px(prior, move_out), zero);
+            __m128i bc = _mm_sub_epi16(b16, c16), ac = _mm_sub_epi16(a16, c16), abc = _mm_add_epi16(bc, ac);
+            __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+            __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+            __m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+            // a unless b is strictly closer, then c if strictly closer still
+            __m128i m = _mm_cmplt_epi16(pb, pa);
+            __m128i pred = _mm_or_si128(_mm_andnot_si128(m, a16), _mm_and_si128(m, b16));
+            m = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+            pred = _mm_or_si128(_mm_andnot_si128(m, pred), _mm_and_si128(m, c16));
+            a = _mm_or_si128(_mm_add_epi8(load_px(raw, load_in), _mm_packus_epi16(pred, zero)), fill);
+            store_px(cur, a, move_out);
+            a16 = _mm_unpacklo_epi8(a, zero);
+            c16 = b16;
+         }
+         break;
+      }
+   }
+   return a;
+}
+
+__forceinline static void unfilter_sse2(int filter, uint8 *cur, uint8 const *raw, uint8 const *prior, int pixels, int in, int out)
+{
+   __m128i a = load_px(cur - out, out);
+   if (pixels > 1)
+      a = unfilter_span_sse2(filter, a, cur, raw, prior, pixels-1, in, out, 1);
+   pixels -= 1;
+   unfilter_span_sse2(filter, a, cur + pixels*out, raw + pixels*in, prior + pixels*out, 1, in, out, 0);
+}
+
+// unfilters all but the first pixel of a row; 0 to leave it to the loops
+// in create_png_image
+static int unfilter_row_sse2(int filter, uint8 *cur, uint8 const *raw, uint8 const *prior, int pixels, int in, int out)
+{
+   if (filter > F_paeth || (filter == F_none && in == out)) return 0;
+   if (pixels <= 0) return 1;
+   if (in == 3 && out == 3) unfilter_sse2(filter, cur, raw, prior, pixels, 3, 3);
+   else if (in == 3 && out == 4) unfilter_sse2(filter, cur, raw, prior, pixels, 3, 4);
+   else if (in == 4 && out == 4) unfilter_sse2(filter, cur, raw, prior, pixels, 4, 4);
+   else return 0;
+   return 1;
+}
+#endif
+
 // create the png data from post-deflated data
 static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n)
 {
@@ -2083,7 +2228,7 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n)
    int k;
    int img_n = s->img_n; // copy it into a local for later
    assert(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (uint8 *) malloc(s->img_x * s->img_y * out_n);
+   a->out = (uint8 *) heap_malloc(s->img_x * s->img_y * out_n);
    if (!a->out) return e("outofmem", "Out of memory");
    if (raw_len != (img_n * s->img_x + 1) * s->img_y) return e("not enough pixels","Corrupt PNG");
    for (j=0; j < s->img_y; ++j) {
@@ -2109,6 +2254,12 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n)
       raw += img_n;
       cur += out_n;
       prior += out_n;
+      #ifdef STBI_SSE2
+      if (unfilter_row_sse2(filter, cur, raw, prior, s->img_x-1, img_n, out_n)) {
+         raw += (s->img_x-1) * img_n;
+         continue;
+      }
+      #endif
       // this is a little gross, so that we don't switch per-pixel or per-component
       if (img_n == out_n) {
          #define CASE(f) \
@@ -2176,7 +2327,7 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
    uint32 i, pixel_count = a->s.img_x * a->s.img_y;
    uint8 *p, *temp_out, *orig = a->out;
 
-   p = (uint8 *) malloc(pixel_count * pal_img_n);
+   p = (uint8 *) heap_malloc(pixel_count * pal_img_n);
    if (p == NULL) return e("outofmem", "Out of memory");
 
    // between here and free(out) below, exitting would leak
@@ -2200,7 +2351,7 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
          p += 4;
       }
    }
-   free(a->out);
+   heap_free(a->out);
    a->out = temp_out;
    return 1;
 }
@@ -2285,11 +2436,12 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (pal_img_n && !pal_len) return e("no PLTE","Corrupt PNG");
             if (scan == SCAN_header) { s->img_n = pal_img_n; return 1; }
             if (ioff + c.length > idata_limit) {
+               uint32 idata_limit_old = idata_limit;
                uint8 *p;
                if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
-               p = (uint8 *) realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
+               p = (uint8 *) heap_realloc(z->idata, idata_limit_old, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
                z->idata = p;
             }
             #ifndef STBI_NO_STDIO
@@ -2313,7 +2465,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
             z->expanded = (uint8 *) stbi_zlib_decode_malloc((char *) z->idata, ioff, (int *) &raw_len);
             if (z->expanded == NULL) return 0; // zlib should set error
-            free(z->idata); z->idata = NULL;
+            heap_free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
@@ -2329,7 +2481,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
                if (!expand_palette(z, palette, pal_len, s->img_out_n))
                   return 0;
             }
-            free(z->expanded); z->expanded = NULL;
+            heap_free(z->expanded); z->expanded = NULL;
             return 1;
          }
 
@@ -2373,9 +2525,9 @@ static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
       *y = p->s.img_y;
       if (n) *n = p->s.img_n;
    }
-   free(p->out);      p->out      = NULL;
-   free(p->expanded); p->expanded = NULL;
-   free(p->idata);    p->idata    = NULL;
+   heap_free(p->out);      p->out      = NULL;
+   heap_free(p->expanded); p->expanded = NULL;
+   heap_free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -2595,11 +2747,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       target = req_comp;
    else
       target = s->img_n; // if they want monochrome, we'll post-convert
-   out = (stbi_uc *) malloc(target * s->img_x * s->img_y);
+   out = (stbi_uc *) heap_malloc(target * s->img_x * s->img_y);
    if (!out) return epuc("outofmem", "Out of memory");
    if (bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { free(out); return epuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { heap_free(out); return epuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = get8(s);
          pal[i][1] = get8(s);
@@ -2610,7 +2762,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       skip(s, offset - 14 - hsz - psize * (hsz == 12 ? 3 : 4));
       if (bpp == 4) width = (s->img_x + 1) >> 1;
       else if (bpp == 8) width = s->img_x;
-      else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
+      else { heap_free(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
          for (i=0; i < (int) s->img_x; i += 2) {
@@ -2834,7 +2986,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	force a new number of components
 		*comp = tga_bits_per_pixel/8;
 	}
-	tga_data = (unsigned char*)malloc( tga_width * tga_height * req_comp );
+	tga_data = (unsigned char*)heap_malloc( tga_width * tga_height * req_comp );
 
 	//	skip to the data's starting position (offset usually = 0)
 	skip(s, tga_offset );
@@ -2844,7 +2996,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	any data to skip? (offset usually = 0)
 		skip(s, tga_palette_start );
 		//	load the palette
-		tga_palette = (unsigned char*)malloc( tga_palette_len * tga_palette_bits / 8 );
+		tga_palette = (unsigned char*)heap_malloc( tga_palette_len * tga_palette_bits / 8 );
 		getn(s, tga_palette, tga_palette_len * tga_palette_bits / 8 );
 	}
 	//	load the data
@@ -2978,7 +3130,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	//	clear my palette, if I had one
 	if( tga_palette != NULL )
 	{
-		free( tga_palette );
+		heap_free( tga_palette );
 	}
 	//	the things I do to get rid of an error message, and yet keep
 	//	Microsoft's C compilers happy... [8^(
@@ -3106,7 +3258,7 @@ static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		return epuc("bad compression", "PSD has an unknown compression format");
 
 	// Create the destination image.
-	out = (stbi_uc *) malloc(4 * w*h);
+	out = (stbi_uc *) heap_malloc(4 * w*h);
 	if (!out) return epuc("outofmem", "Out of memory");
    pixelCount = w*h;
 
@@ -3358,7 +3510,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	if (req_comp == 0) req_comp = 3;
 
 	// Read data
-	hdr_data = (float *) malloc(height * width * req_comp * sizeof(float));
+	hdr_data = (float *) heap_malloc(height * width * req_comp * sizeof(float));
 
 	// Load image data
    // image data is stored as some number of sca
@@ -3387,13 +3539,13 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            free(scanline);
+            heap_free(scanline);
             goto main_decode_loop; // yes, this is fucking insane; blame the fucking insane format
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(hdr_data); free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) scanline = (stbi_uc *) malloc(width * 4);
+         if (len != width) { heap_free(hdr_data); heap_free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
+         if (scanline == NULL) scanline = (stbi_uc *) heap_malloc(width * 4);
 
 			for (k = 0; k < 4; ++k) {
 				i = 0;
@@ -3415,7 +3567,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          for (i=0; i < width; ++i)
             hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
 		}
-      free(scanline);
+      heap_free(scanline);
 	}
 
    return hdr_data;
@@ -3466,7 +3618,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
 	req_comp = 4;
 
 	// Read data
-	rgbe_data = (stbi_uc *) malloc(height * width * req_comp * sizeof(stbi_uc));
+	rgbe_data = (stbi_uc *) heap_malloc(height * width * req_comp * sizeof(stbi_uc));
 	//	point to the beginning
 	scanline = rgbe_data;
 
@@ -3502,7 +3654,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { heap_free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
 			for (k = 0; k < 4; ++k) {
 				i = 0;
 				while (i < width) {
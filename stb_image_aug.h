@@ -157,6 +157,7 @@
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif
+#include <stddef.h>
 
 #define STBI_VERSION 1
 
@@ -216,9 +217,21 @@ extern void   stbi_ldr_to_hdr_scale(float scale);
 // NOT THREADSAFE
 extern char    *stbi_failure_reason  (void); 
 
-// free the loaded image -- this is just free()
+// free the loaded image -- this is just free(), or free_fn below
 extern void     stbi_image_free      (void *retval_from_stbi_load);
 
+// replace malloc/realloc/free at run time; set all three, and do it before
+// loading anything. NULL goes back to the C library.
+typedef struct
+{
+   void *(*malloc_fn)(void *user, size_t size);
+   void *(*realloc_fn)(void *user, void *p, size_t old_size, size_t new_size);
+   void  (*free_fn)(void *user, void *p);
+   void *user;
+} stbi_allocator;
+
+extern void     stbi_set_allocator   (stbi_allocator const *alloc);
+
 // get image dimensions & components without fully decoding
 extern int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
 extern int      stbi_is_hdr_from_memory(stbi_uc const *buffer, int len);
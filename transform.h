@@ -0,0 +1,187 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "linmath.h"
+
+#include <algorithm>
+#include <vector>
+
+// Parent/child transforms stored flat in depth-first order: every node is
+// followed by its whole subtree, so a subtree is the contiguous index range
+// [index, subtreeEnd). Setters only mark a node dirty; Update() walks the
+// dirty subtrees once, front to back, so parents are always done before
+// their children and untouched parts of the hierarchy cost nothing.
+class TransformHierarchy
+{
+public:
+	typedef int Handle;  // stable across insertions, unlike the internal index
+
+	// Adds a node with identity local transform under parent (-1 for a root)
+	Handle AddNode(Handle parent = -1)
+	{
+		int index;
+		int parentIndex = parent < 0 ? -1 : handleToIndex[parent];
+		if (parentIndex < 0)
+		{
+			index = (int)locals.size();
+		}
+		else
+		{
+			// insert at the end of the parent's subtree to keep depth-first order
+			index = subtreeEnd[parentIndex];
+			for (int a = parentIndex; a >= 0; a = parents[a])
+				subtreeEnd[a]++;  // every ancestor's subtree grows by one
+			for (int i = index; i < (int)locals.size(); i++)
+				subtreeEnd[i]++;  // nodes shifted one slot to the right
+			for (int i = 0; i < (int)locals.size(); i++)
+				if (parents[i] >= index)
+					parents[i]++;
+			for (size_t h = 0; h < handleToIndex.size(); h++)
+				if (handleToIndex[h] >= index)
+					handleToIndex[h]++;
+		}
+
+		Local local;
+		vec3 zero = { 0.f, 0.f, 0.f };
+		std::memcpy(local.translation, zero, sizeof(zero));
+		quat_identity(local.rotation);
+		local.scale[0] = local.scale[1] = local.scale[2] = 1.f;
+
+		Matrix identity;
+		mat4x4_identity(identity.m);
+
+		Handle handle = (Handle)handleToIndex.size();
+		handleToIndex.push_back(index);
+		locals.insert(locals.begin() + index, local);
+		localMatrices.insert(localMatrices.begin() + index, identity);
+		worldMatrices.insert(worldMatrices.begin() + index, identity);
+		parents.insert(parents.begin() + index, parentIndex);
+		subtreeEnd.insert(subtreeEnd.begin() + index, index + 1);
+		localDirty.insert(localDirty.begin() + index, (unsigned char)1);
+		indexToHandle.insert(indexToHandle.begin() + index, handle);
+		dirtyHandles.push_back(handle);
+		return handle;
+	}
+
+	void SetTranslation(Handle h, float x, float y, float z)
+	{
+		float* t = locals[handleToIndex[h]].translation;
+		t[0] = x; t[1] = y; t[2] = z;
+		MarkDirty(h);
+	}
+
+	void SetRotation(Handle h, quat q)
+	{
+		std::memcpy(locals[handleToIndex[h]].rotation, q, sizeof(quat));
+		MarkDirty(h);
+	}
+
+	void SetScale(Handle h, float x, float y, float z)
+	{
+		float* s = locals[handleToIndex[h]].scale;
+		s[0] = x; s[1] = y; s[2] = z;
+		MarkDirty(h);
+	}
+
+	// Valid after Update()
+	vec4 const* GetWorldMatrix(Handle h) const
+	{
+		return worldMatrices[handleToIndex[h]].m;
+	}
+
+	Handle GetParent(Handle h) const
+	{
+		int p = parents[handleToIndex[h]];
+		return p < 0 ? -1 : indexToHandle[p];
+	}
+
+	int NodeCount() const
+	{
+		return (int)locals.size();
+	}
+
+	// Recomputes world matrices of dirty nodes and their descendants.
+	// Returns the number of world matrices rebuilt.
+	int Update()
+	{
+		if (dirtyHandles.empty())
+			return 0;
+
+		std::vector<int> roots;
+		roots.reserve(dirtyHandles.size());
+		for (size_t i = 0; i < dirtyHandles.size(); i++)
+			roots.push_back(handleToIndex[dirtyHandles[i]]);
+		dirtyHandles.clear();
+		std::sort(roots.begin(), roots.end());
+
+		int rebuilt = 0;
+		int coveredEnd = 0;
+		for (size_t r = 0; r < roots.size(); r++)
+		{
+			int first = roots[r];
+			if (first < coveredEnd)
+				continue;  // already inside a subtree done in this pass
+			coveredEnd = subtreeEnd[first];
+			for (int i = first; i < coveredEnd; i++)
+			{
+				if (localDirty[i])
+				{
+					BuildLocal(i);
+					localDirty[i] = 0;
+				}
+				if (parents[i] < 0)
+					mat4x4_dup(worldMatrices[i].m, localMatrices[i].m);
+				else
+					mat4x4_mul(worldMatrices[i].m, worldMatrices[parents[i]].m, localMatrices[i].m);
+			}
+			rebuilt += coveredEnd - first;
+		}
+		return rebuilt;
+	}
+
+private:
+	struct Local
+	{
+		vec3 translation;
+		quat rotation;
+		vec3 scale;
+	};
+	struct Matrix
+	{
+		mat4x4 m;
+	};
+
+	std::vector<Local> locals;
+	std::vector<Matrix> localMatrices;
+	std::vector<Matrix> worldMatrices;
+	std::vector<int> parents;        // index of the parent, -1 for roots
+	std::vector<int> subtreeEnd;     // one past the last descendant
+	std::vector<unsigned char> localDirty;
+	std::vector<Handle> indexToHandle;
+	std::vector<int> handleToIndex;
+	std::vector<Handle> dirtyHandles;
+
+	void MarkDirty(Handle h)
+	{
+		int i = handleToIndex[h];
+		if (!localDirty[i])
+		{
+			localDirty[i] = 1;
+			dirtyHandles.push_back(h);
+		}
+	}
+
+	// local = T * R * S
+	void BuildLocal(int i)
+	{
+		Local& l = locals[i];
+		mat4x4 r;
+		mat4x4_from_quat(r, l.rotation);
+		mat4x4_scale_aniso(localMatrices[i].m, r, l.scale[0], l.scale[1], l.scale[2]);
+		localMatrices[i].m[3][0] = l.translation[0];
+		localMatrices[i].m[3][1] = l.translation[1];
+		localMatrices[i].m[3][2] = l.translation[2];
+	}
+};
+
+#endif